@@ -0,0 +1,651 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+
+/* latency histogram: exact below 64 usec, then 32 sub-buckets per
+   power of two, so percentiles are within about 3% */
+#define BENCH_SUB_BITS      5
+#define BENCH_SUB           (1 << BENCH_SUB_BITS)
+#define BENCH_BUCKETS       (40 * BENCH_SUB)
+
+#define BENCH_MAX_DEPTH     64
+#define BENCH_RECV_LEN      65536
+#define BENCH_MAX_PATHS     32
+
+enum {
+    BENCH_HEAD,
+    BENCH_BODY,
+    BENCH_CHUNK_SIZE,
+    BENCH_CHUNK_DATA,
+    BENCH_CHUNK_TRAILER
+};
+
+typedef struct {
+    unsigned long long buckets[BENCH_BUCKETS];
+    unsigned long long requests;
+    unsigned long long errors;
+    unsigned long long bytes;
+    unsigned long long connects;
+    unsigned long long max;
+} bench_stats;
+
+typedef struct {
+    int fd;
+    int state;
+    int close_next;
+    int close_after;
+    long long body_left;
+    unsigned long long sent[BENCH_MAX_DEPTH];
+    int sent_head;
+    int outstanding;
+    char *out;
+    int out_len;
+    int out_pos;
+    char in[BENCH_RECV_LEN];
+    int in_len;
+} bench_conn;
+
+typedef struct {
+    pthread_t thread;
+    int num_conns;
+    unsigned int next_path;
+    bench_stats stats;
+} bench_thread;
+
+
+/* the run, as parsed from the command line */
+struct sockaddr_storage bench_addr;
+socklen_t bench_addr_len = 0;
+int bench_keepalive = 1;
+int bench_depth = 1;
+double bench_warmup = 1.0;
+double bench_duration = 10.0;
+unsigned long long bench_start = 0;
+unsigned long long bench_measure = 0;
+unsigned long long bench_end = 0;
+char *bench_requests[BENCH_MAX_PATHS];
+int bench_request_lens[BENCH_MAX_PATHS];
+int bench_num_paths = 0;
+
+/* the test/ assets plus a path only the wildcard page answers */
+const char *bench_default_paths[] = {
+    "/index.html", "/style.css", "/WWWlogo.png", "/favicon.ico", "/wildcard"
+};
+
+
+unsigned long long bench_nsec(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+int bench_bucket(unsigned long long usec) {
+    int msb = 0;
+    int n = 0;
+    
+    if (usec < 2 * BENCH_SUB) {
+        n = (int) usec;
+    } else {
+        msb = 63 - __builtin_clzll(usec);
+        n = (msb - BENCH_SUB_BITS) * BENCH_SUB + (int) (usec >> (msb - BENCH_SUB_BITS));
+        if (n >= BENCH_BUCKETS) {
+            n = BENCH_BUCKETS - 1;
+        }
+    }
+    
+    return n;
+}
+
+
+/* the largest latency a bucket holds */
+unsigned long long bench_bucket_max(int n) {
+    unsigned long long usec = n;
+    int shift = 0;
+    
+    if (n >= 2 * BENCH_SUB) {
+        shift = (n >> BENCH_SUB_BITS) - 1;
+        usec = ((unsigned long long) (n - shift * BENCH_SUB) + 1) << shift;
+        usec--;
+    }
+    
+    return usec;
+}
+
+
+unsigned long long bench_percentile(const bench_stats *stats, double pct) {
+    unsigned long long want = 0;
+    unsigned long long seen = 0;
+    int n = 0;
+    
+    want = (unsigned long long) (stats->requests * pct / 100.0 + 0.5);
+    if (want == 0) {
+        want = 1;
+    }
+    for (n = 0; n < BENCH_BUCKETS; n++) {
+        seen += stats->buckets[n];
+        if (seen >= want) {
+            break;
+        }
+    }
+    
+    return (n < BENCH_BUCKETS) ? bench_bucket_max(n) : stats->max;
+}
+
+
+int bench_connect(bench_thread *thread, bench_conn *conn, int epfd) {
+    struct epoll_event event;
+    int one = 1;
+    int rc = -1;
+    
+    conn->fd = socket(bench_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn->fd >= 0) {
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if ((connect(conn->fd, (struct sockaddr *) &bench_addr, bench_addr_len) == 0) ||
+            (errno == EINPROGRESS)) {
+            conn->state = BENCH_HEAD;
+            conn->close_next = 0;
+            conn->close_after = 0;
+            conn->outstanding = 0;
+            conn->sent_head = 0;
+            conn->out_len = 0;
+            conn->out_pos = 0;
+            conn->in_len = 0;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.ptr = conn;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &event) == 0) {
+                thread->stats.connects++;
+                rc = 0;
+            }
+        }
+        if (rc != 0) {
+            close(conn->fd);
+            conn->fd = -1;
+        }
+    }
+    
+    return rc;
+}
+
+
+void bench_disconnect(bench_thread *thread, bench_conn *conn, unsigned long long now) {
+    /* requests pipelined past a Connection: close are dropped, not failed */
+    if ((now >= bench_measure) && !conn->close_after) {
+        thread->stats.errors += conn->outstanding;
+    }
+    close(conn->fd);
+    conn->fd = -1;
+}
+
+
+/* queue the next batch: depth requests on keep-alive, one when closing */
+void bench_fill(bench_thread *thread, bench_conn *conn, unsigned long long now) {
+    int count = bench_keepalive ? bench_depth : 1;
+    int n = 0;
+    int i = 0;
+    
+    conn->out_len = 0;
+    conn->out_pos = 0;
+    for (i = 0; i < count; i++) {
+        n = thread->next_path++ % bench_num_paths;
+        memcpy(&conn->out[conn->out_len], bench_requests[n], bench_request_lens[n]);
+        conn->out_len += bench_request_lens[n];
+        conn->sent[(conn->sent_head + conn->outstanding) % BENCH_MAX_DEPTH] = now;
+        conn->outstanding++;
+    }
+}
+
+
+int bench_write(bench_conn *conn) {
+    ssize_t n = 0;
+    int rc = 0;
+    
+    while (conn->out_pos < conn->out_len) {
+        n = send(conn->fd, &conn->out[conn->out_pos], conn->out_len - conn->out_pos,
+                 MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->out_pos += n;
+        } else {
+            if ((n < 0) && (errno != EAGAIN)) {
+                rc = -1;
+            }
+            break;
+        }
+    }
+    
+    return rc;
+}
+
+
+void bench_record(bench_thread *thread, bench_conn *conn, unsigned long long now) {
+    unsigned long long usec = 0;
+    
+    usec = (now - conn->sent[conn->sent_head]) / 1000;
+    conn->sent_head = (conn->sent_head + 1) % BENCH_MAX_DEPTH;
+    conn->outstanding--;
+    conn->close_after = conn->close_next;
+    if (now >= bench_measure) {
+        thread->stats.buckets[bench_bucket(usec)]++;
+        thread->stats.requests++;
+        if (usec > thread->stats.max) {
+            thread->stats.max = usec;
+        }
+    }
+}
+
+
+/* find the end of the line starting at pos, or -1 if it is not all here */
+int bench_line_end(const bench_conn *conn, int pos) {
+    const char *p = memchr(&conn->in[pos], '\n', conn->in_len - pos);
+    
+    return (p != NULL) ? (int) (p - conn->in) : -1;
+}
+
+
+/* parse a response header, returns bytes consumed, 0 for more, -1 on error */
+int bench_parse_head(bench_conn *conn) {
+    int status = 0;
+    int pos = 0;
+    int end = 0;
+    int rc = 0;
+    
+    end = bench_line_end(conn, 0);
+    if ((end > 0) && (sscanf(conn->in, "HTTP/1.%*d %d", &status) != 1)) {
+        rc = -1;
+    }
+    conn->body_left = 0;
+    conn->state = BENCH_BODY;
+    while ((rc == 0) && (end > 0)) {
+        pos = end + 1;
+        end = bench_line_end(conn, pos);
+        if ((end < 0) || (end - pos <= 1)) {
+            break;
+        }
+        if (strncasecmp(&conn->in[pos], "Content-Length:", 15) == 0) {
+            conn->body_left = atoll(&conn->in[pos + 15]);
+        } else if ((strncasecmp(&conn->in[pos], "Transfer-Encoding:", 18) == 0) &&
+                   (strncasecmp(&conn->in[pos + 18], " chunked", 8) == 0)) {
+            conn->state = BENCH_CHUNK_SIZE;
+        } else if ((strncasecmp(&conn->in[pos], "Connection:", 11) == 0) &&
+                   (strncasecmp(&conn->in[pos + 11], " close", 6) == 0)) {
+            conn->close_next = 1;
+        }
+    }
+    if ((rc == 0) && (end >= 0)) {
+        if ((status == 204) || (status == 304)) {
+            conn->state = BENCH_BODY;
+            conn->body_left = 0;
+        }
+        rc = end + 1;
+    } else if (rc == 0) {
+        conn->state = BENCH_HEAD;
+        if (conn->in_len == BENCH_RECV_LEN) {
+            rc = -1;
+        }
+    }
+    
+    return rc;
+}
+
+
+/* consume whole responses from the input, returns -1 on a bad response */
+int bench_parse(bench_thread *thread, bench_conn *conn, unsigned long long now) {
+    int pos = 0;
+    int end = 0;
+    int n = 0;
+    int rc = 0;
+    
+    while ((rc == 0) && (pos < conn->in_len) && !conn->close_after) {
+        if (conn->state == BENCH_HEAD) {
+            memmove(conn->in, &conn->in[pos], conn->in_len - pos);
+            conn->in_len -= pos;
+            pos = 0;
+            n = bench_parse_head(conn);
+            if (n <= 0) {
+                rc = n;
+                break;
+            }
+            pos = n;
+            if (conn->outstanding <= 0) {
+                rc = -1;
+            } else if ((conn->state == BENCH_BODY) && (conn->body_left == 0)) {
+                conn->state = BENCH_HEAD;
+                bench_record(thread, conn, now);
+            }
+        } else if ((conn->state == BENCH_BODY) || (conn->state == BENCH_CHUNK_DATA)) {
+            n = conn->in_len - pos;
+            if (n > conn->body_left) {
+                n = (int) conn->body_left;
+            }
+            pos += n;
+            conn->body_left -= n;
+            if (conn->body_left == 0) {
+                if (conn->state == BENCH_BODY) {
+                    conn->state = BENCH_HEAD;
+                    bench_record(thread, conn, now);
+                } else {
+                    conn->state = BENCH_CHUNK_SIZE;
+                }
+            }
+        } else {
+            end = bench_line_end(conn, pos);
+            if (end < 0) {
+                if (pos == 0) {
+                    rc = (conn->in_len == BENCH_RECV_LEN) ? -1 : 0;
+                }
+                break;
+            }
+            if (conn->state == BENCH_CHUNK_SIZE) {
+                /* each chunk carries its trailing CRLF as data */
+                conn->body_left = strtoll(&conn->in[pos], NULL, 16);
+                conn->state = (conn->body_left > 0) ? BENCH_CHUNK_DATA : BENCH_CHUNK_TRAILER;
+                conn->body_left += 2;
+                if (conn->state == BENCH_CHUNK_TRAILER) {
+                    conn->body_left = 0;
+                }
+            } else if (end - pos <= 1) {
+                conn->state = BENCH_HEAD;
+                bench_record(thread, conn, now);
+            }
+            pos = end + 1;
+        }
+    }
+    if (pos > 0) {
+        memmove(conn->in, &conn->in[pos], conn->in_len - pos);
+        conn->in_len -= pos;
+    }
+    
+    return rc;
+}
+
+
+int bench_read(bench_thread *thread, bench_conn *conn, unsigned long long now) {
+    ssize_t n = 0;
+    int rc = 0;
+    
+    while ((rc == 0) && !conn->close_after) {
+        n = recv(conn->fd, &conn->in[conn->in_len], BENCH_RECV_LEN - conn->in_len, 0);
+        if (n > 0) {
+            if (now >= bench_measure) {
+                thread->stats.bytes += n;
+            }
+            conn->in_len += n;
+            rc = bench_parse(thread, conn, now);
+        } else if ((n < 0) && (errno == EAGAIN)) {
+            break;
+        } else {
+            rc = -1;
+        }
+    }
+    
+    return rc;
+}
+
+
+void *bench_worker(void *arg) {
+    bench_thread *thread = arg;
+    struct epoll_event events[256];
+    bench_conn *conns = NULL;
+    bench_conn *conn = NULL;
+    unsigned long long now = 0;
+    int epfd = -1;
+    int count = 0;
+    int done = 0;
+    int i = 0;
+    
+    epfd = epoll_create1(0);
+    conns = calloc(thread->num_conns, sizeof(bench_conn));
+    for (i = 0; (conns != NULL) && (i < thread->num_conns); i++) {
+        conns[i].out = malloc(BENCH_RECV_LEN);
+        bench_connect(thread, &conns[i], epfd);
+    }
+    
+    while ((epfd >= 0) && (conns != NULL)) {
+        now = bench_nsec();
+        if (now >= bench_end) {
+            break;
+        }
+        count = epoll_wait(epfd, events, 256, 10);
+        now = bench_nsec();
+        for (i = 0; i < count; i++) {
+            conn = events[i].data.ptr;
+            done = 0;
+            if (events[i].events & EPOLLIN) {
+                done = bench_read(thread, conn, now);
+            }
+            if ((done == 0) && conn->close_after) {
+                done = 1;
+            } else if ((done == 0) && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                done = -1;
+            }
+            if ((done == 0) && (conn->outstanding == 0)) {
+                bench_fill(thread, conn, now);
+            }
+            if ((done == 0) && (bench_write(conn) != 0)) {
+                done = -1;
+            }
+            if (done != 0) {
+                if ((done < 0) && (now >= bench_measure)) {
+                    thread->stats.errors++;
+                }
+                bench_disconnect(thread, conn, now);
+                bench_connect(thread, conn, epfd);
+            }
+        }
+        /* retry sockets whose connect failed outright */
+        for (i = 0; i < thread->num_conns; i++) {
+            if (conns[i].fd < 0) {
+                bench_connect(thread, &conns[i], epfd);
+            }
+        }
+    }
+    
+    for (i = 0; (conns != NULL) && (i < thread->num_conns); i++) {
+        if (conns[i].fd >= 0) {
+            close(conns[i].fd);
+        }
+        free(conns[i].out);
+    }
+    free(conns);
+    if (epfd >= 0) {
+        close(epfd);
+    }
+    
+    return NULL;
+}
+
+
+int bench_resolve(const char *host, const char *port) {
+    struct addrinfo hints;
+    struct addrinfo *info = NULL;
+    int rc = -1;
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((getaddrinfo(host, port, &hints, &info) == 0) && (info != NULL)) {
+        memcpy(&bench_addr, info->ai_addr, info->ai_addrlen);
+        bench_addr_len = info->ai_addrlen;
+        freeaddrinfo(info);
+        rc = 0;
+    }
+    
+    return rc;
+}
+
+
+void bench_add_path(const char *host, const char *path) {
+    char request[512];
+    int n = 0;
+    
+    if (bench_num_paths < BENCH_MAX_PATHS) {
+        n = snprintf(request, sizeof(request),
+                     "GET %s HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "User-Agent: loadgen\r\n"
+                     "Accept: */*\r\n"
+                     "%s"
+                     "\r\n",
+                     path, host, bench_keepalive ? "" : "Connection: close\r\n");
+        if ((n > 0) && (n < (int) sizeof(request))) {
+            bench_requests[bench_num_paths] = strdup(request);
+            bench_request_lens[bench_num_paths] = n;
+            bench_num_paths++;
+        }
+    }
+}
+
+
+void bench_usage(void) {
+    printf("usage: loadgen [options] [path ...]\n"
+           "  -h host      server host (127.0.0.1)\n"
+           "  -p port      server port (18080)\n"
+           "  -c conns     connections (64)\n"
+           "  -t threads   client threads (1)\n"
+           "  -d seconds   measured duration (10)\n"
+           "  -w seconds   warmup before measuring (1)\n"
+           "  -P depth     pipelined requests per connection (1)\n"
+           "  -C           one request per connection, Connection: close\n"
+           "paths default to the test/ assets and a wildcard page\n");
+}
+
+
+int main(int argc, const char *argv[]) {
+    const char *host = "127.0.0.1";
+    const char *port = "18080";
+    bench_thread *threads = NULL;
+    bench_stats total;
+    double seconds = 0;
+    int num_conns = 64;
+    int num_threads = 1;
+    int i = 0;
+    int n = 0;
+    
+    for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+        if ((strcmp(argv[i], "-C") == 0)) {
+            bench_keepalive = 0;
+        } else if (i + 1 >= argc) {
+            bench_usage();
+            return 1;
+        } else if (strcmp(argv[i], "-h") == 0) {
+            host = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0) {
+            port = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0) {
+            num_conns = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            bench_duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            bench_warmup = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-P") == 0) {
+            bench_depth = atoi(argv[++i]);
+        } else {
+            bench_usage();
+            return 1;
+        }
+    }
+    if ((num_conns < 1) || (num_threads < 1) || (num_threads > num_conns) ||
+        (bench_depth < 1) || (bench_depth > BENCH_MAX_DEPTH) || (bench_duration <= 0)) {
+        bench_usage();
+        return 1;
+    }
+    for (; i < argc; i++) {
+        bench_add_path(host, argv[i]);
+    }
+    if (bench_num_paths == 0) {
+        for (i = 0; i < (int) (sizeof(bench_default_paths) / sizeof(bench_default_paths[0])); i++) {
+            bench_add_path(host, bench_default_paths[i]);
+        }
+    }
+    if (bench_resolve(host, port) != 0) {
+        fprintf(stderr, "loadgen: cannot resolve %s:%s\n", host, port);
+        return 1;
+    }
+    
+    printf("%d connections, %d threads, %s, depth %d, %d paths, %.1f s\n",
+           num_conns, num_threads, bench_keepalive ? "keep-alive" : "close",
+           bench_keepalive ? bench_depth : 1, bench_num_paths, bench_duration);
+    bench_start = bench_nsec();
+    bench_measure = bench_start + (unsigned long long) (bench_warmup * 1e9);
+    bench_end = bench_measure + (unsigned long long) (bench_duration * 1e9);
+    threads = calloc(num_threads, sizeof(bench_thread));
+    if (threads == NULL) {
+        return 1;
+    }
+    for (i = 0; i < num_threads; i++) {
+        threads[i].num_conns = num_conns / num_threads + (i < num_conns % num_threads);
+        threads[i].next_path = i;
+        pthread_create(&threads[i].thread, NULL, bench_worker, &threads[i]);
+    }
+    
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        for (n = 0; n < BENCH_BUCKETS; n++) {
+            total.buckets[n] += threads[i].stats.buckets[n];
+        }
+        total.requests += threads[i].stats.requests;
+        total.errors += threads[i].stats.errors;
+        total.bytes += threads[i].stats.bytes;
+        total.connects += threads[i].stats.connects;
+        if (threads[i].stats.max > total.max) {
+            total.max = threads[i].stats.max;
+        }
+    }
+    free(threads);
+    
+    seconds = bench_duration;
+    printf("%-10s %12llu %10.0f req/s %8.1f MB/s\n", "requests", total.requests,
+           total.requests / seconds, total.bytes / seconds / 1e6);
+    printf("%-10s %12llu connects %6llu errors\n", "sockets", total.connects, total.errors);
+    printf("%-10s p50 %llu  p99 %llu  p999 %llu  max %llu usec\n", "latency",
+           bench_percentile(&total, 50.0), bench_percentile(&total, 99.0),
+           bench_percentile(&total, 99.9), total.max);
+    
+    return (total.requests > 0) ? 0 : 1;
+}
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "httpsvr.h"
+#include "httpsvr_file.h"
+#include "httpsvr_internal.h"
+
+
+/* count allocations by standing in front of the C library's */
+#if defined (__GLIBC__)
+#  define BENCH_ALLOCS      1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+unsigned long long bench_allocs = 0;
+
+void *malloc(size_t size) {
+    bench_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    bench_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    bench_allocs++;
+    return __libc_realloc(ptr, size);
+}
+#else
+#  define BENCH_ALLOCS      0
+unsigned long long bench_allocs = 0;
+#endif
+
+
+/* what a desktop browser sends for a page asset */
+const char *bench_browser_request =
+    "GET /static/js/app.bundle.min.js?v=20240311.3 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"122\", \"Not(A:Brand\";v=\"24\", \"Google Chrome\";v=\"122\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/122.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: */*\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/account/settings/profile\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+    "Cookie: session=5f2b9c1e8a7d4e3f9b0c2d1a6e5f4b3c; _ga=GA1.2.1234567890.1700000000; theme=dark; consent=granted\r\n"
+    "\r\n";
+
+#define BENCH_GET(path)     "GET " path " HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+/* requests answered through httpsvr_process, one case per dispatch path */
+const struct {
+    const char *name;
+    const char *request;
+} bench_cases[] = {
+    { "page",       BENCH_GET("/wildcard") },
+    { "route",      BENCH_GET("/api/users/42") },
+    { "file",       BENCH_GET("/index.html") },
+    { "file 304",   "GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+                    "If-Modified-Since: Fri, 01 Jan 2100 00:00:00 GMT\r\n\r\n" },
+    { "not found",  BENCH_GET("/missing.txt") },
+    { "pipeline 8", BENCH_GET("/wildcard") BENCH_GET("/wildcard") BENCH_GET("/wildcard")
+                    BENCH_GET("/wildcard") BENCH_GET("/wildcard") BENCH_GET("/wildcard")
+                    BENCH_GET("/wildcard") BENCH_GET("/wildcard") },
+};
+
+#define BENCH_CHUNKED      "POST /wildcard HTTP/1.1\r\nHost: localhost\r\n" \
+                           "Transfer-Encoding: chunked\r\n\r\n"
+
+/* answers checked before any timing, a guard for the request parsers */
+const struct {
+    const char *request;
+    const char *status;
+} bench_checks[] = {
+    { BENCH_CHUNKED "5\r\nhello\r\n0\r\n\r\n",           "HTTP/1.1 200 " },
+    { BENCH_CHUNKED "ffffffffffffffff\r\n",                  "HTTP/1.1 413 " },
+    { BENCH_CHUNKED "7fffffffffffffffff\r\nhello\r\n",       "HTTP/1.1 413 " },
+    { BENCH_CHUNKED "5x\r\nhello\r\n0\r\n\r\n",          "HTTP/1.1 400 " },
+};
+
+const char *bench_body =
+    "<html><head><title>*</title></head><body><h1>*</h1></body></html>";
+
+
+unsigned long long bench_nsec(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+int bench_page(const char *path,
+               const char *parameters,
+               char *buffer,
+               int buffer_len) {
+    int len = 0;
+    
+    len += httpsvr_append_content_type(&buffer[len], buffer_len - len, "text/html");
+    len += httpsvr_append(&buffer[len], buffer_len - len, bench_body);
+    
+    return len;
+}
+
+
+int bench_route(const char *path,
+                const char *parameters,
+                const httpsvr_route_param *params,
+                int num_params,
+                char *buffer,
+                int buffer_len) {
+    int len = 0;
+    
+    len += httpsvr_append_content_type(&buffer[len], buffer_len - len, "text/plain");
+    if ((num_params > 0) && (buffer_len - len > 0)) {
+        len += snprintf(&buffer[len], buffer_len - len, "%.*s=%.*s\n",
+                        params[0].name_len, params[0].name,
+                        params[0].value_len, params[0].value);
+    }
+    
+    return len;
+}
+
+
+/* the fake socket, it only counts what it is given */
+int bench_sink(void *context, const char *data, int data_len) {
+    *(long long *) context += data_len;
+    return data_len;
+}
+
+
+/* keeps the start of the answer for the checks */
+int bench_capture(void *context, const char *data, int data_len) {
+    char *answer = context;
+    int len = strlen(answer);
+    int n = (data_len < 255 - len) ? data_len : 255 - len;
+    
+    memcpy(&answer[len], data, n);
+    answer[len + n] = '\0';
+    return data_len;
+}
+
+
+/* one request, copied in as a read would, scanned and split in place */
+void bench_parse(httpsvr_conn_struct *conn, const char *request, int len) {
+    memcpy(conn->recv_data, request, len);
+    conn->recv_data_len = len;
+    httpsvr_req_complete(conn);
+    httpsvr_parse_req(conn);
+    httpsvr_conn_next(conn);
+}
+
+
+/* status line, headers and body of a page response, queued and dropped */
+void bench_headers(httpsvr_conn_struct *conn) {
+    httpsvr_length_resp(conn, HTTPSVR_RESP_OK);
+    httpsvr_append_send(conn, "Content-Type: text/html\r\n\r\n");
+    httpsvr_append_send(conn, bench_body);
+    httpsvr_send(conn);
+    httpsvr_send_clear(conn);
+}
+
+
+void bench_report(const char *name, unsigned long long best, unsigned long long allocs,
+                  int iterations, long long bytes) {
+    printf("%-12s %10.1f ns/op", name, (double) best / iterations);
+    if (BENCH_ALLOCS) {
+        printf(" %8.2f allocs/op", (double) allocs / (5.0 * iterations));
+    } else {
+        printf(" %8s allocs/op", "n/a");
+    }
+    if (bytes >= 0) {
+        printf(" %8lld bytes/op", bytes);
+    }
+    printf("\n");
+}
+
+
+int main(int argc, const char *argv[]) {
+    httpsvr_handle handle = NULL;
+    httpsvr_conn_struct *conn = NULL;
+    unsigned long long start = 0;
+    unsigned long long best = 0;
+    unsigned long long allocs = 0;
+    unsigned long long t = 0;
+    const char *dir = "../test";
+    char answer[256];
+    long long bytes = 0;
+    long long sunk = 0;
+    int iterations = 100000;
+    int round = 0;
+    int len = 0;
+    int c = 0;
+    int i = 0;
+    
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        dir = argv[2];
+    }
+    
+    /* files are served from the test assets */
+    if (chdir(dir) != 0) {
+        fprintf(stderr, "procbench: cannot change to %s\n", dir);
+        return 1;
+    }
+    handle = httpsvr_init(18081, 1024, 8192, 1024, 32, 32);
+    if (handle == NULL) {
+        fprintf(stderr, "procbench: cannot create the server\n");
+        return 1;
+    }
+    httpsvr_add_file_handler(handle, "html", httpsvr_html_file_handler);
+    httpsvr_add_page_handler(handle, "*", bench_page);
+    httpsvr_add_route(handle, "GET", "/api/users/:id", bench_route);
+    conn = ((httpsvr_struct *) handle)->conn;
+    
+    for (c = 0; c < (int) (sizeof(bench_checks) / sizeof(bench_checks[0])); c++) {
+        answer[0] = '\0';
+        httpsvr_process(handle, bench_checks[c].request, strlen(bench_checks[c].request),
+                        bench_capture, answer);
+        if (strncmp(answer, bench_checks[c].status, strlen(bench_checks[c].status)) != 0) {
+            fprintf(stderr, "procbench: check %d answered \"%.12s\", not \"%s\"\n",
+                    c, answer, bench_checks[c].status);
+            return 1;
+        }
+    }
+    
+    printf("%d iterations, best of 5 rounds\n", iterations);
+    
+    /* best of several rounds, to step around interrupts */
+    len = strlen(bench_browser_request);
+    best = 0;
+    allocs = bench_allocs;
+    for (round = 0; round < 5; round++) {
+        start = bench_nsec();
+        for (i = 0; i < iterations; i++) {
+            bench_parse(conn, bench_browser_request, len);
+        }
+        t = bench_nsec() - start;
+        if ((best == 0) || (t < best)) {
+            best = t;
+        }
+    }
+    bench_report("parse", best, bench_allocs - allocs, iterations, -1);
+    
+    memcpy(conn->recv_data, bench_browser_request, len);
+    conn->recv_data_len = len;
+    httpsvr_req_complete(conn);
+    httpsvr_parse_req(conn);
+    best = 0;
+    allocs = bench_allocs;
+    for (round = 0; round < 5; round++) {
+        start = bench_nsec();
+        for (i = 0; i < iterations; i++) {
+            bench_headers(conn);
+        }
+        t = bench_nsec() - start;
+        if ((best == 0) || (t < best)) {
+            best = t;
+        }
+    }
+    bench_report("headers", best, bench_allocs - allocs, iterations, -1);
+    httpsvr_conn_reset(conn);
+    
+    for (c = 0; c < (int) (sizeof(bench_cases) / sizeof(bench_cases[0])); c++) {
+        len = strlen(bench_cases[c].request);
+        bytes = 0;
+        if (httpsvr_process(handle, bench_cases[c].request, len, bench_sink, &bytes) <= 0) {
+            printf("%-12s failed\n", bench_cases[c].name);
+            continue;
+        }
+        best = 0;
+        allocs = bench_allocs;
+        for (round = 0; round < 5; round++) {
+            start = bench_nsec();
+            for (i = 0; i < iterations; i++) {
+                httpsvr_process(handle, bench_cases[c].request, len, bench_sink, &sunk);
+            }
+            t = bench_nsec() - start;
+            if ((best == 0) || (t < best)) {
+                best = t;
+            }
+        }
+        bench_report(bench_cases[c].name, best, bench_allocs - allocs, iterations, bytes);
+    }
+    
+    return 0;
+}
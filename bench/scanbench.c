@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#  include <x86intrin.h>
+#  define BENCH_CLOCK()     __rdtsc()
+#  define BENCH_UNIT        "cycles/byte"
+#else
+#  define BENCH_CLOCK()     bench_nsec()
+#  define BENCH_UNIT        "nsec/byte"
+#endif
+
+#include "httpsvr_scan.h"
+
+
+/* what a desktop browser sends for a page asset */
+const char *bench_request =
+    "GET /static/js/app.bundle.min.js?v=20240311.3 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"122\", \"Not(A:Brand\";v=\"24\", \"Google Chrome\";v=\"122\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/122.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: */*\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/account/settings/profile\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+    "Cookie: session=5f2b9c1e8a7d4e3f9b0c2d1a6e5f4b3c; _ga=GA1.2.1234567890.1700000000; theme=dark; consent=granted\r\n"
+    "If-None-Match: \"5e1f-61a2b3c4d5e6f\"\r\n"
+    "If-Modified-Since: Mon, 11 Mar 2024 09:30:00 GMT\r\n"
+    "\r\n";
+
+
+unsigned long long bench_nsec(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/* the parser before the scanner: a byte loop per line end, then per
+   space, '?', '.', '~' and colon */
+int bench_bytewise(const char *data, int len) {
+    int marks = 0;
+    int line = 0;
+    int i = 0;
+    int j = 0;
+    
+    for (i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            for (j = line; j < i; j++) {
+                if ((data[j] == ' ') || (data[j] == ':') || (data[j] == '?') ||
+                    (data[j] == '.') || (data[j] == '~')) {
+                    marks++;
+                    if (line > 0) {
+                        break;
+                    }
+                }
+            }
+            marks++;
+            line = i + 1;
+        }
+    }
+    
+    return marks;
+}
+
+
+/* the parser now: one scan over the request finding every delimiter */
+int bench_scan(const char *data, int len) {
+    const httpsvr_scan_set *set = &httpsvr_scan_request_line;
+    int marks = 0;
+    int colon = 0;
+    int i = 0;
+    
+    while (i < len) {
+        i += httpsvr_scan(set, &data[i], len - i);
+        if (i < len) {
+            if (data[i] == '\n') {
+                set = &httpsvr_scan_header_line;
+                colon = 0;
+                marks++;
+            } else if (!colon) {
+                colon = (set == &httpsvr_scan_header_line);
+                marks++;
+            }
+        }
+        i++;
+    }
+    
+    return marks;
+}
+
+
+double bench_run(int (*func)(const char *data, int len),
+                 const char *data, int len, int iterations) {
+    unsigned long long start = 0;
+    unsigned long long best = 0;
+    unsigned long long t = 0;
+    volatile int sink = 0;
+    int round = 0;
+    int i = 0;
+    
+    /* best of several rounds, to step around interrupts */
+    for (round = 0; round < 5; round++) {
+        start = BENCH_CLOCK();
+        for (i = 0; i < iterations; i++) {
+            sink += func(data, len);
+        }
+        t = BENCH_CLOCK() - start;
+        if ((best == 0) || (t < best)) {
+            best = t;
+        }
+    }
+    
+    return (double) best / ((double) len * iterations);
+}
+
+
+int main(int argc, const char *argv[]) {
+    const char *scanners[] = { "scalar", "sse4.2", "avx2" };
+    int len = strlen(bench_request);
+    int iterations = 200000;
+    int i = 0;
+    
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    httpsvr_scan_init();
+    
+    printf("request of %d bytes, %d iterations\n", len, iterations);
+    printf("%-10s %8.3f %s\n", "bytewise",
+           bench_run(bench_bytewise, bench_request, len, iterations), BENCH_UNIT);
+    for (i = 0; i < 3; i++) {
+        if (httpsvr_scan_use(scanners[i]) == 0) {
+            printf("%-10s %8.3f %s\n", scanners[i],
+                   bench_run(bench_scan, bench_request, len, iterations), BENCH_UNIT);
+        } else {
+            printf("%-10s %8s\n", scanners[i], "n/a");
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Runs loadgen scenarios against test/testsvr on loopback.
+#
+#   scenarios.sh [seconds] [workers]
+#
+# Each scenario prints req/s and p50/p99/p999 latency; compare runs
+# on the same machine to spot regressions in request handling.
+
+SECONDS_PER_RUN=${1:-5}
+WORKERS=${2:-1}
+PORT=18080
+DIR=$(cd "$(dirname "$0")" && pwd)
+
+cd "$DIR/../test" || exit 1
+./testsvr "$WORKERS" > /dev/null 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT INT TERM
+sleep 1
+
+run() {
+    name=$1
+    shift
+    echo "== $name"
+    "$DIR/loadgen" -p $PORT -d "$SECONDS_PER_RUN" "$@"
+    echo
+}
+
+run "keep-alive, 1 connection"           -c 1
+run "keep-alive, 64 connections"         -c 64
+run "keep-alive, 256 connections"        -c 256 -t 2
+run "pipelined 16 deep, 64 connections"  -c 64 -P 16
+run "close, 32 connections"              -c 32 -C
+run "wildcard page only"                 -c 64 /wildcard
+run "largest asset only"                 -c 64 /WWWlogo.png
@@ -34,17 +34,40 @@
 
 #define HTTPSVR_USER_AGENT                  "httpsvr/1.0"
 #define HTTPSVR_WILDCARD                    "*"
+#define HTTPSVR_MAX_ROUTE_PARAMS            8
+
+/* file handler return code (negated): the buffer holds the headers and
+   the server sends file_path as the body, see httpsvr_file.h; it adds
+   ETag and Last-Modified, answers matching conditional GETs with 304
+   and Range requests with 206 */
+#define HTTPSVR_SEND_FILE                   1
 
 
 enum HTTPSVR_STATUS_CODES {
     HTTPSVR_STATUS_OK           = 200,
     HTTPSVR_STATUS_NO_CONTENT   = 204,
+    HTTPSVR_STATUS_PARTIAL      = 206,
     HTTPSVR_STATUS_MOVED        = 301,
+    HTTPSVR_STATUS_NOT_MODIFIED = 304,
     HTTPSVR_STATUS_BAD_REQUEST  = 400,
     HTTPSVR_STATUS_NOT_FOUND    = 404,
+    HTTPSVR_STATUS_TOO_LARGE    = 413,
+    HTTPSVR_STATUS_BAD_RANGE    = 416,
+    HTTPSVR_STATUS_HEADERS_TOO_LARGE = 431,
+    HTTPSVR_STATUS_SERVER_ERROR = 500,
 };
     
 
+/* log levels, each logs what the ones before it do */
+enum HTTPSVR_LOG_LEVELS {
+    HTTPSVR_LOG_OFF             = 0,
+    HTTPSVR_LOG_ERROR           = 1,
+    HTTPSVR_LOG_WARN            = 2,
+    HTTPSVR_LOG_INFO            = 3,    /* a line per request */
+    HTTPSVR_LOG_DEBUG           = 4,
+};
+
+
 typedef void *httpsvr_handle;
 
 typedef int (*httpsvr_file_handler)(const char *file_path,
@@ -57,7 +80,58 @@ typedef int (*httpsvr_page_handler)(const char *page_name,
                                     char *buffer,
                                     int buffer_len);
 
+/* called each time the connection can take more of the body, returns
+   the number of bytes written to buffer, 0 at the end of the body or
+   negative to abort; called once more with a NULL buffer when the
+   stream ends so *context can be released */
+typedef int (*httpsvr_stream_handler)(const char *page_name,
+                                      const char *parameters,
+                                      void **context,
+                                      char *buffer,
+                                      int buffer_len);
+
+/* called with each piece of a request body as it arrives, returning
+   negative to reject the request; then once with NULL data to write
+   the response into buffer, returning like a page handler; a NULL
+   buffer instead means the request was dropped, so *context can be
+   released */
+typedef int (*httpsvr_upload_handler)(const char *page_name,
+                                      const char *parameters,
+                                      void **context,
+                                      const char *data,
+                                      int data_len,
+                                      char *buffer,
+                                      int buffer_len);
+
+/* a path segment captured by a route, name and value point into the
+   route pattern and the request and are not nul terminated */
+typedef struct {
+    const char *name;
+    int         name_len;
+    const char *value;
+    int         value_len;
+} httpsvr_route_param;
+
+/* same return codes as a page handler, path is the full request path */
+typedef int (*httpsvr_route_handler)(const char *path,
+                                     const char *parameters,
+                                     const httpsvr_route_param *params,
+                                     int num_params,
+                                     char *buffer,
+                                     int buffer_len);
+
+/* takes response bytes from httpsvr_process, returns data_len or
+   negative to stop */
+typedef int (*httpsvr_sink)(void *context,
+                            const char *data,
+                            int data_len);
 
+
+/* recv_buffer_len bounds the request line and headers, which are
+   answered with 431 when they fill it; send_buffer_len bounds the
+   output of one handler call, output that fills it is answered with
+   500 rather than sent cut short; responses to pipelined requests are
+   built into more buffers as needed */
 httpsvr_handle httpsvr_init(unsigned short port,
                             int recv_buffer_len,
                             int send_buffer_len,
@@ -65,9 +139,83 @@ httpsvr_handle httpsvr_init(unsigned short port,
                             int num_file_handlers,
                             int num_page_handlers);
 
+/* sent with every response, an empty string leaves the header out,
+   set before serving */
 int  httpsvr_set_user_agent(httpsvr_handle handle,
                             const char *user_agent);
 
+/* log records up to level as logfmt lines to fd, written by a
+   background thread so requests never wait on it; records are dropped
+   when the queue is full, HTTPSVR_LOG_OFF writes out the queue and
+   stops the thread */
+int  httpsvr_set_log(httpsvr_handle handle,
+                     int level,
+                     int fd);
+
+/* allow up to max_requests per connection (1 disables keep-alive) and
+   close connections idle for idle_timeout msec (0 disables) */
+int  httpsvr_set_keep_alive(httpsvr_handle handle,
+                            int max_requests,
+                            int idle_timeout);
+
+/* close connections that take over header_timeout msec to send a
+   request's headers, counted from its first byte (or from the accept),
+   or that stall over body_timeout msec while sending a body or
+   write_timeout msec while taking a response, 0 disables each; the
+   defaults are 10, 30 and 30 seconds */
+int  httpsvr_set_timeouts(httpsvr_handle handle,
+                          int header_timeout,
+                          int body_timeout,
+                          int write_timeout);
+
+/* keep up to max_bytes of static files no larger than max_file_len in
+   memory, revalidated against each file's size and modification time
+   (0 max_bytes disables), set before serving; only the bodies are
+   cached, the headers are built for each request since validators,
+   ranges and encodings differ between requests, a hit saves the read */
+int  httpsvr_set_file_cache(httpsvr_handle handle,
+                            int max_bytes,
+                            int max_file_len);
+
+/* serve GET and HEAD for the files packed into bundle_path by
+   tools/mkbundle straight from a read-only mapping of it, ahead of the
+   file and page handlers, with the headers, ETags and gzip variants it
+   was built with (Range is not supported); NULL unloads it, set
+   before serving; a new bundle must be written elsewhere and renamed
+   over bundle_path, rewriting the mapped file in place crashes the
+   server */
+int  httpsvr_set_bundle(httpsvr_handle handle,
+                        const char *bundle_path);
+
+/* have the file cache map files read-only rather than copy them, so
+   every worker sends from the one page cache copy and max_bytes of
+   httpsvr_set_file_cache bounds what is mapped, set before serving;
+   each mapped file holds a descriptor, and a file cut short in place
+   fails the responses sending it, files are best replaced by rename */
+int  httpsvr_set_file_map(httpsvr_handle handle,
+                          int enable);
+
+/* accept request bodies up to max_body_len (413 beyond), handing them
+   to handlers in one piece up to max_buffered_len, larger bodies need
+   an upload handler, set before serving */
+int  httpsvr_set_max_body(httpsvr_handle handle,
+                          int max_body_len,
+                          int max_buffered_len);
+
+/* serve file.gz in place of a static file to clients accepting gzip,
+   with the handler's headers plus Content-Encoding, set before serving */
+int  httpsvr_set_gzip_static(httpsvr_handle handle,
+                             int enable);
+
+/* compress text output of page and route handlers of at least min_len
+   bytes at zlib level 1-9 (0 disables) for clients accepting gzip or
+   deflate, keeping up to cache_bytes of compressed bodies so repeated
+   output is not compressed again, set before serving */
+int  httpsvr_set_deflate(httpsvr_handle handle,
+                         int level,
+                         int min_len,
+                         int cache_bytes);
+
 int  httpsvr_add_file_handler(httpsvr_handle handle,
                               const char *file_extension,
                               httpsvr_file_handler file_handler);
@@ -76,8 +224,84 @@ int  httpsvr_add_page_handler(httpsvr_handle handle,
                               const char *page_name,
                               httpsvr_file_handler page_handler);
 
+/* body is produced piece by piece and sent with chunked transfer
+   encoding, so it need not fit the send buffer */
+int  httpsvr_add_stream_handler(httpsvr_handle handle,
+                                const char *page_name,
+                                const char *content_type,
+                                httpsvr_stream_handler stream_handler);
+
+/* request bodies for page_name are streamed to upload_handler rather
+   than buffered, so they are limited by max_body_len alone */
+int  httpsvr_add_upload_handler(httpsvr_handle handle,
+                                const char *page_name,
+                                httpsvr_upload_handler upload_handler);
+
+/* route requests for method (NULL for any) and pattern, which starts
+   with '/' and may hold ":name" segments and end with "*" to mount a
+   prefix, the rest of the path is then captured as param "*"; exact
+   text beats a ":name" segment beats a mount, HEAD falls back to GET,
+   and requests matching no route go to the file and page handlers */
+int  httpsvr_add_route(httpsvr_handle handle,
+                       const char *method,
+                       const char *pattern,
+                       httpsvr_route_handler route_handler);
+
+/* the request being answered on the calling thread, only valid while a
+   file, page or route handler runs; header names and values point into
+   the receive buffer and are not nul terminated */
+const char *httpsvr_get_method(void);
+
+const char *httpsvr_get_header(const char *name,
+                               int *value_len);
+
+int  httpsvr_get_num_headers(void);
+
+const char *httpsvr_get_header_at(int i,
+                                  const char **name,
+                                  int *name_len,
+                                  int *value_len);
+
+/* body read per Content-Length or chunked, NULL with an upload handler */
+const char *httpsvr_get_body(int *body_len);
+
 void httpsvr_receive(httpsvr_handle handle);
 
+/* answer the requests in data as if they arrived on one new connection,
+   passing the responses to sink in place of a socket, for benchmarks
+   and tests; shares its connection with httpsvr_receive, so not at the
+   same time; returns the number of requests answered or -1 */
+int  httpsvr_process(httpsvr_handle handle,
+                     const char *data,
+                     int data_len,
+                     httpsvr_sink sink,
+                     void *context);
+
+/* serve up to max_connections concurrently from a single thread,
+   returns when httpsvr_stop is called or on error (-1) */
+int  httpsvr_run_event_loop(httpsvr_handle handle,
+                            int max_connections);
+
+/* serve from num_workers threads, each with its own listening socket
+   (SO_REUSEPORT) and up to max_connections of its own connections */
+int  httpsvr_run_workers(httpsvr_handle handle,
+                         int num_workers,
+                         int max_connections);
+
+/* makes the running loops return, and releases the compression state of
+   the calling thread, e.g. one that used httpsvr_receive */
+void httpsvr_stop(httpsvr_handle handle);
+
+/* stream handler writing request counts, bytes and connections, and
+   latency histograms of the parse, handler and send phases, in the
+   Prometheus text format; opt in by registering it, e.g. as "metrics"
+   with content type "text/plain; version=0.0.4" */
+int  httpsvr_metrics_stream(const char *page_name,
+                            const char *parameters,
+                            void **context,
+                            char *buffer,
+                            int buffer_len);
+
 int httpsvr_redirect_to_index_html(const char *path,
                                    const char *parameters,
                                    char *buffer,
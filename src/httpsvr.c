@@ -32,91 +32,332 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
 
-#if defined (WIN32)
-#  include <winsock2.h>
-#  define CLOSE(soc)        closesocket(soc)
-#else
-#  include <unistd.h>
-#  include <sys/types.h>
-#  include <sys/socket.h>
-#  include <netinet/in.h>
-#  define SOCKET            int
-#  define INVALID_SOCKET    (-1)
-#  define SOCKET_ERROR      (-1)
-#  define SD_RECEIVE        SHUT_RD
-#  define SD_SEND           SHUT_WR
-#  define CLOSE(soc)        close(soc)
-#endif
+#include <sys/uio.h>
+
+#include "httpsvr_internal.h"
+#include "httpsvr_bundle.h"
+#include "httpsvr_cache.h"
+#include "httpsvr_route.h"
+#include "httpsvr_scan.h"
+#include "httpsvr_zip.h"
+#include "httpsvr_metrics.h"
+#include "httpsvr_log.h"
+
+
+const char *httpsvr_status_lines[HTTPSVR_NUM_RESP] = {
+    "200 OK",
+    "204 No Content",
+    "206 Partial Content",
+    "301 Moved Permanently",
+    "304 Not Modified",
+    "400 Bad Request",
+    "404 Not Found",
+    "413 Payload Too Large",
+    "416 Range Not Satisfiable",
+    "500 Internal Server Error",
+    "431 Request Header Fields Too Large",
+};
+
+static const char *httpsvr_day_names[7] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat",
+};
+
+static const char *httpsvr_month_names[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+};
 
-#include "httpsvr.h"
-
-
-#define HTTPSVR_CONTENT_LENGTH_STR      "Content-Length:"
-#define HTTPSVR_CONTENT_PLACE_HOLDER    "      0"
-
-typedef struct {
-    char                   *ext;
-    httpsvr_file_handler    handler;
-} httpsvr_file_handler_struct;
-
-typedef struct {
-    char                   *name;
-    httpsvr_file_handler    handler;
-} httpsvr_page_handler_struct;
-
-
-typedef struct {
-    SOCKET  listen_soc;
-    SOCKET  recv_soc;
-    char   *recv_data;
-    int     recv_data_max_len;
-    int     recv_data_len;
-    char   *send_data;
-    int     send_data_max_len;
-    int     send_data_len;
-    char   *req_method;
-    char   *req_path;
-    char   *req_params;
-    char   *req_ver;
-    char   *user_agent;
-    int     user_agent_max_len;
-    char   *file_path;
-    char   *file_root_path;
-    int     file_path_max_len;
-    httpsvr_file_handler_struct *file_handlers;
-    int     file_handlers_max_len;
-    int     file_handlers_len;
-    httpsvr_page_handler_struct *page_handlers;
-    int     page_handlers_max_len;
-    int     page_handlers_len;
-} httpsvr_struct;
+/* two digits at a time for the Content-Length */
+static const char httpsvr_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
 
 
 void httpsvr_init_struct(httpsvr_struct *hss) {
     hss->listen_soc             = INVALID_SOCKET;
-    hss->recv_soc               = INVALID_SOCKET;
-    hss->recv_data              = NULL;
+    hss->port                   = 0;
+    hss->running                = 0;
+    hss->conn                   = NULL;
     hss->recv_data_max_len      = 0;
-    hss->recv_data_len          = 0;
-    hss->send_data              = NULL;
     hss->send_data_max_len      = 0;
-    hss->send_data_len          = 0;
-    hss->req_method             = NULL;
-    hss->req_path               = NULL;
-    hss->req_params             = NULL;
-    hss->req_ver                = NULL;
+    hss->keep_alive_max_requests = HTTPSVR_KEEP_ALIVE_MAX_REQUESTS;
+    hss->keep_alive_timeout     = HTTPSVR_KEEP_ALIVE_TIMEOUT;
+    hss->header_timeout         = HTTPSVR_HEADER_TIMEOUT;
+    hss->body_timeout           = HTTPSVR_BODY_TIMEOUT;
+    hss->write_timeout          = HTTPSVR_WRITE_TIMEOUT;
+    hss->max_body_len           = HTTPSVR_MAX_BODY_LEN;
+    hss->max_buffered_body_len  = HTTPSVR_MAX_BUFFERED_BODY_LEN;
+    hss->cache                  = NULL;
+    hss->bundle                 = NULL;
     hss->user_agent             = NULL;
     hss->user_agent_max_len     = 0;
-    hss->file_path              = NULL;
+    hss->template_data          = NULL;
     hss->file_root_path         = NULL;
     hss->file_path_max_len      = 0;
     hss->file_handlers          = NULL;
     hss->file_handlers_max_len  = 0;
     hss->file_handlers_len      = 0;
+    hss->file_index             = NULL;
+    hss->file_index_mask        = 0;
+    hss->file_wildcard          = -1;
     hss->page_handlers          = NULL;
     hss->page_handlers_max_len  = 0;
     hss->page_handlers_len      = 0;
+    hss->page_index             = NULL;
+    hss->page_index_mask        = 0;
+    hss->page_wildcard          = -1;
+    hss->routes                 = NULL;
+    hss->num_routes             = 0;
+    httpsvr_arena_init(&hss->arena, HTTPSVR_KEY_ARENA_LEN);
+    hss->gzip_static            = 0;
+    hss->file_map               = 0;
+    hss->deflate_level          = 0;
+    hss->deflate_min_len        = 0;
+    hss->zip_cache              = NULL;
+    hss->metrics                = NULL;
+    hss->log                    = NULL;
+}
+
+
+unsigned int httpsvr_hash(const char *s) {
+    unsigned int hash = 2166136261u;  /* FNV-1a */
+    
+    while (*s != '\0') {
+        hash ^= (unsigned char) *s++;
+        hash *= 16777619u;
+    }
+    
+    return hash;
+}
+
+
+int *httpsvr_index_create(int max_len, unsigned int *mask) {
+    unsigned int n = 4;
+    int *index = NULL;
+    
+    /* keep the table at most half full so probes stay short */
+    while (n < (unsigned int) (2 * max_len)) {
+        n *= 2;
+    }
+    index = malloc(n * sizeof(int));
+    if (index != NULL) {
+        memset(index, -1, n * sizeof(int));
+        *mask = n - 1;
+    }
+    
+    return index;
+}
+
+
+void httpsvr_index_insert(int *index, unsigned int mask, unsigned int hash, int i) {
+    
+    /* linear probing, slots hold handler table positions */
+    while (index[hash & mask] != -1) {
+        hash++;
+    }
+    index[hash & mask] = i;
+}
+
+
+int httpsvr_conn_len(httpsvr_struct *hss) {
+    return sizeof(httpsvr_conn_struct) +
+           (2 * hss->recv_data_max_len) +
+           hss->send_data_max_len +
+           hss->file_path_max_len;
+}
+
+
+httpsvr_conn_struct *httpsvr_conn_create(httpsvr_struct *hss,
+                                         httpsvr_pool_struct *pool,
+                                         httpsvr_pool_struct *buf_pool) {
+    httpsvr_conn_struct *conn = NULL;
+    char *block = NULL;
+    int recycled = 0;
+    
+    /* the connection and its buffers are one block, reused from the
+       worker's pool once connections have come and gone */
+    if (pool != NULL) {
+        recycled = (pool->free_list != NULL);
+        block = httpsvr_pool_get(pool);
+    } else {
+        block = malloc(httpsvr_conn_len(hss));
+    }
+    
+    if (block != NULL) {
+        conn = (httpsvr_conn_struct *) block;
+        block += sizeof(httpsvr_conn_struct);
+        if (!recycled) {
+            httpsvr_arena_init(&conn->arena, HTTPSVR_CONN_ARENA_LEN);
+        }
+        conn->hss               = hss;
+        conn->pool              = pool;
+        conn->buf_pool          = buf_pool;
+        conn->metrics           = NULL;
+        conn->prev              = NULL;
+        conn->next              = NULL;
+        conn->requests_left     = 1;
+        conn->timer.prev        = NULL;
+        conn->timer.next        = NULL;
+        conn->timer.data        = conn;
+        conn->timer_kind        = HTTPSVR_DEADLINE_NONE;
+        conn->soc               = INVALID_SOCKET;
+        conn->sink              = NULL;
+        conn->sink_context      = NULL;
+        conn->events            = 0;
+        conn->route_params_len  = 0;
+        conn->stream            = NULL;
+        conn->upload            = NULL;
+        conn->upload_context    = NULL;
+        conn->req_body          = NULL;
+        conn->req_body_max_len  = 0;
+        conn->recv_data_max_len = hss->recv_data_max_len;
+        conn->recv_data         = block;
+        block += conn->recv_data_max_len;
+        conn->send_data_max_len = hss->send_data_max_len;
+        conn->send_data         = block;
+        conn->send_base         = block;
+        conn->send_bufs_len     = 0;
+        conn->segs_len          = 0;
+        conn->seg_pos           = 0;
+        conn->resp_seg_start    = 0;
+        block += conn->send_data_max_len;
+        conn->req_save          = block;
+        block += conn->recv_data_max_len;
+        conn->file_path_max_len = hss->file_path_max_len;
+        conn->file_path         = block;
+        httpsvr_conn_reset(conn);
+    }
+    
+    return conn;
+}
+
+
+void httpsvr_conn_destroy(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_stream_end(conn);
+        httpsvr_body_reset(conn);
+        httpsvr_send_clear(conn);
+        
+        /* back to the pool with the first arena chunk, if it has room */
+        if ((conn->pool != NULL) && (conn->pool->num_free < conn->pool->max_free)) {
+            httpsvr_arena_trim(&conn->arena);
+            httpsvr_pool_put(conn->pool, conn);
+        } else {
+            httpsvr_arena_free(&conn->arena);
+            free(conn);
+        }
+    }
+}
+
+
+void httpsvr_conn_pool_destroy(httpsvr_pool_struct *pool) {
+    httpsvr_conn_struct *conn = NULL;
+    
+    /* pooled connections still hold their arenas */
+    while (pool->free_list != NULL) {
+        conn = httpsvr_pool_get(pool);
+        httpsvr_arena_free(&conn->arena);
+        free(conn);
+    }
+}
+
+
+void httpsvr_conn_reset(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_stream_end(conn);
+        httpsvr_body_reset(conn);
+        conn->state         = HTTPSVR_CONN_READING;
+        conn->recv_data_len = 0;
+        conn->parse_state   = HTTPSVR_PARSE_REQUEST_LINE;
+        conn->parse_pos     = 0;
+        conn->parse_scan    = 0;
+        conn->parse_spaces  = 0;
+        conn->parse_colon   = -1;
+        conn->req_query_pos = -1;
+        conn->req_dot_pos   = -1;
+        conn->req_tilde     = 0;
+        conn->headers_len   = 0;
+        conn->req_len       = 0;
+        conn->keep_alive    = 0;
+        httpsvr_send_clear(conn);
+        conn->resp_start    = 0;
+        conn->resp_seg_start = 0;
+        conn->resp_status   = -1;
+        conn->resp_head     = 0;
+        conn->resp_length_pos = -1;
+        conn->route_id      = -1;
+        conn->send_start    = 0;
+        conn->resp_time     = 0;
+        conn->ranges_len    = 0;
+        conn->req_method    = NULL;
+        conn->req_path      = NULL;
+        conn->req_params    = NULL;
+        conn->req_ver       = NULL;
+        conn->route_params_len = 0;
+    }
+}
+
+
+SOCKET httpsvr_listen_socket(unsigned short port) {
+    struct sockaddr addr;
+    int addrlen = sizeof(addr);
+    int opt = 1;
+    SOCKET soc = socket(PF_INET, SOCK_STREAM, 0);
+    
+    if (soc != INVALID_SOCKET) {
+        
+        /* let every worker bind its own socket to the same port,
+           and allow restarting while old connections linger */
+        setsockopt(soc, SOL_SOCKET, SO_REUSEADDR, (const char *) &opt, sizeof(opt));
+#if defined (SO_REUSEPORT)
+        setsockopt(soc, SOL_SOCKET, SO_REUSEPORT, (const char *) &opt, sizeof(opt));
+#endif
+        
+        /* bind to local receive port */
+        memset(&addr, 0, addrlen);
+        struct sockaddr_in *config = (struct sockaddr_in *) &addr;
+        config->sin_family      = AF_INET;
+        config->sin_addr.s_addr = htonl(INADDR_ANY);  /* listen to anyone */
+        config->sin_port        = htons(port);
+        if (bind(soc, &addr, addrlen) == SOCKET_ERROR) {
+            CLOSE(soc);
+            soc = INVALID_SOCKET;
+        }
+    }
+    
+    return soc;
+}
+
+
+void httpsvr_socket_timeouts(SOCKET soc, int recv_timeout, int send_timeout) {
+#if defined (WIN32)
+    DWORD t = recv_timeout;
+    setsockopt(soc, SOL_SOCKET, SO_RCVTIMEO, (const char *) &t, sizeof(t));
+    t = send_timeout;
+    setsockopt(soc, SOL_SOCKET, SO_SNDTIMEO, (const char *) &t, sizeof(t));
+#else
+    struct timeval tv;
+    tv.tv_sec  = recv_timeout / 1000;
+    tv.tv_usec = (recv_timeout % 1000) * 1000;
+    setsockopt(soc, SOL_SOCKET, SO_RCVTIMEO, (const char *) &tv, sizeof(tv));
+    tv.tv_sec  = send_timeout / 1000;
+    tv.tv_usec = (send_timeout % 1000) * 1000;
+    setsockopt(soc, SOL_SOCKET, SO_SNDTIMEO, (const char *) &tv, sizeof(tv));
+#endif
 }
 
 
@@ -127,33 +368,41 @@ httpsvr_handle httpsvr_init(unsigned short port,
                             int num_file_handlers,
                             int num_page_handlers) {
     int i = 0;
-    struct sockaddr addr;
-    int addrlen = sizeof(addr);
     httpsvr_struct *hss = NULL;
     hss = malloc(sizeof(httpsvr_struct));
+    httpsvr_scan_init();
     
     if (hss != NULL) {
         httpsvr_init_struct(hss);
         hss->recv_data_max_len  = recv_buffer_len;
-        hss->recv_data          = malloc(hss->recv_data_max_len);
         hss->send_data_max_len  = send_buffer_len;
-        hss->send_data          = malloc(hss->send_data_max_len);
         hss->user_agent_max_len = file_path_len;
-        hss->user_agent         = malloc(hss->file_path_max_len);
+        hss->user_agent         = malloc(hss->user_agent_max_len);
+        hss->template_data      = malloc(HTTPSVR_NUM_RESP * 4 *
+                                         (HTTPSVR_TEMPLATE_BASE_LEN + hss->user_agent_max_len));
         hss->file_path_max_len  = file_path_len;
-        hss->file_path          = malloc(hss->file_path_max_len);
         hss->file_root_path     = malloc(hss->file_path_max_len);
         hss->file_handlers_max_len = num_file_handlers;
         hss->file_handlers      = malloc(hss->file_handlers_max_len * sizeof(httpsvr_file_handler_struct));
         hss->page_handlers_max_len = num_page_handlers;
         hss->page_handlers      = malloc(hss->page_handlers_max_len * sizeof(httpsvr_page_handler_struct));
-        if ((hss->recv_data         == NULL) ||
-            (hss->send_data         == NULL) ||
+        hss->file_index         = httpsvr_index_create(hss->file_handlers_max_len, &hss->file_index_mask);
+        hss->page_index         = httpsvr_index_create(hss->page_handlers_max_len, &hss->page_index_mask);
+        hss->conn               = httpsvr_conn_create(hss, NULL, NULL);
+        if ((hss->conn              == NULL) ||
             (hss->user_agent        == NULL) ||
-            (hss->file_path         == NULL) ||
+            (hss->template_data     == NULL) ||
             (hss->file_root_path    == NULL) ||
             (hss->file_handlers     == NULL) ||
-            (hss->page_handlers     == NULL)) {
+            (hss->page_handlers     == NULL) ||
+            (hss->file_index        == NULL) ||
+            (hss->page_index        == NULL)) {
+            if (hss->page_index != NULL) {
+                free(hss->page_index);
+            }
+            if (hss->file_index != NULL) {
+                free(hss->file_index);
+            }
             if (hss->page_handlers != NULL) {
                 free(hss->page_handlers);
             }
@@ -163,61 +412,46 @@ httpsvr_handle httpsvr_init(unsigned short port,
             if (hss->file_root_path != NULL) {
                 free(hss->file_root_path);
             }
-            if (hss->file_path != NULL) {
-                free(hss->file_path);
+            if (hss->template_data != NULL) {
+                free(hss->template_data);
             }
             if (hss->user_agent != NULL) {
                 free(hss->user_agent);
             }
-            if (hss->send_data != NULL) {
-                free(hss->send_data);
-            }
-            if (hss->recv_data != NULL) {
-                free(hss->recv_data);
-            }
+            httpsvr_conn_destroy(hss->conn);
+            httpsvr_arena_free(&hss->arena);
             free(hss);
             hss = NULL;
         } else {
             for (i = 0; i < hss->page_handlers_max_len; i++) {
-                hss->page_handlers[i].name    = NULL;
-                hss->page_handlers[i].handler = NULL;
+                hss->page_handlers[i].name         = NULL;
+                hss->page_handlers[i].hash         = 0;
+                hss->page_handlers[i].handler      = NULL;
+                hss->page_handlers[i].stream       = NULL;
+                hss->page_handlers[i].content_type = NULL;
+                hss->page_handlers[i].upload       = NULL;
             }
             for (i = 0; i < hss->file_handlers_max_len; i++) {
                 hss->file_handlers[i].ext     = NULL;
+                hss->file_handlers[i].hash    = 0;
                 hss->file_handlers[i].handler = NULL;
             }
             strncpy(hss->file_root_path, ".", hss->file_path_max_len);
-            strncpy(hss->user_agent, HTTPSVR_USER_AGENT, hss->user_agent_max_len);
-            hss->recv_soc = INVALID_SOCKET;
-            hss->listen_soc = socket(PF_INET, SOCK_STREAM, 0);
+            httpsvr_set_user_agent(hss, HTTPSVR_USER_AGENT);
+            hss->port = port;
+            hss->listen_soc = httpsvr_listen_socket(port);
             if (hss->listen_soc == INVALID_SOCKET) {
+                free(hss->page_index);
+                free(hss->file_index);
                 free(hss->page_handlers);
                 free(hss->file_handlers);
                 free(hss->file_root_path);
-                free(hss->file_path);
-                free(hss->send_data);
-                free(hss->recv_data);
+                free(hss->template_data);
+                free(hss->user_agent);
+                httpsvr_conn_destroy(hss->conn);
+                httpsvr_arena_free(&hss->arena);
                 free(hss);
                 hss = NULL;
-            } else {
-                
-                /* bind to local receive port */
-                memset(&addr, 0, addrlen);
-                struct sockaddr_in *config = (struct sockaddr_in *) &addr;
-                config->sin_family      = AF_INET;
-                config->sin_addr.s_addr = htonl(INADDR_ANY);  /* listen to anyone */
-                config->sin_port        = htons(port);
-                if (bind(hss->listen_soc, &addr, addrlen) == SOCKET_ERROR) {
-                    CLOSE(hss->listen_soc);
-                    free(hss->page_handlers);
-                    free(hss->file_handlers);
-                    free(hss->file_root_path);
-                    free(hss->file_path);
-                    free(hss->send_data);
-                    free(hss->recv_data);
-                    free(hss);
-                    hss = NULL;
-                }
             }
         }
     }
@@ -226,81 +460,78 @@ httpsvr_handle httpsvr_init(unsigned short port,
 }
 
 
-int httpsvr_add_file_handler(httpsvr_handle handle,
-                             const char *file_extension,
-                             httpsvr_file_handler file_handler) {
-    int rc = -1;
+void httpsvr_build_templates(httpsvr_struct *hss) {
+    int i = 0;
+    int ver = 0;
+    int ka = 0;
+    int n = 0;
+    int max_len = HTTPSVR_TEMPLATE_BASE_LEN + hss->user_agent_max_len;
+    char *s = hss->template_data;
     
-    httpsvr_struct *hss = handle;
-    if (hss != NULL) {
-        
-        /* check if file extension is already in the list */
-        int i = 0;
-        for (i = 0; i < hss->file_handlers_len; i++) {
-            if (hss->file_handlers[i].ext != NULL) {
-                int n = strcmp(file_extension,
-                               hss->file_handlers[i].ext);
-                if (n == 0) {
-                    break;
+    /* status line, user agent and connection, for every response */
+    for (i = 0; i < HTTPSVR_NUM_RESP; i++) {
+        for (ver = 0; ver < 2; ver++) {
+            for (ka = 0; ka < 2; ka++) {
+                n = 0;
+                n += httpsvr_append(&s[n], max_len - n, ver ? "HTTP/1.1 " : "HTTP/1.0 ");
+                n += httpsvr_append(&s[n], max_len - n, httpsvr_status_lines[i]);
+                n += httpsvr_append(&s[n], max_len - n, "\r\n");
+                if (hss->user_agent[0] != '\0') {
+                    n += httpsvr_append(&s[n], max_len - n, "User-Agent: ");
+                    n += httpsvr_append(&s[n], max_len - n, hss->user_agent);
+                    n += httpsvr_append(&s[n], max_len - n, "\r\n");
                 }
+                n += httpsvr_append(&s[n], max_len - n, ka ? "Connection: keep-alive\r\n" :
+                                                             "Connection: close\r\n");
+                hss->templates[i][ver][ka].iov_base = s;
+                hss->templates[i][ver][ka].iov_len  = n;
+                s += max_len;
             }
         }
-        
-        if (i < hss->file_handlers_len) {
-            
-            /* replace existing file handler */
-            hss->file_handlers[i].handler = file_handler;
-            
-        } else if (i < hss->file_handlers_max_len) {
-            
-            /* add new file handler */
-            int n = strlen(file_extension) + 1;
-            hss->file_handlers[i].ext = malloc(n);
-            memset(hss->file_handlers[i].ext, 0, n);
-            strncpy(hss->file_handlers[i].ext, file_extension, n - 1);
-            hss->file_handlers[i].handler = file_handler;
-            hss->file_handlers_len++;
+    }
+}
+
+
+int httpsvr_set_user_agent(httpsvr_handle handle,
+                           const char *user_agent) {
+    int rc = -1;
+    int n = 0;
+    
+    httpsvr_struct *hss = handle;
+    if ((hss != NULL) && (user_agent != NULL)) {
+        n = strlen(user_agent);
+        if (n >= hss->user_agent_max_len) {
+            n = hss->user_agent_max_len - 1;
         }
+        memcpy(hss->user_agent, user_agent, n);
+        hss->user_agent[n] = '\0';
+        httpsvr_build_templates(hss);
+        rc = 0;
     }
     
     return rc;
 }
 
 
-int httpsvr_add_page_handler(httpsvr_handle handle,
-                             const char *page_name,
-                             httpsvr_page_handler page_handler) {
+int httpsvr_set_log(httpsvr_handle handle,
+                    int level,
+                    int fd) {
     int rc = -1;
     
     httpsvr_struct *hss = handle;
     if (hss != NULL) {
-        
-        /* check if page name is already in the list */
-        int i = 0;
-        for (i = 0; i < hss->page_handlers_len; i++) {
-            if (hss->page_handlers[i].name != NULL) {
-                int n = strcmp(page_name,
-                               hss->page_handlers[i].name);
-                if (n == 0) {
-                    break;
-                }
-            }
+        if (level > HTTPSVR_LOG_DEBUG) {
+            level = HTTPSVR_LOG_DEBUG;
         }
         
-        if (i < hss->page_handlers_len) {
-            
-            /* replace existing page handler */
-            hss->page_handlers[i].handler = page_handler;
-            
-        } else if (i < hss->file_handlers_max_len) {
-            
-            /* add new page handler */
-            int n = strlen(page_name) + 1;
-            hss->page_handlers[i].name = malloc(n);
-            memset(hss->page_handlers[i].name, 0, n);
-            strncpy(hss->page_handlers[i].name, page_name, n - 1);
-            hss->page_handlers[i].handler = page_handler;
-            hss->page_handlers_len++;
+        /* the queue stays once made, workers may still hold it */
+        if ((hss->log == NULL) && (level > HTTPSVR_LOG_OFF)) {
+            hss->log = httpsvr_log_create();
+        }
+        if (hss->log != NULL) {
+            rc = httpsvr_log_start(hss->log, level, fd);
+        } else if (level <= HTTPSVR_LOG_OFF) {
+            rc = 0;
         }
     }
     
@@ -308,331 +539,1373 @@ int httpsvr_add_page_handler(httpsvr_handle handle,
 }
 
 
-void httpsvr_print(const char *data, int data_len) {
-    int i = 0;
+int httpsvr_set_keep_alive(httpsvr_handle handle,
+                           int max_requests,
+                           int idle_timeout) {
+    int rc = -1;
     
-    if (data != NULL) {
-        for (i = 0; i < data_len; i++) {
-            if (isprint(data[i])) {
-                putchar(data[i]);
-            } else {
-                printf("[%02hX]", (0x00FF) & data[i]);
-                if (data[i] == '\n') {
-                    putchar('\n');
-                }
-            }
-        }
-        putchar('\n');
+    httpsvr_struct *hss = handle;
+    if (hss != NULL) {
+        hss->keep_alive_max_requests = (max_requests > 1) ? max_requests : 1;
+        hss->keep_alive_timeout      = (idle_timeout > 0) ? idle_timeout : 0;
+        rc = 0;
     }
+    
+    return rc;
 }
 
 
-void httpsvr_print_recv(httpsvr_handle handle) {
+int httpsvr_set_timeouts(httpsvr_handle handle,
+                         int header_timeout,
+                         int body_timeout,
+                         int write_timeout) {
+    int rc = -1;
+    
     httpsvr_struct *hss = handle;
     if (hss != NULL) {
-        httpsvr_print(hss->recv_data, hss->recv_data_len);
+        hss->header_timeout = (header_timeout > 0) ? header_timeout : 0;
+        hss->body_timeout   = (body_timeout > 0) ? body_timeout : 0;
+        hss->write_timeout  = (write_timeout > 0) ? write_timeout : 0;
+        rc = 0;
     }
+    
+    return rc;
 }
 
 
-void httpsvr_print_send(httpsvr_handle handle) {
+int httpsvr_set_max_body(httpsvr_handle handle,
+                         int max_body_len,
+                         int max_buffered_len) {
+    int rc = -1;
+    
     httpsvr_struct *hss = handle;
     if (hss != NULL) {
-        httpsvr_print(hss->send_data, hss->send_data_len);
+        hss->max_body_len          = (max_body_len > 0) ? max_body_len : 0;
+        hss->max_buffered_body_len = (max_buffered_len > 0) ? max_buffered_len : 0;
+        if (hss->max_buffered_body_len > hss->max_body_len) {
+            hss->max_buffered_body_len = hss->max_body_len;
+        }
+        rc = 0;
     }
+    
+    return rc;
 }
 
 
-void httpsvr_print_req(httpsvr_handle handle) {
+void httpsvr_stop(httpsvr_handle handle) {
     httpsvr_struct *hss = handle;
     if (hss != NULL) {
-        putchar('\n');
-        printf("Method: %s\n", (hss->req_method == NULL) ? "NULL" : hss->req_method);
-        printf("Path:   %s\n", (hss->req_path   == NULL) ? "NULL" : hss->req_path);
-        printf("Params: %s\n", (hss->req_params == NULL) ? "NULL" : hss->req_params);
-        printf("Ver:    %s\n", (hss->req_ver    == NULL) ? "NULL" : hss->req_ver);
+        hss->running = 0;
     }
+    
+    /* loops free their own thread's zlib state as they return */
+    httpsvr_zip_thread_end();
 }
 
 
-void httpsvr_append_send(httpsvr_handle handle, const char *s) {
-    httpsvr_struct *hss = handle;
-    if (hss != NULL) {
-        int len = strlen(s);
-        int max_len = hss->send_data_max_len - hss->send_data_len;
-        strncpy(&hss->send_data[hss->send_data_len], s, max_len);
-        hss->send_data_len += len;
-        if (hss->send_data_len > hss->send_data_max_len) {
-            hss->send_data_len = hss->send_data_max_len;
+int httpsvr_find_file(httpsvr_struct *hss, const char *file_extension) {
+    unsigned int key  = httpsvr_hash(file_extension);
+    unsigned int hash = key;
+    int i = -1;
+    
+    while ((i = hss->file_index[hash & hss->file_index_mask]) != -1) {
+        if ((hss->file_handlers[i].hash == key) &&
+            (strcmp(file_extension, hss->file_handlers[i].ext) == 0)) {
+            break;
         }
-        
-        /* make sure send buffer remains null terminated */
-        hss->send_data[hss->send_data_max_len - 1] = '\0';
+        hash++;
     }
+    
+    return i;
 }
 
 
-void httpsvr_send(httpsvr_handle handle) {
+int httpsvr_add_file_handler(httpsvr_handle handle,
+                             const char *file_extension,
+                             httpsvr_file_handler file_handler) {
+    int rc = -1;
+    
     httpsvr_struct *hss = handle;
     if (hss != NULL) {
         
-        /* find start of content */
-        int content_len = 0;
-        const char *content = strstr(hss->send_data, "\r\n\r\n");
-        if (content != NULL) {
-            content += 4;  /* advance past blank line */
-            int header_len = content - hss->send_data;
-            content_len = hss->send_data_len - header_len;
+        /* check if file extension is already in the list */
+        int i = httpsvr_find_file(hss, file_extension);
+        
+        if (i >= 0) {
+            
+            /* replace existing file handler */
+            hss->file_handlers[i].handler = file_handler;
+            rc = 0;
             
-            /* now fill in content length */
-            char *s = strstr(hss->send_data, HTTPSVR_CONTENT_LENGTH_STR);
-            if (s != NULL) {
-                if ((s - hss->send_data) < header_len) {
-                    char s2[16];
-                    sprintf(s2, "%7d", content_len);
-                    strncpy(s + 15, s2, 7);
+        } else if (hss->file_handlers_len < hss->file_handlers_max_len) {
+            
+            /* add new file handler */
+            i = hss->file_handlers_len;
+            hss->file_handlers[i].ext = httpsvr_arena_strndup(&hss->arena, file_extension,
+                                                              strlen(file_extension));
+            if (hss->file_handlers[i].ext != NULL) {
+                hss->file_handlers[i].hash    = httpsvr_hash(file_extension);
+                hss->file_handlers[i].handler = file_handler;
+                hss->file_handlers_len++;
+                httpsvr_index_insert(hss->file_index, hss->file_index_mask,
+                                     hss->file_handlers[i].hash, i);
+                if (strcmp(file_extension, HTTPSVR_WILDCARD) == 0) {
+                    hss->file_wildcard = i;
                 }
+                rc = 0;
             }
         }
-        send(hss->recv_soc, hss->send_data, hss->send_data_len, 0);
-        httpsvr_print_send(handle);
     }
+    
+    return rc;
 }
 
 
-void httpsvr_echo_req(httpsvr_handle handle) {
-    httpsvr_struct *hss = handle;
-    if (hss != NULL) {
-        hss->send_data_len = 0;
-        memcpy(&hss->send_data[hss->send_data_len], hss->recv_data, hss->recv_data_len);
-        hss->send_data_len += hss->recv_data_len;
-        httpsvr_send(handle);
+int httpsvr_find_page(httpsvr_struct *hss, const char *page_name) {
+    unsigned int key  = httpsvr_hash(page_name);
+    unsigned int hash = key;
+    int i = -1;
+    
+    while ((i = hss->page_index[hash & hss->page_index_mask]) != -1) {
+        if ((hss->page_handlers[i].hash == key) &&
+            (strcmp(page_name, hss->page_handlers[i].name) == 0)) {
+            break;
+        }
+        hash++;
     }
+    
+    return i;
 }
 
 
-void httpsvr_ok_resp(httpsvr_handle handle) {
-    httpsvr_struct *hss = handle;
-    if (hss != NULL) {
-        hss->send_data_len = 0;
-        httpsvr_append_send(handle, hss->req_ver);
-        httpsvr_append_send(handle, " 200 OK\r\n");
-        if (hss->user_agent[0] != '\0') {
-            httpsvr_append_send(handle, "User-Agent: ");
-            httpsvr_append_send(handle, hss->user_agent);
-            httpsvr_append_send(handle, "\r\n");
+int httpsvr_find_page_slot(httpsvr_struct *hss, const char *page_name) {
+    
+    /* check if page name is already in the list */
+    int i = httpsvr_find_page(hss, page_name);
+    
+    if (i < 0) {
+        if (hss->page_handlers_len < hss->page_handlers_max_len) {
+            
+            /* add new page handler */
+            i = hss->page_handlers_len;
+            hss->page_handlers[i].name = httpsvr_arena_strndup(&hss->arena, page_name,
+                                                               strlen(page_name));
+            if (hss->page_handlers[i].name == NULL) {
+                i = -1;
+            } else {
+                hss->page_handlers[i].hash = httpsvr_hash(page_name);
+                hss->page_handlers_len++;
+                httpsvr_index_insert(hss->page_index, hss->page_index_mask,
+                                     hss->page_handlers[i].hash, i);
+                if (strcmp(page_name, HTTPSVR_WILDCARD) == 0) {
+                    hss->page_wildcard = i;
+                }
+            }
         }
-        
-        /* content length place holder, to be filled in by httpsvr_send */
-        httpsvr_append_send(handle, HTTPSVR_CONTENT_LENGTH_STR);
-        httpsvr_append_send(handle, HTTPSVR_CONTENT_PLACE_HOLDER);
-        httpsvr_append_send(handle, "\r\n");
     }
+    
+    return i;
 }
 
 
-void httpsvr_no_content_resp(httpsvr_handle handle) {
+int httpsvr_add_page_handler(httpsvr_handle handle,
+                             const char *page_name,
+                             httpsvr_page_handler page_handler) {
+    int rc = -1;
+    int i = 0;
+    
     httpsvr_struct *hss = handle;
     if (hss != NULL) {
-        hss->send_data_len = 0;
-        httpsvr_append_send(handle, hss->req_ver);
-        httpsvr_append_send(handle, " 204 No content\r\n");
-        if (hss->user_agent[0] != '\0') {
-            httpsvr_append_send(handle, "User-Agent: ");
-            httpsvr_append_send(handle, hss->user_agent);
-            httpsvr_append_send(handle, "\r\n");
+        i = httpsvr_find_page_slot(hss, page_name);
+        if (i >= 0) {
+            hss->page_handlers[i].handler      = page_handler;
+            hss->page_handlers[i].stream       = NULL;
+            hss->page_handlers[i].content_type = NULL;
+            hss->page_handlers[i].upload       = NULL;
+            rc = 0;
         }
-        httpsvr_send(handle);
     }
+    
+    return rc;
 }
 
 
-void httpsvr_bad_request_resp(httpsvr_handle handle) {
+int httpsvr_add_stream_handler(httpsvr_handle handle,
+                               const char *page_name,
+                               const char *content_type,
+                               httpsvr_stream_handler stream_handler) {
+    int rc = -1;
+    int i = 0;
+    
     httpsvr_struct *hss = handle;
-    if (hss != NULL) {
-        hss->send_data_len = 0;
-        httpsvr_append_send(handle, hss->req_ver);
-        httpsvr_append_send(handle, " 400 Bad request\r\n");
-        if (hss->user_agent[0] != '\0') {
-            httpsvr_append_send(handle, "User-Agent: ");
-            httpsvr_append_send(handle, hss->user_agent);
-            httpsvr_append_send(handle, "\r\n");
+    if ((hss != NULL) && (content_type != NULL)) {
+        i = httpsvr_find_page_slot(hss, page_name);
+        if (i >= 0) {
+            hss->page_handlers[i].handler      = NULL;
+            hss->page_handlers[i].stream       = stream_handler;
+            hss->page_handlers[i].content_type = content_type;
+            hss->page_handlers[i].upload       = NULL;
+            rc = 0;
         }
-        httpsvr_send(handle);
     }
+    
+    return rc;
 }
 
 
-void httpsvr_not_found_resp(httpsvr_handle handle) {
+int httpsvr_add_upload_handler(httpsvr_handle handle,
+                               const char *page_name,
+                               httpsvr_upload_handler upload_handler) {
+    int rc = -1;
+    int i = 0;
+    
     httpsvr_struct *hss = handle;
     if (hss != NULL) {
-        hss->send_data_len = 0;
-        httpsvr_append_send(handle, hss->req_ver);
-        httpsvr_append_send(handle, " 404 Not found\r\n");
-        if (hss->user_agent[0] != '\0') {
-            httpsvr_append_send(handle, "User-Agent: ");
-            httpsvr_append_send(handle, hss->user_agent);
-            httpsvr_append_send(handle, "\r\n");
+        i = httpsvr_find_page_slot(hss, page_name);
+        if (i >= 0) {
+            hss->page_handlers[i].handler      = NULL;
+            hss->page_handlers[i].stream       = NULL;
+            hss->page_handlers[i].content_type = NULL;
+            hss->page_handlers[i].upload       = upload_handler;
+            rc = 0;
         }
-        httpsvr_append_send(handle, HTTPSVR_CONTENT_LENGTH_STR);
-        httpsvr_append_send(handle, HTTPSVR_CONTENT_PLACE_HOLDER);
-        httpsvr_append_send(handle, "\r\n");
-        httpsvr_append_send(handle, "\r\nCould not find object\r\n");
-        httpsvr_send(handle);
     }
+    
+    return rc;
 }
 
 
-int httpsvr_strncmp(const char *s1, int len1, const char *s2, int len2) {
+int httpsvr_add_route(httpsvr_handle handle,
+                      const char *method,
+                      const char *pattern,
+                      httpsvr_route_handler route_handler) {
     int rc = -1;
     
-    if (len2 >= len1) {
-        if (strncmp(s1, s2, len1) == 0) {
-            rc = 1;
+    httpsvr_struct *hss = handle;
+    if (hss != NULL) {
+        if (hss->routes == NULL) {
+            hss->routes = httpsvr_route_create(&hss->arena);
         }
+        rc = httpsvr_route_insert(&hss->arena, hss->routes, method, pattern, route_handler,
+                                  &hss->num_routes);
     }
     
     return rc;
 }
 
 
-void httpsvr_parse_req(httpsvr_handle handle) {
+#if defined (HTTPSVR_DEBUG_DUMP)
+void httpsvr_print(const char *data, int data_len) {
     int i = 0;
-    int n = 0;
-
-    httpsvr_struct *hss = handle;
-    if (hss != NULL) {
-        hss->req_method = NULL;
-        hss->req_path   = NULL;
-        hss->req_params = NULL;
-        hss->req_ver    = NULL;
-        
-        /* verify request method */
-        if (httpsvr_strncmp("GET ", 4, hss->recv_data, hss->recv_data_len)) {
-            n = 3;
-            hss->recv_data[n++] = '\0';
-            hss->req_method = hss->recv_data;
-        } else if (httpsvr_strncmp("POST ", 5, hss->recv_data, hss->recv_data_len)) {
-            n = 4;
-            hss->recv_data[n++] = '\0';
-            hss->req_method = hss->recv_data;
-        } else if (httpsvr_strncmp("HEAD ", 5, hss->recv_data, hss->recv_data_len)) {
-            n = 4;
-            hss->recv_data[n++] = '\0';
-            hss->req_method = hss->recv_data;
-        }
-        if (hss->req_method != NULL) {
-            
-            /* find request path */
-            for (i = n; i < hss->recv_data_len; i++) {
-                if (hss->recv_data[i] == ' ') {
-                    hss->recv_data[i] = '\0';
-                    hss->req_path = &hss->recv_data[n];
-                    n = i + 1;
-                    break;
+    
+    if (data != NULL) {
+        for (i = 0; i < data_len; i++) {
+            if (isprint(data[i])) {
+                putchar(data[i]);
+            } else {
+                printf("[%02hX]", (0x00FF) & data[i]);
+                if (data[i] == '\n') {
+                    putchar('\n');
                 }
             }
-            if (hss->req_path != NULL) {
-                
-                /* get parameters at the end of the path */
-                hss->req_params = strchr(hss->req_path, '?');
-                if (hss->req_params != NULL) {
-                    hss->req_params[0] = '\0';
-                    hss->req_params++;
-                }
-                
-                /* determine request version */
-                if (httpsvr_strncmp("HTTP", 4, &hss->recv_data[n], hss->recv_data_len - n)) {
-                    for (i = n + 4; i < hss->recv_data_len; i++) {
-                        if ((hss->recv_data[i] == '\r') || (hss->recv_data[i] == '\n')) {
-                            hss->recv_data[i] = '\0';
-                            hss->req_ver = &hss->recv_data[n];
-                            break;
-                        }
-                    }
-                }
+        }
+        putchar('\n');
+    }
+}
+
+
+void httpsvr_print_recv(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_print(conn->recv_data, conn->recv_data_len);
+    }
+}
+
+
+void httpsvr_print_send(httpsvr_conn_struct *conn) {
+    int i = 0;
+    
+    if (conn != NULL) {
+        for (i = conn->resp_seg_start; i < conn->segs_len; i++) {
+            if (conn->segs[i].data != NULL) {
+                httpsvr_print(&conn->segs[i].data[conn->segs[i].pos],
+                              conn->segs[i].end - conn->segs[i].pos);
             }
         }
     }
 }
 
 
-void httpsvr_process_file(httpsvr_handle handle) {
-    int processed_flag = 0;
-    int n = 0;
-    httpsvr_struct *hss = handle;
-    if (hss != NULL) {
-        
-        /* append resp path to root path */
-        strncpy(hss->file_path, hss->file_root_path, hss->file_path_max_len);
-        hss->file_path[hss->file_path_max_len - 1] = '\0';
-        n = strlen(hss->file_path);
-        strncpy(&hss->file_path[n], hss->req_path, hss->file_path_max_len - n);
+void httpsvr_print_req(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        putchar('\n');
+        printf("Method: %s\n", (conn->req_method == NULL) ? "NULL" : conn->req_method);
+        printf("Path:   %s\n", (conn->req_path   == NULL) ? "NULL" : conn->req_path);
+        printf("Params: %s\n", (conn->req_params == NULL) ? "NULL" : conn->req_params);
+        printf("Ver:    %s\n", (conn->req_ver    == NULL) ? "NULL" : conn->req_ver);
+    }
+}
+#endif
+
+
+void httpsvr_append_send(httpsvr_conn_struct *conn, const char *s) {
+    if (conn != NULL) {
+        int len = strlen(s);
+        int max_len = conn->send_data_max_len - conn->send_data_len;
+        if (len < max_len) {
+            memcpy(&conn->send_data[conn->send_data_len], s, len + 1);
+            conn->send_data_len += len;
+        } else {
+            
+            /* a full buffer marks the response as cut short */
+            memcpy(&conn->send_data[conn->send_data_len], s, max_len);
+            conn->send_data_len = conn->send_data_max_len;
+            conn->send_data[conn->send_data_max_len - 1] = '\0';
+        }
+    }
+}
+
+
+char *httpsvr_format_int(char *end, unsigned long long n) {
+    int i = 0;
+    
+    /* digits written backwards from end, returns the first one */
+    while (n >= 100) {
+        i = (n % 100) * 2;
+        n /= 100;
+        *--end = httpsvr_digit_pairs[i + 1];
+        *--end = httpsvr_digit_pairs[i];
+    }
+    if (n >= 10) {
+        i = n * 2;
+        *--end = httpsvr_digit_pairs[i + 1];
+        *--end = httpsvr_digit_pairs[i];
+    } else {
+        *--end = '0' + n;
+    }
+    
+    return end;
+}
+
+
+int httpsvr_header_end(const char *data, int len) {
+    int rc = 0;
+    int i = 0;
+    int n = 0;
+    
+    /* offset past the blank line ending the headers, 0 if there is none */
+    while ((rc == 0) && (i < len)) {
+        n = i + httpsvr_scan(&httpsvr_scan_line_end, &data[i], len - i);
+        if ((n < len) && (n >= 3) &&
+            (data[n - 1] == '\r') && (data[n - 2] == '\n') && (data[n - 3] == '\r')) {
+            rc = n + 1;
+        }
+        i = n + 1;
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_is_http11(httpsvr_conn_struct *conn) {
+    return (conn->req_ver != NULL) && (strcmp(conn->req_ver, "HTTP/1.1") == 0);
+}
+
+
+void httpsvr_send_length(httpsvr_conn_struct *conn, long long content_len) {
+    if (conn != NULL) {
+        
+        /* handler output follows the room left for the content length */
+        int start = conn->resp_head;
+        int end = conn->send_data_len;
+        int header_len = 0;
+        char *s = NULL;
+        if (conn->resp_length_pos >= 0) {
+            start = conn->resp_length_pos;
+        }
+        header_len = httpsvr_header_end(&conn->send_data[start], end - start);
+        if (conn->resp_length_pos >= 0) {
+            if (content_len < 0) {
+                content_len = (header_len > 0) ? (end - start - header_len) : 0;
+            }
+            
+            /* fill it in backwards, to end right where the handler began */
+            s = &conn->send_data[start - 2];
+            memcpy(s, "\r\n", 2);
+            s = httpsvr_format_int(s, content_len);
+            s -= sizeof("Content-Length: ") - 1;
+            memcpy(s, "Content-Length: ", sizeof("Content-Length: ") - 1);
+        }
+        
+        /* HEAD gets the headers only */
+        if ((header_len > 0) && httpsvr_is_head(conn)) {
+            end = start + header_len;
+        }
+        if (s == NULL) {
+            s = &conn->send_data[conn->resp_head];
+        }
+        
+        /* queue prebuilt status line and headers, then the rest from the
+           buffer, written out together by httpsvr_write_pending */
+        if (conn->resp_status >= 0) {
+            struct iovec *t = &conn->hss->templates[conn->resp_status]
+                                                  [httpsvr_is_http11(conn)]
+                                                  [conn->keep_alive ? 1 : 0];
+            httpsvr_send_queue(conn, t->iov_base, t->iov_len);
+        }
+        httpsvr_send_queue(conn, s, &conn->send_data[end] - s);
+        conn->state = HTTPSVR_CONN_WRITING;
+#if defined (HTTPSVR_DEBUG_DUMP)
+        httpsvr_print_send(conn);
+#endif
+    }
+}
+
+
+void httpsvr_send(httpsvr_conn_struct *conn) {
+    httpsvr_send_length(conn, -1);
+}
+
+
+void httpsvr_handler_headers(httpsvr_conn_struct *conn) {
+    int start = (conn->resp_length_pos >= 0) ? conn->resp_length_pos : conn->resp_head;
+    char *resp = &conn->send_data[start];
+    
+    /* handler wrote only headers, terminate them if it did not */
+    conn->send_data_len = start + strnlen(resp, conn->send_data_max_len - start);
+    if (httpsvr_header_end(resp, conn->send_data_len - start) == 0) {
+        httpsvr_append_send(conn, "\r\n");
+    }
+}
+
+
+int httpsvr_is_head(httpsvr_conn_struct *conn) {
+    return (conn->req_method != NULL) && (strcmp(conn->req_method, "HEAD") == 0);
+}
+
+
+int httpsvr_write_pending(httpsvr_conn_struct *conn) {
+    int rc = -1;
+    
+    if (conn != NULL) {
+        rc = httpsvr_write_chain(conn);
+        
+        /* then produce streamed chunks into the emptied buffer */
+        while ((rc > 0) && (conn->stream != NULL)) {
+            rc = httpsvr_stream_fill(conn);
+            if (rc > 0) {
+                rc = httpsvr_write_chain(conn);
+            }
+        }
+        
+        /* time from queueing the batch to its last byte */
+        if ((rc > 0) && (conn->send_start != 0)) {
+            httpsvr_metrics_time(conn->metrics, HTTPSVR_PHASE_SEND,
+                                 httpsvr_metrics_clock() - conn->send_start);
+            conn->send_start = 0;
+        }
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_echo_req(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        int n = conn->req_len;
+        if (n > conn->send_data_max_len - conn->resp_start) {
+            n = conn->send_data_max_len - conn->resp_start;
+        }
+        conn->send_data_len   = conn->resp_start;
+        httpsvr_send_drop(conn, conn->resp_seg_start);
+        conn->resp_status     = -1;
+        conn->resp_head       = conn->resp_start;
+        conn->resp_length_pos = -1;
+        memcpy(&conn->send_data[conn->send_data_len], conn->recv_data, n);
+        conn->send_data_len += n;
+        httpsvr_send(conn);
+    }
+}
+
+
+void httpsvr_put_send(httpsvr_conn_struct *conn, const char *data, int len) {
+    if (len > conn->send_data_max_len - conn->send_data_len) {
+        len = conn->send_data_max_len - conn->send_data_len;
+    }
+    memcpy(&conn->send_data[conn->send_data_len], data, len);
+    conn->send_data_len += len;
+}
+
+
+void httpsvr_status_resp(httpsvr_conn_struct *conn, int status) {
+    if (conn != NULL) {
+        
+        /* status line and common headers come from the prebuilt templates */
+        conn->send_data_len   = conn->resp_start;
+        httpsvr_send_drop(conn, conn->resp_seg_start);
+        conn->resp_status     = status;
+        conn->resp_head       = conn->resp_start;
+        conn->resp_length_pos = -1;
+    }
+}
+
+
+void httpsvr_length_resp(httpsvr_conn_struct *conn, int status) {
+    if (conn != NULL) {
+        httpsvr_status_resp(conn, status);
+        
+        /* room for the content length, filled in by httpsvr_send */
+        if (conn->send_data_max_len - conn->send_data_len > HTTPSVR_CONTENT_LENGTH_LEN) {
+            conn->send_data_len  += HTTPSVR_CONTENT_LENGTH_LEN;
+            conn->resp_length_pos = conn->send_data_len;
+            conn->send_data[conn->send_data_len] = '\0';
+        }
+    }
+}
+
+
+void httpsvr_ok_resp(httpsvr_conn_struct *conn) {
+    httpsvr_length_resp(conn, HTTPSVR_RESP_OK);
+}
+
+
+void httpsvr_no_content_resp(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_status_resp(conn, HTTPSVR_RESP_NO_CONTENT);
+        httpsvr_put_send(conn, "\r\n", 2);
+        httpsvr_send(conn);
+    }
+}
+
+
+void httpsvr_bad_request_resp(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_length_resp(conn, HTTPSVR_RESP_BAD_REQUEST);
+        httpsvr_put_send(conn, "\r\n", 2);
+        httpsvr_send(conn);
+    }
+}
+
+
+void httpsvr_too_large_resp(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_length_resp(conn, HTTPSVR_RESP_TOO_LARGE);
+        httpsvr_put_send(conn, "\r\n", 2);
+        httpsvr_send(conn);
+    }
+}
+
+
+void httpsvr_headers_too_large_resp(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_length_resp(conn, HTTPSVR_RESP_HEADERS_TOO_LARGE);
+        httpsvr_put_send(conn, "\r\n", 2);
+        httpsvr_send(conn);
+    }
+}
+
+
+void httpsvr_server_error_resp(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_length_resp(conn, HTTPSVR_RESP_SERVER_ERROR);
+        httpsvr_put_send(conn, "\r\n", 2);
+        httpsvr_send(conn);
+    }
+}
+
+
+void httpsvr_not_found_resp(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        httpsvr_length_resp(conn, HTTPSVR_RESP_NOT_FOUND);
+        httpsvr_put_send(conn, "\r\nCould not find object\r\n",
+                         sizeof("\r\nCould not find object\r\n") - 1);
+        httpsvr_send(conn);
+    }
+}
+
+
+int httpsvr_format_date(char *buffer, int buffer_len, long long t) {
+    struct tm tm;
+    time_t tt = t;
+    
+    /* IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT" */
+    gmtime_r(&tt, &tm);
+    return snprintf(buffer, buffer_len, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                    httpsvr_day_names[tm.tm_wday], tm.tm_mday,
+                    httpsvr_month_names[tm.tm_mon], tm.tm_year + 1900,
+                    tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+
+int httpsvr_parse_date(const char *value, int value_len, long long *t) {
+    int rc = 0;
+    char s[64];
+    char month[4];
+    int day = 0;
+    int year = 0;
+    int hour = 0;
+    int min = 0;
+    int sec = 0;
+    int m = 0;
+    long long days = 0;
+    
+    /* only the IMF-fixdate form, anything else is ignored */
+    if (value_len < sizeof(s)) {
+        memcpy(s, value, value_len);
+        s[value_len] = '\0';
+        if (sscanf(s, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT",
+                   &day, month, &year, &hour, &min, &sec) == 6) {
+            for (m = 0; m < 12; m++) {
+                if (strcmp(month, httpsvr_month_names[m]) == 0) {
+                    break;
+                }
+            }
+            if (m < 12) {
+                
+                /* days since the epoch, with March as the first month */
+                if (m < 2) {
+                    year--;
+                }
+                m = (m + 10) % 12;
+                days = 365LL * year + year / 4 - year / 100 + year / 400 +
+                       (153 * m + 2) / 5 + day - 1 - 719468;
+                *t = ((days * 24 + hour) * 60 + min) * 60 + sec;
+                rc = 1;
+            }
+        }
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_etag_match(const char *value, int value_len,
+                       const char *etag, int etag_len) {
+    int rc = 0;
+    int i = 0;
+    int n = 0;
+    
+    /* any entry of a comma separated list, weak or strong */
+    while ((rc == 0) && (i < value_len)) {
+        while ((i < value_len) && ((value[i] == ' ') || (value[i] == ','))) {
+            i++;
+        }
+        if ((value_len - i >= 2) && (value[i] == 'W') && (value[i + 1] == '/')) {
+            i += 2;
+        }
+        n = i;
+        while ((n < value_len) && (value[n] != ',') && (value[n] != ' ')) {
+            n++;
+        }
+        if (((n - i == 1) && (value[i] == '*')) ||
+            ((n - i == etag_len) && (memcmp(&value[i], etag, etag_len) == 0))) {
+            rc = 1;
+        }
+        i = n;
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_format_etag(char *etag, long long size, long long mtime, long long ino) {
+    return sprintf(etag, "\"%llx-%llx-%llx\"", ino, size, mtime);
+}
+
+
+void httpsvr_add_header(httpsvr_conn_struct *conn, const char *name, const char *value) {
+    int start = (conn->resp_length_pos >= 0) ? conn->resp_length_pos : conn->resp_head;
+    int n = httpsvr_header_end(&conn->send_data[start], conn->send_data_len - start);
+    
+    /* step back over the blank line, and put it back after */
+    if (n >= 2) {
+        conn->send_data_len = start + n - 2;
+        httpsvr_append_send(conn, name);
+        httpsvr_append_send(conn, ": ");
+        httpsvr_append_send(conn, value);
+        httpsvr_append_send(conn, "\r\n\r\n");
+    }
+}
+
+
+int httpsvr_validators(httpsvr_conn_struct *conn,
+                       long long size,
+                       long long mtime,
+                       long long ino) {
+    int rc = 0;
+    char etag[64];
+    char date[40];
+    const char *value = NULL;
+    int etag_len = 0;
+    int n = 0;
+    long long t = 0;
+    
+    /* add ETag and Last-Modified ahead of the blank line */
+    etag_len = httpsvr_format_etag(etag, size, mtime, ino);
+    httpsvr_format_date(date, sizeof(date), mtime);
+    httpsvr_add_header(conn, "ETag", etag);
+    httpsvr_add_header(conn, "Last-Modified", date);
+    
+    /* If-None-Match wins over If-Modified-Since, both only for reads */
+    if ((strcmp(conn->req_method, "GET") == 0) || httpsvr_is_head(conn)) {
+        value = httpsvr_find_header(conn, "If-None-Match", &n);
+        if (value != NULL) {
+            rc = httpsvr_etag_match(value, n, etag, etag_len);
+        } else {
+            value = httpsvr_find_header(conn, "If-Modified-Since", &n);
+            if ((value != NULL) && httpsvr_parse_date(value, n, &t)) {
+                rc = (mtime <= t);
+            }
+        }
+    }
+    
+    return rc;
+}
+
+
+long long httpsvr_open_file(httpsvr_conn_struct *conn,
+                            httpsvr_cache_entry_struct **entry,
+                            int *fd,
+                            long long *mtime,
+                            long long *ino) {
+    long long size = -1;
+    struct stat st;
+    
+    /* hot files come from memory, the rest from the file system */
+    *entry = NULL;
+    *fd = -1;
+    if (conn->hss->cache != NULL) {
+        *entry = httpsvr_cache_lookup(conn->hss->cache, conn->file_path);
+    }
+    if (*entry != NULL) {
+        size   = (*entry)->size;
+        *mtime = (*entry)->mtime;
+        *ino   = (*entry)->ino;
+    } else {
+        *fd = open(conn->file_path, O_RDONLY);
+        if ((*fd != -1) &&
+            (fstat(*fd, &st) == 0) &&
+            S_ISREG(st.st_mode)) {
+            size   = st.st_size;
+            *mtime = st.st_mtime;
+            *ino   = st.st_ino;
+        } else if (*fd != -1) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    
+    return size;
+}
+
+
+void httpsvr_send_file(httpsvr_conn_struct *conn) {
+    int fd = -1;
+    long long size = -1;
+    long long mtime = 0;
+    long long ino = 0;
+    long long start = 0;
+    long long end = 0;
+    long long content_len = 0;
+    int not_modified = 0;
+    int gzip = 0;
+    int n = 0;
+    httpsvr_cache_entry_struct *entry = NULL;
+    
+    if (conn != NULL) {
+        
+        /* a precompressed file.gz stands in for file when acceptable */
+        n = strlen(conn->file_path);
+        if (conn->hss->gzip_static &&
+            (n + 3 < conn->file_path_max_len) &&
+            (httpsvr_zip_accepts(conn) & HTTPSVR_ZIP_GZIP)) {
+            memcpy(&conn->file_path[n], ".gz", 4);
+            size = httpsvr_open_file(conn, &entry, &fd, &mtime, &ino);
+            conn->file_path[n] = '\0';
+            gzip = (size >= 0);
+        }
+        if (!gzip) {
+            size = httpsvr_open_file(conn, &entry, &fd, &mtime, &ino);
+        }
+        
+        if (size < 0) {
+            httpsvr_not_found_resp(conn);
+        } else {
+            
+            /* handler wrote the headers, the file follows as the body */
+            httpsvr_handler_headers(conn);
+            if (gzip) {
+                httpsvr_add_header(conn, "Content-Encoding", "gzip");
+            }
+            if (conn->hss->gzip_static) {
+                httpsvr_add_header(conn, "Vary", "Accept-Encoding");
+            }
+            
+            /* a client holding the same version gets the headers only */
+            if (conn->resp_length_pos >= 0) {
+                not_modified = httpsvr_validators(conn, size, mtime, ino);
+            }
+            start = 0;
+            end   = size;
+            content_len = size;
+            if (not_modified) {
+                conn->resp_status = HTTPSVR_RESP_NOT_MODIFIED;
+            } else if (conn->resp_length_pos >= 0) {
+                content_len = httpsvr_range_start(conn, size, mtime, ino, &start, &end);
+            }
+            httpsvr_send_length(conn, content_len);
+            
+            /* the body is the window, or the parts with their headers,
+               queued behind the headers without copying */
+            if (httpsvr_is_head(conn) || not_modified ||
+                ((start == end) && (conn->ranges_len == 0))) {
+                httpsvr_cache_release(conn->hss->cache, entry);
+                if (fd != -1) {
+                    close(fd);
+                }
+            } else if (conn->ranges_len > 0) {
+                httpsvr_range_queue(conn, fd, entry);
+            } else {
+                httpsvr_send_window(conn, fd, entry, start, end);
+                httpsvr_send_own(conn, fd, entry);
+            }
+        }
+    }
+}
+
+
+void httpsvr_stream_resp(httpsvr_conn_struct *conn,
+                         const char *page_name,
+                         httpsvr_page_handler_struct *page) {
+    int n = 0;
+    
+    if (conn != NULL) {
+        
+        /* without chunked encoding the end of the body is the close */
+        conn->stream_chunked = httpsvr_is_http11(conn);
+        if (!conn->stream_chunked) {
+            conn->keep_alive = 0;
+        }
+        httpsvr_status_resp(conn, HTTPSVR_RESP_OK);
+        if (conn->stream_chunked) {
+            httpsvr_append_send(conn, "Transfer-Encoding: chunked\r\n");
+        }
+        httpsvr_append_send(conn, "Content-Type: ");
+        httpsvr_append_send(conn, page->content_type);
+        httpsvr_append_send(conn, "\r\n\r\n");
+        httpsvr_send(conn);
+        
+        if (!httpsvr_is_head(conn)) {
+            
+            /* request buffer moves on, keep the arguments with the stream */
+            n = 0;
+            n += httpsvr_append(&conn->file_path[n], conn->file_path_max_len - n,
+                                page_name) + 1;
+            conn->stream_params = NULL;
+            if ((conn->req_params != NULL) && (n < conn->file_path_max_len)) {
+                conn->stream_params = &conn->file_path[n];
+                httpsvr_append(conn->stream_params, conn->file_path_max_len - n,
+                               conn->req_params);
+            }
+            conn->stream         = page->stream;
+            conn->stream_context = NULL;
+        }
+    }
+}
+
+
+void httpsvr_stream_end(httpsvr_conn_struct *conn) {
+    if ((conn != NULL) && (conn->stream != NULL)) {
+        
+        /* let the handler release its context */
+        conn->stream(conn->file_path, conn->stream_params,
+                     &conn->stream_context, NULL, 0);
+        conn->stream         = NULL;
+        conn->stream_context = NULL;
+        conn->stream_params  = NULL;
+    }
+}
+
+
+int httpsvr_stream_fill(httpsvr_conn_struct *conn) {
+    int rc = 1;
+    int n = 0;
+    int head_len = 0;
+    char head[16];
+    
+    /* leave room in front for the chunk size, and behind for the
+       chunk end and the last chunk */
+    int start = HTTPSVR_CHUNK_HEAD_LEN;
+    int max_len = conn->send_data_max_len - start - HTTPSVR_CHUNK_TAIL_LEN;
+    if (!conn->stream_chunked) {
+        start = 0;
+        max_len = conn->send_data_max_len;
+    }
+    
+    httpsvr_current_conn = conn;
+    n = conn->stream(conn->file_path, conn->stream_params,
+                     &conn->stream_context, &conn->send_data[start], max_len);
+    httpsvr_current_conn = NULL;
+    if (n > max_len) {
+        n = max_len;
+    }
+    httpsvr_send_clear(conn);
+    conn->send_data_len = start;
+    if (n > 0) {
+        conn->send_data_len += n;
+        if (conn->stream_chunked) {
+            head_len = sprintf(head, "%x\r\n", n);
+            start -= head_len;
+            memcpy(&conn->send_data[start], head, head_len);
+            memcpy(&conn->send_data[conn->send_data_len], "\r\n", 2);
+            conn->send_data_len += 2;
+        }
+    } else {
+        if (n == 0) {
+            if (conn->stream_chunked) {
+                memcpy(&conn->send_data[conn->send_data_len], "0\r\n\r\n", 5);
+                conn->send_data_len += 5;
+            }
+        } else {
+            rc = -1;  /* handler failed, the client sees a cut short body */
+        }
+        httpsvr_stream_end(conn);
+    }
+    httpsvr_send_queue(conn, &conn->send_data[start], conn->send_data_len - start);
+    
+    return rc;
+}
+
+
+int httpsvr_strncmp(const char *s1, int len1, const char *s2, int len2) {
+    int rc = 0;
+    
+    if (len2 >= len1) {
+        if (strncmp(s1, s2, len1) == 0) {
+            rc = 1;
+        }
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_parse_mark(httpsvr_conn_struct *conn, int n, char c) {
+    
+    /* the two spaces split the request line, the query, extension and
+       '~' only matter inside the path */
+    if (c == ' ') {
+        if (conn->parse_spaces == 0) {
+            conn->req_method_slice.pos = conn->parse_pos;
+            conn->req_method_slice.len = n - conn->parse_pos;
+        } else if (conn->parse_spaces == 1) {
+            conn->req_target_slice.pos = conn->parse_pos + conn->req_method_slice.len + 1;
+            conn->req_target_slice.len = n - conn->req_target_slice.pos;
+        }
+        conn->parse_spaces++;
+    } else if ((conn->parse_spaces == 1) && (conn->req_query_pos < 0)) {
+        if (c == '?') {
+            conn->req_query_pos = n;
+        } else if (c == '.') {
+            conn->req_dot_pos = n;
+        } else if (c == '~') {
+            conn->req_tilde = 1;
+        }
+    }
+}
+
+
+void httpsvr_parse_request_line(httpsvr_conn_struct *conn, int pos, int len) {
+    const char *s = &conn->recv_data[pos];
+    int i = 0;
+    
+    conn->parse_state = HTTPSVR_PARSE_ERROR;
+    
+    /* method token, request target and version, split by single spaces */
+    if ((conn->parse_spaces == 2) &&
+        (conn->req_method_slice.len > 0) &&
+        (conn->req_target_slice.len > 0)) {
+        for (i = 0; i < conn->req_method_slice.len; i++) {
+            if ((s[i] < 'A') || (s[i] > 'Z')) {
+                break;
+            }
+        }
+        conn->req_ver_slice.pos = conn->req_target_slice.pos + conn->req_target_slice.len + 1;
+        conn->req_ver_slice.len = pos + len - conn->req_ver_slice.pos;
+        if ((i == conn->req_method_slice.len) &&
+            (conn->req_ver_slice.len >= 8) &&
+            (strncmp(&conn->recv_data[conn->req_ver_slice.pos], "HTTP/", 5) == 0)) {
+            conn->parse_state = HTTPSVR_PARSE_HEADERS;
+        }
+    }
+}
+
+
+void httpsvr_parse_header(httpsvr_conn_struct *conn, int pos, int len) {
+    const char *s = &conn->recv_data[pos];
+    httpsvr_header_struct *header = NULL;
+    int i = 0;
+    
+    /* lines without a name, folded lines and headers past the
+       table are skipped */
+    if ((conn->parse_colon > pos) && (s[0] != ' ') && (s[0] != '\t') &&
+        (conn->headers_len < HTTPSVR_MAX_HEADERS)) {
+        header = &conn->headers[conn->headers_len++];
+        header->name.pos = pos;
+        header->name.len = conn->parse_colon - pos;
         
-        /* get file extension */
-        const char *file_extension = strrchr(hss->req_path, '.');
-        if (file_extension != NULL) {
-            file_extension++;
+        /* trim white space around the value */
+        i = header->name.len + 1;
+        while ((i < len) && ((s[i] == ' ') || (s[i] == '\t'))) {
+            i++;
+        }
+        while ((len > i) && ((s[len - 1] == ' ') || (s[len - 1] == '\t'))) {
+            len--;
+        }
+        header->value.pos = pos + i;
+        header->value.len = len - i;
+    }
+    conn->parse_colon = -1;
+}
+
+
+int httpsvr_req_complete(httpsvr_conn_struct *conn) {
+    int rc = 0;
+    int len = 0;
+    int n = 0;
+    char c = '\0';
+    const httpsvr_scan_set *set = NULL;
+    
+    if ((conn != NULL) && (conn->req_len > 0)) {
         
-            /* find matching file extension */
-            int i = 0;
-            for (i = 0; i < hss->file_handlers_len; i++) {
-                n = strcmp(file_extension,
-                           hss->file_handlers[i].ext);
-                if (n == 0) {
-                    break;
+        /* headers already found, complete once the body is in */
+        rc = httpsvr_body_read(conn);
+        
+    } else if (conn != NULL) {
+        
+        /* resume with the first byte not yet scanned, so each byte is
+           looked at once however the request is split across reads */
+        while ((rc == 0) && (conn->parse_scan < conn->recv_data_len)) {
+            set = (conn->parse_state == HTTPSVR_PARSE_REQUEST_LINE) ?
+                  &httpsvr_scan_request_line : &httpsvr_scan_header_line;
+            n = conn->parse_scan + httpsvr_scan(set, &conn->recv_data[conn->parse_scan],
+                                                conn->recv_data_len - conn->parse_scan);
+            conn->parse_scan = n + 1;
+            if (n >= conn->recv_data_len) {
+                conn->parse_scan = conn->recv_data_len;
+                break;
+            }
+            c = conn->recv_data[n];
+            if (c != '\n') {
+                if (conn->parse_state == HTTPSVR_PARSE_REQUEST_LINE) {
+                    httpsvr_parse_mark(conn, n, c);
+                } else if (conn->parse_colon < 0) {
+                    conn->parse_colon = n;
                 }
+                continue;
             }
             
-            /* if match was not found, then check if last extension is a wildcard */
-            if (i == hss->file_handlers_len) {
-                if (i > 0) {
-                    n = strcmp(HTTPSVR_WILDCARD,
-                               hss->file_handlers[i - 1].ext);
-                    if (n == 0) {
-                        i--;
-                    }
+            len = n - conn->parse_pos;
+            if ((len > 0) && (conn->recv_data[n - 1] == '\r')) {
+                len--;
+            }
+            if (conn->parse_state == HTTPSVR_PARSE_REQUEST_LINE) {
+                
+                /* blank lines ahead of a request are ignored */
+                if (len > 0) {
+                    httpsvr_parse_request_line(conn, conn->parse_pos, len);
+                }
+            } else if (len == 0) {
+                
+                /* blank line ends the headers, any body follows */
+                conn->req_len = n + 1;
+                if (conn->parse_state == HTTPSVR_PARSE_HEADERS) {
+                    httpsvr_body_start(conn);
+                }
+                rc = httpsvr_body_read(conn);
+                break;
+            } else if (conn->parse_state == HTTPSVR_PARSE_HEADERS) {
+                httpsvr_parse_header(conn, conn->parse_pos, len);
+            }
+            conn->parse_colon = -1;
+            conn->parse_pos = n + 1;
+        }
+        
+        /* headers that fill the buffer may have lost their framing,
+           they are refused and the connection closed */
+        if ((rc == 0) && (conn->req_len == 0) &&
+            (conn->recv_data_len >= conn->recv_data_max_len)) {
+            conn->req_len = conn->recv_data_len;
+            httpsvr_body_fail(conn, HTTPSVR_STATUS_HEADERS_TOO_LARGE);
+            rc = 1;
+        }
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_parse_req(httpsvr_conn_struct *conn) {
+    char *s = NULL;
+
+    if (conn != NULL) {
+        conn->req_method = NULL;
+        conn->req_path   = NULL;
+        conn->req_params = NULL;
+        conn->req_ver    = NULL;
+        
+        /* the request line was indexed as it arrived, terminate its
+           parts in place, headers stay as slices */
+        if (conn->parse_state == HTTPSVR_PARSE_HEADERS) {
+            s = conn->recv_data;
+            conn->req_method = &s[conn->req_method_slice.pos];
+            conn->req_method[conn->req_method_slice.len] = '\0';
+            conn->req_path = &s[conn->req_target_slice.pos];
+            conn->req_path[conn->req_target_slice.len] = '\0';
+            conn->req_ver = &s[conn->req_ver_slice.pos];
+            conn->req_ver[conn->req_ver_slice.len] = '\0';
+            
+            /* get parameters at the end of the path */
+            if (conn->req_query_pos >= 0) {
+                s[conn->req_query_pos] = '\0';
+                conn->req_params = &s[conn->req_query_pos + 1];
+            }
+        }
+    }
+}
+
+
+const char *httpsvr_find_header(httpsvr_conn_struct *conn,
+                                const char *name,
+                                int *value_len) {
+    const char *value = NULL;
+    httpsvr_header_struct *header = NULL;
+    int name_len = strlen(name);
+    int i = 0;
+    
+    if (conn != NULL) {
+        for (i = 0; i < conn->headers_len; i++) {
+            header = &conn->headers[i];
+            if ((header->name.len == name_len) &&
+                (strncasecmp(&conn->recv_data[header->name.pos], name, name_len) == 0)) {
+                value = &conn->recv_data[header->value.pos];
+                if (value_len != NULL) {
+                    *value_len = header->value.len;
                 }
+                break;
+            }
+        }
+    }
+    
+    return value;
+}
+
+
+/* connection whose request is being answered on this thread */
+HTTPSVR_THREAD_LOCAL httpsvr_conn_struct *httpsvr_current_conn = NULL;
+
+
+const char *httpsvr_get_method(void) {
+    const char *method = NULL;
+    
+    if (httpsvr_current_conn != NULL) {
+        method = httpsvr_current_conn->req_method;
+    }
+    
+    return method;
+}
+
+
+const char *httpsvr_get_header(const char *name,
+                               int *value_len) {
+    return httpsvr_find_header(httpsvr_current_conn, name, value_len);
+}
+
+
+const char *httpsvr_get_body(int *body_len) {
+    const char *body = NULL;
+    int n = 0;
+    httpsvr_conn_struct *conn = httpsvr_current_conn;
+    
+    if ((conn != NULL) && (conn->body_state == HTTPSVR_BODY_DONE) && (conn->upload == NULL)) {
+        body = (conn->req_body != NULL) ? conn->req_body : "";
+        n = conn->req_body_len;
+    }
+    if (body_len != NULL) {
+        *body_len = n;
+    }
+    
+    return body;
+}
+
+
+int httpsvr_get_num_headers(void) {
+    int n = 0;
+    
+    if (httpsvr_current_conn != NULL) {
+        n = httpsvr_current_conn->headers_len;
+    }
+    
+    return n;
+}
+
+
+const char *httpsvr_get_header_at(int i,
+                                  const char **name,
+                                  int *name_len,
+                                  int *value_len) {
+    const char *value = NULL;
+    httpsvr_conn_struct *conn = httpsvr_current_conn;
+    
+    if ((conn != NULL) && (i >= 0) && (i < conn->headers_len)) {
+        value = &conn->recv_data[conn->headers[i].value.pos];
+        if (name != NULL) {
+            *name = &conn->recv_data[conn->headers[i].name.pos];
+        }
+        if (name_len != NULL) {
+            *name_len = conn->headers[i].name.len;
+        }
+        if (value_len != NULL) {
+            *value_len = conn->headers[i].value.len;
+        }
+    }
+    
+    return value;
+}
+
+
+int httpsvr_has_token(const char *value, int value_len, const char *token) {
+    int rc = 0;
+    int i = 0;
+    int n = strlen(token);
+    
+    /* look for token in a comma separated list */
+    if (value != NULL) {
+        while ((i < value_len) && (rc == 0)) {
+            while ((i < value_len) && ((value[i] == ' ') || (value[i] == ','))) {
+                i++;
+            }
+            if ((value_len - i >= n) &&
+                (strncasecmp(&value[i], token, n) == 0) &&
+                ((i + n == value_len) || (value[i + n] == ',') || (value[i + n] == ' '))) {
+                rc = 1;
+            }
+            while ((i < value_len) && (value[i] != ',')) {
+                i++;
+            }
+        }
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_want_keep_alive(httpsvr_conn_struct *conn) {
+    int rc = 0;
+    int n = 0;
+    const char *value = NULL;
+    
+    /* HTTP/1.1 defaults to persistent, HTTP/1.0 must ask for it */
+    if ((conn->req_ver != NULL) && (conn->requests_left > 1)) {
+        value = httpsvr_find_header(conn, "Connection", &n);
+        if (strcmp(conn->req_ver, "HTTP/1.1") == 0) {
+            rc = !httpsvr_has_token(value, n, "close");
+        } else {
+            rc = httpsvr_has_token(value, n, "keep-alive");
+        }
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_handler_resp(httpsvr_conn_struct *conn, int n) {
+    int rc = 0;
+    
+    /* check return status */
+    if (n >= 0) {  /* ok */
+        
+        /* output filling the buffer may have been cut short */
+        if ((conn->send_data_len + n) >= conn->send_data_max_len) {
+            conn->send_data_len = conn->send_data_max_len;
+            
+            /* behind earlier responses the handler only had what they
+               left of the buffer, so the full buffer makes the batch
+               build it again into a fresh one; with the whole buffer to
+               itself it really is too large, and is refused rather than
+               sent truncated under a matching length */
+            if (conn->resp_start == 0) {
+                httpsvr_server_error_resp(conn);
+            }
+        } else {
+            conn->send_data_len += n;
+            
+            /* compress the body if configured, then send response */
+            httpsvr_zip_resp(conn);
+            httpsvr_send(conn);
+        }
+        rc = 1;
+        
+    } else if (n == -HTTPSVR_SEND_FILE) {  /* file body */
+        httpsvr_send_file(conn);
+        rc = 1;
+        
+    } else if (n == -HTTPSVR_STATUS_NO_CONTENT) {  /* no content */
+        httpsvr_no_content_resp(conn);
+        rc = 1;
+        
+    } else if (n == -HTTPSVR_STATUS_MOVED) {  /* redirect */
+        
+        /* same headers under the moved status line */
+        conn->resp_status = HTTPSVR_RESP_MOVED;
+        httpsvr_handler_headers(conn);
+        httpsvr_send(conn);
+        rc = 1;
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_process_file(httpsvr_conn_struct *conn) {
+    int processed_flag = 0;
+    int n = 0;
+    if (conn != NULL) {
+        httpsvr_struct *hss = conn->hss;
+        
+        /* append resp path to root path */
+        strncpy(conn->file_path, hss->file_root_path, conn->file_path_max_len);
+        conn->file_path[conn->file_path_max_len - 1] = '\0';
+        n = strlen(conn->file_path);
+        strncpy(&conn->file_path[n], conn->req_path, conn->file_path_max_len - n);
+        
+        /* get file extension */
+        const char *file_extension = NULL;
+        if (conn->req_dot_pos >= 0) {
+            file_extension = &conn->recv_data[conn->req_dot_pos];
+        }
+        if (file_extension != NULL) {
+            file_extension++;
+        
+            /* find matching file extension, else fall back to the wildcard */
+            int i = httpsvr_find_file(hss, file_extension);
+            if (i < 0) {
+                i = hss->file_wildcard;
             }
             
             /* check if handler is valid */
-            if (i < hss->file_handlers_len) {
+            if (i >= 0) {
                 if (hss->file_handlers[i].handler != NULL) {
-                    httpsvr_ok_resp(handle);
+                    httpsvr_ok_resp(conn);
                     
                     /* call handler */
-                    n = hss->file_handlers[i].handler(hss->file_path,
-                                                          hss->req_params,
-                                                          &hss->send_data[hss->send_data_len],
-                                                          hss->send_data_max_len - hss->send_data_len);
-                    /* check return status */
-                    if (n > 0) {  /* ok */
-                        if ((hss->send_data_len + n) > hss->send_data_max_len) {
-                            hss->send_data_len = hss->send_data_max_len;
-                        } else {
-                            hss->send_data_len += n;
-                        }
-                        
-                        /* send response */
-                        httpsvr_send(handle);
-                        processed_flag = 1;
-                        
-                    } else if (n == -HTTPSVR_STATUS_NO_CONTENT) {  /* no content */
-                        httpsvr_no_content_resp(handle);
-                        processed_flag = 1;
-                        
-                    } else if (n == -HTTPSVR_STATUS_MOVED) {  /* redirect */
-                        
-                        /* over write ok status with moved status */
-                        char *s = strstr(hss->send_data, "200");
-                        if (s != NULL) {
-                            memcpy(s, "301", 3);
-                        }
-                        hss->send_data_len = strlen(hss->send_data);
-                        
-                        /* send response */
-                        httpsvr_send(handle);
-                        processed_flag = 1;
+                    n = hss->file_handlers[i].handler(conn->file_path,
+                                                      conn->req_params,
+                                                      &conn->send_data[conn->send_data_len],
+                                                      conn->send_data_max_len - conn->send_data_len);
+                    
+                    /* nothing written counts as not found */
+                    if (n != 0) {
+                        processed_flag = httpsvr_handler_resp(conn, n);
                     }
                 }
             }
@@ -640,148 +1913,411 @@ void httpsvr_process_file(httpsvr_handle handle) {
         
         /* if no match, then respond with not found error */
         if (!processed_flag) {
-            httpsvr_not_found_resp(handle);
+            httpsvr_not_found_resp(conn);
         }
     }
 }
 
 
-void httpsvr_process_page(httpsvr_handle handle) {
+void httpsvr_process_page(httpsvr_conn_struct *conn) {
     int processed_flag = 0;
     int n = 0;
-    httpsvr_struct *hss = handle;
-    if (hss != NULL) {
+    const char *page_name = NULL;
+    if (conn != NULL) {
+        httpsvr_struct *hss = conn->hss;
         
-        /* skip leading slash */
-        if ((hss->req_path[0] == '/') && (hss->req_path[1] != '\0')) {
-            hss->req_path++;
+        /* skip leading slash, the request path itself stays whole for
+           the access log */
+        page_name = conn->req_path;
+        if ((page_name[0] == '/') && (page_name[1] != '\0')) {
+            page_name++;
         }
             
-        /* find matching page */
-        int i = 0;
-        for (i = 0; i < hss->page_handlers_len; i++) {
-            n = strcmp(hss->req_path,
-                       hss->page_handlers[i].name);
-            if (n == 0) {
-                break;
-            }
-        }
-        
-        /* if match was not found, then check if last path name is a wildcard */
-        if (i == hss->page_handlers_len) {
-            if (i > 0) {
-                n = strcmp(HTTPSVR_WILDCARD,
-                           hss->page_handlers[i - 1].name);
-                if (n == 0) {
-                    i--;
-                }
-            }
+        /* find matching page, else fall back to the wildcard */
+        int i = httpsvr_find_page(hss, page_name);
+        if (i < 0) {
+            i = hss->page_wildcard;
         }
         
         /* check if handler is valid */
-        if (i < hss->page_handlers_len) {
-            if (hss->page_handlers[i].handler != NULL) {
-                httpsvr_ok_resp(handle);
+        if (i >= 0) {
+            if (hss->page_handlers[i].stream != NULL) {
+                httpsvr_stream_resp(conn, page_name, &hss->page_handlers[i]);
+                processed_flag = 1;
+                
+            } else if (hss->page_handlers[i].upload != NULL) {
+                httpsvr_ok_resp(conn);
+                
+                /* the body went to the handler as it arrived, now answer */
+                n = hss->page_handlers[i].upload(page_name,
+                                                 conn->req_params,
+                                                 &conn->upload_context,
+                                                 NULL,
+                                                 0,
+                                                 &conn->send_data[conn->send_data_len],
+                                                 conn->send_data_max_len - conn->send_data_len);
+                conn->upload         = NULL;
+                conn->upload_context = NULL;
+                processed_flag = httpsvr_handler_resp(conn, n);
+                
+            } else if (hss->page_handlers[i].handler != NULL) {
+                httpsvr_ok_resp(conn);
                 
                 /* call handler */
-                n = hss->page_handlers[i].handler(hss->req_path,
-                                                  hss->req_params,
-                                                  &hss->send_data[hss->send_data_len],
-                                                  hss->send_data_max_len - hss->send_data_len);
-                /* check return status */
-                if (n >= 0) {  /* ok */
-                    if ((hss->send_data_len + n) > hss->send_data_max_len) {
-                        hss->send_data_len = hss->send_data_max_len;
-                    } else {
-                        hss->send_data_len += n;
-                    }
-                    
-                    /* send response */
-                    httpsvr_send(handle);
-                    processed_flag = 1;
-                    
-                } else if (n == -HTTPSVR_STATUS_NO_CONTENT) {  /* no content */
-                    httpsvr_no_content_resp(handle);
-                    processed_flag = 1;
-                    
-                } else if (n == -HTTPSVR_STATUS_MOVED) {  /* redirect */
-                    
-                    /* over write ok status with moved status */
-                    char *s = strstr(hss->send_data, "200");
-                    if (s != NULL) {
-                        memcpy(s, "301", 3);
-                    }
-                    hss->send_data_len = strlen(hss->send_data);
-                    
-                    /* send response */
-                    httpsvr_send(handle);
-                    processed_flag = 1;
-                }
+                n = hss->page_handlers[i].handler(page_name,
+                                                  conn->req_params,
+                                                  &conn->send_data[conn->send_data_len],
+                                                  conn->send_data_max_len - conn->send_data_len);
+                processed_flag = httpsvr_handler_resp(conn, n);
             }
         }
     }
     
     /* if no match, then respond with not found error */
     if (!processed_flag) {
-        httpsvr_not_found_resp(handle);
+        httpsvr_not_found_resp(conn);
     }
 }
 
 
-void httpsvr_process_req(httpsvr_handle handle) {
-    httpsvr_struct *hss = handle;
-    if (hss != NULL) {
-        hss->send_data_len = 0;
+void httpsvr_process_route(httpsvr_conn_struct *conn,
+                           httpsvr_route_struct *route) {
+    int n = 0;
+    
+    if (conn != NULL) {
+        httpsvr_ok_resp(conn);
+        
+        /* call handler with the segments captured from the path */
+        n = route->handler(conn->req_path,
+                           conn->req_params,
+                           conn->route_params,
+                           conn->route_params_len,
+                           &conn->send_data[conn->send_data_len],
+                           conn->send_data_max_len - conn->send_data_len);
+        if (!httpsvr_handler_resp(conn, n)) {
+            httpsvr_not_found_resp(conn);
+        }
+    }
+}
+
+
+void httpsvr_process_req(httpsvr_conn_struct *conn) {
+    httpsvr_route_struct *route = NULL;
+    long long start = 0;
+    long long parsed = 0;
+
+    if (conn != NULL) {
+        start = httpsvr_metrics_clock();
+        parsed = start;
+        conn->send_data_len = conn->resp_start;
+        httpsvr_send_drop(conn, conn->resp_seg_start);
+        conn->keep_alive = 0;
+        conn->route_id = -1;
+        if (conn->req_len == 0) {
+            conn->req_len = conn->recv_data_len;
+        }
 
         /* special check for echo request */
-        if (strncmp("GET /echo ", hss->recv_data, 10) == 0) {
-            httpsvr_echo_req(handle);
+        if (strncmp("GET /echo ", conn->recv_data, 10) == 0) {
+            httpsvr_echo_req(conn);
         } else {
-            httpsvr_parse_req(handle);
-            httpsvr_print_req(handle);
+            httpsvr_parse_req(conn);
+            parsed = httpsvr_metrics_clock();
+            httpsvr_metrics_time(conn->metrics, HTTPSVR_PHASE_PARSE, parsed - start);
+#if defined (HTTPSVR_DEBUG_DUMP)
+            httpsvr_print_req(conn);
+#endif
+            conn->keep_alive = httpsvr_want_keep_alive(conn);
+            httpsvr_current_conn = conn;
             
-            if (hss->req_path != NULL) {
+            /* a refused body is left unread, so the connection closes */
+            if (conn->body_error == HTTPSVR_STATUS_HEADERS_TOO_LARGE) {
+                conn->keep_alive = 0;
+                httpsvr_headers_too_large_resp(conn);
+            } else if (conn->body_error == HTTPSVR_STATUS_TOO_LARGE) {
+                conn->keep_alive = 0;
+                httpsvr_too_large_resp(conn);
+            } else if (conn->body_error != 0) {
+                conn->keep_alive = 0;
+                httpsvr_bad_request_resp(conn);
+            } else if (conn->req_path != NULL) {
 
                 /* check path for bad characters */
-                if (strrchr(hss->req_path, '~') != NULL) {
-                    httpsvr_bad_request_resp(handle);
+                if (conn->req_tilde) {
+                    httpsvr_bad_request_resp(conn);
+                
+                /* check if a route claims the path */
+                } else if ((route = httpsvr_route_match(conn->hss->routes,
+                                                        conn->req_method,
+                                                        conn->req_path,
+                                                        conn->route_params,
+                                                        &conn->route_params_len)) != NULL) {
+                    conn->route_id = route->id;
+                    httpsvr_process_route(conn, route);
+                
+                /* files and pages only answer the original methods */
+                } else if ((strcmp(conn->req_method, "GET") != 0) &&
+                           (strcmp(conn->req_method, "HEAD") != 0) &&
+                           (strcmp(conn->req_method, "POST") != 0)) {
+                    httpsvr_not_found_resp(conn);
                 
+                /* a bundled file needs no handler or file system */
+                } else if ((conn->hss->bundle != NULL) && httpsvr_bundle_serve(conn)) {
+                    
                 /* check if requested path is a file (has a '.') */
-                } else if (strrchr(hss->req_path, '.') != NULL) {
-                    httpsvr_process_file(handle);
+                } else if (conn->req_dot_pos >= 0) {
+                    httpsvr_process_file(conn);
                     
                     /* else it must be a special page */
                 } else {
-                    httpsvr_process_page(handle);
+                    httpsvr_process_page(conn);
                 }
             } else {
-                httpsvr_not_found_resp(handle);
+                httpsvr_bad_request_resp(conn);
             }
+            httpsvr_current_conn = NULL;
+        }
+        conn->resp_time = httpsvr_metrics_clock() - start;
+        httpsvr_metrics_time(conn->metrics, HTTPSVR_PHASE_HANDLER,
+                             conn->resp_time - (parsed - start));
+        conn->requests_left--;
+    }
+}
 
+
+void httpsvr_conn_next(httpsvr_conn_struct *conn) {
+    int n = 0;
+    
+    if (conn != NULL) {
+        
+        /* keep any bytes received past the finished request */
+        n = conn->recv_data_len - conn->req_len;
+        if (n > 0) {
+            memmove(conn->recv_data, &conn->recv_data[conn->req_len], n);
+        } else {
+            n = 0;
+        }
+        conn->recv_data_len = n;
+        conn->parse_state   = HTTPSVR_PARSE_REQUEST_LINE;
+        conn->parse_pos     = 0;
+        conn->parse_scan    = 0;
+        conn->parse_spaces  = 0;
+        conn->parse_colon   = -1;
+        conn->req_query_pos = -1;
+        conn->req_dot_pos   = -1;
+        conn->req_tilde     = 0;
+        conn->headers_len   = 0;
+        conn->req_len       = 0;
+        conn->req_method    = NULL;
+        conn->req_path      = NULL;
+        conn->req_params    = NULL;
+        conn->req_ver       = NULL;
+        conn->route_params_len = 0;
+        httpsvr_body_reset(conn);
+    }
+}
+
+
+int httpsvr_process_batch(httpsvr_conn_struct *conn) {
+    int num_req = 0;
+    
+    if (conn != NULL) {
+        httpsvr_send_clear(conn);
+        do {
+            
+            /* an upload is answered once, so never behind responses
+               that might have it taken back */
+            if ((conn->segs_len > 0) && (conn->upload != NULL)) {
+                break;
+            }
+            
+            /* room for the pieces of one more response */
+            if (conn->segs_len + HTTPSVR_RESP_MAX_SEGS > HTTPSVR_MAX_SEGS) {
+                break;
+            }
+            
+            /* responses to pipelined requests queue up behind each other */
+            conn->resp_start     = conn->send_data_len;
+            conn->resp_seg_start = conn->segs_len;
+            if (conn->resp_start > 0) {
+                memcpy(conn->req_save, conn->recv_data, conn->req_len);
+            }
+            httpsvr_process_req(conn);
+            
+            /* a response cut short by earlier ones in the buffer is taken
+               back and built again into a fresh one, or retried once
+               the batch has been written out */
+            if ((conn->resp_start > 0) &&
+                (conn->send_data_len >= conn->send_data_max_len)) {
+                memcpy(conn->recv_data, conn->req_save, conn->req_len);
+                httpsvr_send_drop(conn, conn->resp_seg_start);
+                conn->send_data_len = conn->resp_start;
+                conn->keep_alive    = 1;
+                conn->requests_left++;
+                if (httpsvr_send_grow(conn)) {
+                    continue;
+                }
+                break;
+            }
+            num_req++;
+            httpsvr_metrics_request(conn);
+            httpsvr_log_access(conn);
+            
+            /* anything after a closing response is ignored */
+            if (!conn->keep_alive) {
+                break;
+            }
+            httpsvr_conn_next(conn);
+            
+            /* a stream is produced into the emptied buffer, last */
+            if (conn->stream != NULL) {
+                break;
+            }
+        } while (httpsvr_req_complete(conn));
+        conn->resp_start     = 0;
+        conn->resp_seg_start = 0;
+        if (num_req > 0) {
+            conn->send_start = httpsvr_metrics_clock();
         }
     }
+    
+    return num_req;
 }
 
 
 void httpsvr_receive(httpsvr_handle handle) {
     int n = 0;
+    int complete = 0;
+    int body_started = 0;
+    long long start = 0;
     httpsvr_struct *hss = handle;
     if (hss != NULL) {
+        httpsvr_conn_struct *conn = hss->conn;
+        if (conn->metrics == NULL) {
+            conn->metrics = httpsvr_metrics_register(hss);
+        }
         if (listen(hss->listen_soc, 6) == 0) {
-            hss->recv_soc = accept(hss->listen_soc, NULL, 0);
-            if (hss->recv_soc != INVALID_SOCKET) {
-                n = hss->recv_data_max_len - hss->recv_data_len;
-                n = recv(hss->recv_soc, hss->recv_data, n, 0);
-                if (n > 0) {
-                    hss->recv_data_len += n;
-                    httpsvr_process_req(handle);
+            conn->soc = accept(hss->listen_soc, NULL, 0);
+            if (conn->soc == INVALID_SOCKET) {
+                if (conn->metrics != NULL) {
+                    httpsvr_metrics_add(conn->metrics->accept_errors, 1);
+                }
+            } else {
+                if (conn->metrics != NULL) {
+                    httpsvr_metrics_add(conn->metrics->accepted, 1);
+                }
+                
+                /* keep-alive would stall other clients, one request only */
+                conn->requests_left = 1;
+                
+                /* a silent or stalled client would hold the only
+                   connection forever */
+                httpsvr_socket_timeouts(conn->soc, hss->header_timeout, hss->write_timeout);
+                start = httpsvr_metrics_clock();
+                
+                /* read until the request is complete, the peer stops or
+                   the headers run out of time */
+                complete = 0;
+                do {
+                    n = conn->recv_data_max_len - conn->recv_data_len;
+                    n = recv(conn->soc, &conn->recv_data[conn->recv_data_len], n, 0);
+                    if (n > 0) {
+                        conn->recv_data_len += n;
+                        if (conn->metrics != NULL) {
+                            httpsvr_metrics_add(conn->metrics->bytes_in, n);
+                        }
+                        complete = httpsvr_req_complete(conn);
+                        
+                        /* a 100 Continue goes out before the rest of the body */
+                        if (!complete && (conn->seg_pos < conn->segs_len)) {
+                            httpsvr_write_pending(conn);
+                            httpsvr_send_clear(conn);
+                        }
+                        
+                        /* once the headers are in, the body may stall
+                           for body_timeout between reads */
+                        if (!complete && (conn->req_len > 0) && !body_started) {
+                            httpsvr_socket_timeouts(conn->soc, hss->body_timeout, hss->write_timeout);
+                            body_started = 1;
+                        }
+                    }
+                } while ((n > 0) && !complete &&
+                         ((hss->header_timeout == 0) || (conn->req_len > 0) ||
+                          (httpsvr_metrics_clock() - start < hss->header_timeout * 1000000LL)));
+                
+                /* what arrived before the peer stopped is answered, a
+                   request cut off by a timeout or error is dropped */
+                if ((conn->recv_data_len > 0) && (complete || (n == 0))) {
+                    httpsvr_process_req(conn);
+                    httpsvr_metrics_request(conn);
+                    httpsvr_log_access(conn);
+                    conn->send_start = httpsvr_metrics_clock();
+                    httpsvr_write_pending(conn);
+                }
+                shutdown(conn->soc, SD_SEND | SD_RECEIVE);
+                CLOSE(conn->soc);
+                conn->soc = INVALID_SOCKET;
+                httpsvr_conn_reset(conn);
+            }
+        }
+    }
+}
+
+
+int httpsvr_process(httpsvr_handle handle,
+                    const char *data,
+                    int data_len,
+                    httpsvr_sink sink,
+                    void *context) {
+    int rc = -1;
+    int n = 0;
+    httpsvr_struct *hss = handle;
+    if ((hss != NULL) && (sink != NULL) && (data != NULL)) {
+        httpsvr_conn_struct *conn = hss->conn;
+        if (conn->metrics == NULL) {
+            conn->metrics = httpsvr_metrics_register(hss);
+        }
+        conn->sink          = sink;
+        conn->sink_context  = context;
+        conn->requests_left = hss->keep_alive_max_requests;
+        rc = 0;
+        
+        /* feed the data as a socket would, a buffer at a time */
+        while (rc >= 0) {
+            n = conn->recv_data_max_len - conn->recv_data_len;
+            if (n > data_len) {
+                n = data_len;
+            }
+            memcpy(&conn->recv_data[conn->recv_data_len], data, n);
+            conn->recv_data_len += n;
+            data += n;
+            data_len -= n;
+            if (!httpsvr_req_complete(conn)) {
+                
+                /* a 100 Continue goes out before the rest of the body */
+                if (conn->seg_pos < conn->segs_len) {
+                    httpsvr_write_pending(conn);
+                    httpsvr_send_clear(conn);
+                }
+                if (n == 0) {
+                    break;  /* the rest is an incomplete request */
                 }
-                shutdown(hss->recv_soc, SD_SEND | SD_RECEIVE);
-                CLOSE(hss->recv_soc);
-                hss->recv_data_len = 0;
+                continue;
+            }
+            rc += httpsvr_process_batch(conn);
+            conn->send_start = httpsvr_metrics_clock();
+            if (httpsvr_write_pending(conn) < 0) {
+                rc = -1;
+            } else if (!conn->keep_alive) {
+                break;
             }
         }
+        conn->sink         = NULL;
+        conn->sink_context = NULL;
+        httpsvr_conn_reset(conn);
     }
+    
+    return rc;
 }
 
 
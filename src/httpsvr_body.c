@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "httpsvr_internal.h"
+#include "httpsvr_route.h"
+
+
+void httpsvr_body_reset(httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        
+        /* an upload cut short lets the handler release its context */
+        if (conn->upload != NULL) {
+            conn->upload(conn->upload_name, conn->req_params,
+                         &conn->upload_context, NULL, 0, NULL, 0);
+            conn->upload         = NULL;
+            conn->upload_context = NULL;
+        }
+        conn->upload_name  = NULL;
+        conn->body_state   = HTTPSVR_BODY_NONE;
+        conn->body_error   = 0;
+        conn->body_left    = 0;
+        conn->body_total   = 0;
+        conn->req_body_len = 0;
+        
+        /* the buffered body lives in the per request arena */
+        conn->req_body         = NULL;
+        conn->req_body_max_len = 0;
+        httpsvr_arena_reset(&conn->arena);
+    }
+}
+
+
+void httpsvr_body_fail(httpsvr_conn_struct *conn, int status) {
+    conn->body_state = HTTPSVR_BODY_ERROR;
+    conn->body_error = status;
+}
+
+
+void httpsvr_body_start(httpsvr_conn_struct *conn) {
+    httpsvr_struct *hss = conn->hss;
+    const char *value = NULL;
+    long long len = 0;
+    int n = 0;
+    int i = 0;
+    
+    /* framing, chunked wins over a length */
+    value = httpsvr_find_header(conn, "Transfer-Encoding", &n);
+    if (value != NULL) {
+        if (httpsvr_has_token(value, n, "chunked")) {
+            conn->body_state = HTTPSVR_BODY_CHUNK_SIZE;
+        } else {
+            httpsvr_body_fail(conn, HTTPSVR_STATUS_BAD_REQUEST);
+        }
+    } else {
+        value = httpsvr_find_header(conn, "Content-Length", &n);
+        if (value != NULL) {
+            for (i = 0; (i < n) && (value[i] >= '0') && (value[i] <= '9') && (len <= hss->max_body_len); i++) {
+                len = 10 * len + (value[i] - '0');
+            }
+            if ((n == 0) || (i < n)) {
+                httpsvr_body_fail(conn, (len > hss->max_body_len) ?
+                                        HTTPSVR_STATUS_TOO_LARGE : HTTPSVR_STATUS_BAD_REQUEST);
+            } else if (len > 0) {
+                conn->body_state = HTTPSVR_BODY_LENGTH;
+                conn->body_left  = len;
+            }
+        }
+    }
+    
+    if ((conn->body_state != HTTPSVR_BODY_NONE) && (conn->body_state != HTTPSVR_BODY_ERROR)) {
+        
+        /* an upload handler takes the body as it arrives, unless a
+           route answers the request */
+        httpsvr_parse_req(conn);
+        if ((conn->req_path != NULL) && (conn->req_dot_pos < 0) &&
+            (httpsvr_route_match(hss->routes, conn->req_method, conn->req_path,
+                                 conn->route_params, &conn->route_params_len) == NULL)) {
+            conn->upload_name = conn->req_path;
+            if ((conn->upload_name[0] == '/') && (conn->upload_name[1] != '\0')) {
+                conn->upload_name++;
+            }
+            i = httpsvr_find_page(hss, conn->upload_name);
+            if (i < 0) {
+                i = hss->page_wildcard;
+            }
+            if (i >= 0) {
+                conn->upload = hss->page_handlers[i].upload;
+            }
+        }
+        
+        /* otherwise it has to fit the buffer */
+        if (len > ((conn->upload != NULL) ? hss->max_body_len : hss->max_buffered_body_len)) {
+            httpsvr_body_fail(conn, HTTPSVR_STATUS_TOO_LARGE);
+        
+        /* let a waiting client go ahead, unless responses are queued;
+           it is written out like any response before the body is read */
+        } else if ((conn->segs_len == 0) &&
+                   (httpsvr_find_header(conn, "Expect", &n) != NULL) &&
+                   (strcmp(conn->req_ver, "HTTP/1.1") == 0)) {
+            httpsvr_send_queue(conn, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+        }
+    }
+}
+
+
+void httpsvr_body_sink(httpsvr_conn_struct *conn, const char *data, int len) {
+    httpsvr_struct *hss = conn->hss;
+    char *body = NULL;
+    int n = 0;
+    
+    conn->body_total += len;
+    if (conn->body_total > hss->max_body_len) {
+        httpsvr_body_fail(conn, HTTPSVR_STATUS_TOO_LARGE);
+        
+    } else if (conn->upload != NULL) {
+        if (conn->upload(conn->upload_name, conn->req_params,
+                         &conn->upload_context, data, len, NULL, 0) < 0) {
+            httpsvr_body_fail(conn, HTTPSVR_STATUS_BAD_REQUEST);
+        }
+        
+    } else if (conn->body_total > hss->max_buffered_body_len) {
+        httpsvr_body_fail(conn, HTTPSVR_STATUS_TOO_LARGE);
+        
+    } else {
+        
+        /* grow the body buffer by doubling, in place while it can */
+        if (conn->req_body_len + len > conn->req_body_max_len) {
+            n = (conn->req_body_max_len > 0) ? conn->req_body_max_len : conn->recv_data_max_len;
+            while (n < conn->req_body_len + len) {
+                n *= 2;
+            }
+            body = httpsvr_arena_grow(&conn->arena, conn->req_body,
+                                      conn->req_body_max_len, n);
+            if (body == NULL) {
+                httpsvr_body_fail(conn, HTTPSVR_STATUS_TOO_LARGE);
+            } else {
+                conn->req_body = body;
+                conn->req_body_max_len = n;
+            }
+        }
+        if (conn->body_state != HTTPSVR_BODY_ERROR) {
+            memcpy(&conn->req_body[conn->req_body_len], data, len);
+            conn->req_body_len += len;
+        }
+    }
+}
+
+
+void httpsvr_body_line(httpsvr_conn_struct *conn, int pos, int len) {
+    const char *s = &conn->recv_data[pos];
+    long long max_len = conn->hss->max_body_len - conn->body_total;
+    long long size = 0;
+    int too_large = 0;
+    int i = 0;
+    int digit = 0;
+    
+    /* strip the line end */
+    if ((len > 0) && (s[len - 1] == '\r')) {
+        len--;
+    }
+    
+    if (conn->body_state == HTTPSVR_BODY_CHUNK_SIZE) {
+        
+        /* hex size, then optional extensions after ';'; a size past
+           what the body may still take stops before it can overflow */
+        for (i = 0; (i < len) && !too_large; i++) {
+            if ((s[i] >= '0') && (s[i] <= '9')) {
+                digit = s[i] - '0';
+            } else if ((s[i] >= 'a') && (s[i] <= 'f')) {
+                digit = s[i] - 'a' + 10;
+            } else if ((s[i] >= 'A') && (s[i] <= 'F')) {
+                digit = s[i] - 'A' + 10;
+            } else {
+                break;
+            }
+            if ((digit > max_len) || (size > (max_len - digit) / 16)) {
+                too_large = 1;
+            } else {
+                size = 16 * size + digit;
+            }
+        }
+        if (too_large) {
+            httpsvr_body_fail(conn, HTTPSVR_STATUS_TOO_LARGE);
+        } else if ((i == 0) || ((i < len) && (s[i] != ';') && (s[i] != ' '))) {
+            httpsvr_body_fail(conn, HTTPSVR_STATUS_BAD_REQUEST);
+        } else if (size == 0) {
+            conn->body_state = HTTPSVR_BODY_TRAILER;
+        } else {
+            conn->body_state = HTTPSVR_BODY_CHUNK_DATA;
+            conn->body_left  = size;
+        }
+        
+    } else if (conn->body_state == HTTPSVR_BODY_CHUNK_END) {
+        if (len == 0) {
+            conn->body_state = HTTPSVR_BODY_CHUNK_SIZE;
+        } else {
+            httpsvr_body_fail(conn, HTTPSVR_STATUS_BAD_REQUEST);
+        }
+        
+    } else if (len == 0) {  /* trailer fields are skipped */
+        conn->body_state = HTTPSVR_BODY_DONE;
+    }
+}
+
+
+int httpsvr_body_read(httpsvr_conn_struct *conn) {
+    int more = 0;
+    int pos = conn->req_len;  /* body bytes follow the headers */
+    int end = conn->recv_data_len;
+    long long n = 0;
+    const char *eol = NULL;
+    
+    while (!more &&
+           (conn->body_state != HTTPSVR_BODY_NONE) &&
+           (conn->body_state != HTTPSVR_BODY_DONE) &&
+           (conn->body_state != HTTPSVR_BODY_ERROR)) {
+        if ((conn->body_state == HTTPSVR_BODY_LENGTH) ||
+            (conn->body_state == HTTPSVR_BODY_CHUNK_DATA)) {
+            n = end - pos;
+            if (n > conn->body_left) {
+                n = conn->body_left;
+            }
+            if (n == 0) {
+                more = 1;
+            } else {
+                httpsvr_body_sink(conn, &conn->recv_data[pos], n);
+                pos += n;
+                conn->body_left -= n;
+                if ((conn->body_left == 0) && (conn->body_state != HTTPSVR_BODY_ERROR)) {
+                    conn->body_state = (conn->body_state == HTTPSVR_BODY_LENGTH) ?
+                                       HTTPSVR_BODY_DONE : HTTPSVR_BODY_CHUNK_END;
+                }
+            }
+        } else {
+            
+            /* chunk framing comes a line at a time */
+            eol = memchr(&conn->recv_data[pos], '\n', end - pos);
+            if (eol != NULL) {
+                n = eol - &conn->recv_data[pos];
+                httpsvr_body_line(conn, pos, n);
+                pos += n + 1;
+            } else if (end - pos > HTTPSVR_CHUNK_LINE_MAX_LEN) {
+                httpsvr_body_fail(conn, HTTPSVR_STATUS_BAD_REQUEST);
+            } else {
+                more = 1;
+            }
+        }
+    }
+    
+    /* drop the body bytes taken, keeping whatever follows them */
+    if (pos > conn->req_len) {
+        memmove(&conn->recv_data[conn->req_len], &conn->recv_data[pos], end - pos);
+        conn->recv_data_len = conn->req_len + end - pos;
+    }
+    
+    return !more;
+}
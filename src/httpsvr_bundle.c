@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "httpsvr_internal.h"
+#include "httpsvr_bundle.h"
+#include "httpsvr_zip.h"
+
+
+#define HTTPSVR_BUNDLE_MAX_PIECE    (1 << 30)   /* bytes per queued piece */
+
+
+uint32_t httpsvr_bundle_hash(const char *s, int len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    int i = 0;
+    
+    /* FNV-1a, then mixed so nearby seeds give unrelated slots */
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    
+    return h;
+}
+
+
+/* the range [off, off + len) lies within the bundle */
+int httpsvr_bundle_within(const httpsvr_bundle_struct *bundle, uint64_t off, uint64_t len) {
+    return (off <= (uint64_t) bundle->len) && (len <= (uint64_t) bundle->len - off);
+}
+
+
+int httpsvr_bundle_check(const httpsvr_bundle_struct *bundle) {
+    const httpsvr_bundle_head *head = bundle->head;
+    const httpsvr_bundle_asset *asset = NULL;
+    int rc = 1;
+    uint32_t i = 0;
+    
+    /* every offset is checked once here, so lookups can trust them */
+    if ((bundle->len < (long long) sizeof(httpsvr_bundle_head)) ||
+        (memcmp(head->magic, HTTPSVR_BUNDLE_MAGIC, sizeof(head->magic)) != 0) ||
+        (head->version != HTTPSVR_BUNDLE_VERSION) ||
+        (head->byte_order != HTTPSVR_BUNDLE_BYTE_ORDER) ||
+        (head->len != (uint64_t) bundle->len) ||
+        (head->num_buckets == 0) || (head->num_buckets & (head->num_buckets - 1)) ||
+        (head->num_slots == 0) || (head->num_slots & (head->num_slots - 1)) ||
+        (head->buckets_off % sizeof(uint32_t)) ||
+        (head->slots_off % sizeof(uint32_t)) ||
+        (head->assets_off % sizeof(uint64_t)) ||
+        !httpsvr_bundle_within(bundle, head->buckets_off,
+                               (uint64_t) head->num_buckets * sizeof(uint32_t)) ||
+        !httpsvr_bundle_within(bundle, head->slots_off,
+                               (uint64_t) head->num_slots * sizeof(uint32_t)) ||
+        !httpsvr_bundle_within(bundle, head->assets_off,
+                               (uint64_t) head->num_assets * sizeof(httpsvr_bundle_asset))) {
+        rc = 0;
+    }
+    for (i = 0; rc && (i < head->num_slots); i++) {
+        if ((bundle->slots[i] != HTTPSVR_BUNDLE_EMPTY) &&
+            (bundle->slots[i] >= head->num_assets)) {
+            rc = 0;
+        }
+    }
+    for (i = 0; rc && (i < head->num_assets); i++) {
+        asset = &bundle->assets[i];
+        if (!httpsvr_bundle_within(bundle, asset->path_off, (uint64_t) asset->path_len + 1) ||
+            (bundle->data[asset->path_off + asset->path_len] != '\0') ||
+            !httpsvr_bundle_within(bundle, asset->resp_off,
+                                   (uint64_t) asset->head_len + asset->body_len) ||
+            ((asset->gzip_off != 0) &&
+             !httpsvr_bundle_within(bundle, asset->gzip_off,
+                                    (uint64_t) asset->gzip_head_len + asset->gzip_body_len)) ||
+            (memchr(asset->etag, '\0', sizeof(asset->etag)) == NULL) ||
+            (memchr(asset->gzip_etag, '\0', sizeof(asset->gzip_etag)) == NULL)) {
+            rc = 0;
+        }
+    }
+    
+    return rc;
+}
+
+
+httpsvr_bundle_struct *httpsvr_bundle_open(const char *path) {
+    httpsvr_bundle_struct *bundle = NULL;
+    struct stat st;
+    void *data = MAP_FAILED;
+    int fd = -1;
+    
+    fd = open(path, O_RDONLY);
+    if ((fd != -1) && (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) &&
+        (st.st_size >= (off_t) sizeof(httpsvr_bundle_head))) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (data != MAP_FAILED) {
+        bundle = malloc(sizeof(httpsvr_bundle_struct));
+        if (bundle != NULL) {
+            bundle->data    = data;
+            bundle->len     = st.st_size;
+            bundle->head    = data;
+            bundle->buckets = (const uint32_t *) &bundle->data[bundle->head->buckets_off];
+            bundle->slots   = (const uint32_t *) &bundle->data[bundle->head->slots_off];
+            bundle->assets  = (const httpsvr_bundle_asset *)
+                              &bundle->data[bundle->head->assets_off];
+            if (!httpsvr_bundle_check(bundle)) {
+                free(bundle);
+                bundle = NULL;
+            }
+        }
+        if (bundle == NULL) {
+            munmap(data, st.st_size);
+        } else {
+            
+            /* fault it all in now, requests then touch no disk */
+            madvise(data, st.st_size, MADV_WILLNEED);
+        }
+    }
+    
+    return bundle;
+}
+
+
+void httpsvr_bundle_close(httpsvr_bundle_struct *bundle) {
+    if (bundle != NULL) {
+        munmap((void *) bundle->data, bundle->len);
+        free(bundle);
+    }
+}
+
+
+const httpsvr_bundle_asset *httpsvr_bundle_find(const httpsvr_bundle_struct *bundle,
+                                                const char *path) {
+    const httpsvr_bundle_head *head = bundle->head;
+    const httpsvr_bundle_asset *asset = NULL;
+    int len = strlen(path);
+    uint32_t seed = 0;
+    uint32_t i = 0;
+    
+    /* two hashes find the one slot the path can be in */
+    seed = bundle->buckets[httpsvr_bundle_hash(path, len, 0) & (head->num_buckets - 1)];
+    i = bundle->slots[httpsvr_bundle_hash(path, len, seed) & (head->num_slots - 1)];
+    if (i != HTTPSVR_BUNDLE_EMPTY) {
+        asset = &bundle->assets[i];
+        if ((asset->path_len != len) ||
+            (memcmp(&bundle->data[asset->path_off], path, len) != 0)) {
+            asset = NULL;
+        }
+    }
+    
+    return asset;
+}
+
+
+int httpsvr_bundle_serve(httpsvr_conn_struct *conn) {
+    const httpsvr_bundle_struct *bundle = conn->hss->bundle;
+    const httpsvr_bundle_asset *asset = NULL;
+    const char *etag = NULL;
+    const char *resp = NULL;
+    const char *value = NULL;
+    struct iovec *t = NULL;
+    long long len = 0;
+    long long n = 0;
+    long long date = 0;
+    int head_len = 0;
+    int value_len = 0;
+    int not_modified = 0;
+    int rc = 0;
+    
+    if (((strcmp(conn->req_method, "GET") == 0) || httpsvr_is_head(conn)) &&
+        ((asset = httpsvr_bundle_find(bundle, conn->req_path)) != NULL)) {
+        rc = 1;
+        
+        /* the gzip variant for clients that take it */
+        if ((asset->gzip_off != 0) && (httpsvr_zip_accepts(conn) & HTTPSVR_ZIP_GZIP)) {
+            etag     = asset->gzip_etag;
+            resp     = &bundle->data[asset->gzip_off];
+            head_len = asset->gzip_head_len;
+            len      = asset->gzip_body_len;
+        } else {
+            etag     = asset->etag;
+            resp     = &bundle->data[asset->resp_off];
+            head_len = asset->head_len;
+            len      = asset->body_len;
+        }
+        
+        /* If-None-Match wins over If-Modified-Since */
+        value = httpsvr_find_header(conn, "If-None-Match", &value_len);
+        if (value != NULL) {
+            not_modified = httpsvr_etag_match(value, value_len, etag, strlen(etag));
+        } else {
+            value = httpsvr_find_header(conn, "If-Modified-Since", &value_len);
+            if ((value != NULL) && httpsvr_parse_date(value, value_len, &date)) {
+                not_modified = (asset->mtime <= date);
+            }
+        }
+        
+        /* prebuilt status line, then headers and body straight from
+           the mapping; Range is ignored, the whole body is sent */
+        httpsvr_status_resp(conn, not_modified ? HTTPSVR_RESP_NOT_MODIFIED : HTTPSVR_RESP_OK);
+        t = &conn->hss->templates[conn->resp_status]
+                                 [httpsvr_is_http11(conn)]
+                                 [conn->keep_alive ? 1 : 0];
+        httpsvr_send_queue(conn, t->iov_base, t->iov_len);
+        httpsvr_send_queue(conn, resp, head_len);
+        if (!not_modified && !httpsvr_is_head(conn)) {
+            for (n = 0; n < len; n += HTTPSVR_BUNDLE_MAX_PIECE) {
+                httpsvr_send_queue(conn, &resp[head_len + n],
+                                   (len - n < HTTPSVR_BUNDLE_MAX_PIECE) ?
+                                   (int) (len - n) : HTTPSVR_BUNDLE_MAX_PIECE);
+            }
+        }
+        conn->state = HTTPSVR_CONN_WRITING;
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_set_bundle(httpsvr_handle handle,
+                       const char *bundle_path) {
+    int rc = -1;
+    
+    httpsvr_struct *hss = handle;
+    if (hss != NULL) {
+        httpsvr_bundle_close(hss->bundle);
+        hss->bundle = NULL;
+        rc = 0;
+        if (bundle_path != NULL) {
+            hss->bundle = httpsvr_bundle_open(bundle_path);
+            if (hss->bundle == NULL) {
+                rc = -1;
+            }
+        }
+    }
+    
+    return rc;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_BUNDLE_H_
+#define HTTPSVR_BUNDLE_H_
+
+#include <stdint.h>
+
+#include "httpsvr_internal.h"
+
+
+#define HTTPSVR_BUNDLE_MAGIC        "httpsvrB"
+#define HTTPSVR_BUNDLE_VERSION      1
+#define HTTPSVR_BUNDLE_BYTE_ORDER   0x01020304u
+#define HTTPSVR_BUNDLE_EMPTY        0xffffffffu
+#define HTTPSVR_BUNDLE_ETAG_LEN     64
+
+
+/* bundle file layout, in the byte order of the machine that wrote it:
+   the head, a displacement seed per bucket, an asset per slot, the
+   asset records, then paths and responses; offsets are from the start
+   of the file */
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_assets;
+    uint32_t num_buckets;           /* power of two */
+    uint32_t num_slots;             /* power of two */
+    uint32_t reserved;
+    uint64_t buckets_off;
+    uint64_t slots_off;
+    uint64_t assets_off;
+    uint64_t len;
+} httpsvr_bundle_head;
+
+/* one file, its headers run through the blank line and the body
+   follows them directly, so both go out as one piece */
+typedef struct {
+    uint64_t path_off;              /* nul terminated, from '/' */
+    uint64_t resp_off;
+    uint64_t body_len;
+    uint64_t gzip_off;              /* 0 without a gzip variant */
+    uint64_t gzip_body_len;
+    int64_t  mtime;
+    uint32_t path_len;
+    uint32_t head_len;
+    uint32_t gzip_head_len;
+    uint32_t reserved;
+    char     etag[HTTPSVR_BUNDLE_ETAG_LEN];
+    char     gzip_etag[HTTPSVR_BUNDLE_ETAG_LEN];
+} httpsvr_bundle_asset;
+
+/* a bundle mapped read-only, shared by all workers */
+struct httpsvr_bundle_struct {
+    const char *data;
+    long long len;
+    const httpsvr_bundle_head *head;
+    const uint32_t *buckets;
+    const uint32_t *slots;
+    const httpsvr_bundle_asset *assets;
+};
+
+
+/* the perfect hash: seed 0 picks the bucket, the bucket's seed the slot */
+uint32_t httpsvr_bundle_hash(const char *s, int len, uint32_t seed);
+
+/* maps and checks a bundle, NULL if it is missing or malformed; the
+   mapping is shared with the file, so a bundle must be replaced by
+   rename and never rewritten in place, or reads past its new end fault */
+httpsvr_bundle_struct *httpsvr_bundle_open(const char *path);
+
+void httpsvr_bundle_close(httpsvr_bundle_struct *bundle);
+
+const httpsvr_bundle_asset *httpsvr_bundle_find(const httpsvr_bundle_struct *bundle,
+                                                const char *path);
+
+/* answers a GET or HEAD for a bundled path, returns 0 to leave the
+   request to the handlers */
+int  httpsvr_bundle_serve(httpsvr_conn_struct *conn);
+
+#endif  /* HTTPSVR_BUNDLE_H_ */
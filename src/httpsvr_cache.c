@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "httpsvr_internal.h"
+#include "httpsvr_cache.h"
+
+
+#define HTTPSVR_CACHE_MIN_BUCKETS   64
+#define HTTPSVR_CACHE_MAX_BUCKETS   65536
+#define HTTPSVR_CACHE_AVG_FILE_LEN  4096
+
+
+httpsvr_cache_struct *httpsvr_cache_create(long long max_bytes,
+                                           long long max_file_len,
+                                           int map_files) {
+    int n = HTTPSVR_CACHE_MIN_BUCKETS;
+    httpsvr_cache_struct *cache = NULL;
+    cache = malloc(sizeof(httpsvr_cache_struct));
+    
+    if (cache != NULL) {
+        
+        /* size the table for the number of files expected to fit */
+        while ((n < HTTPSVR_CACHE_MAX_BUCKETS) &&
+               (n < (max_bytes / HTTPSVR_CACHE_AVG_FILE_LEN))) {
+            n *= 2;
+        }
+        cache->num_buckets  = n;
+        cache->buckets      = calloc(n, sizeof(httpsvr_cache_entry_struct *));
+        cache->lru_head     = NULL;
+        cache->lru_tail     = NULL;
+        cache->bytes        = 0;
+        cache->max_bytes    = max_bytes;
+        cache->max_file_len = max_file_len;
+        cache->map_files    = map_files;
+        if ((cache->buckets == NULL) ||
+            (pthread_mutex_init(&cache->lock, NULL) != 0)) {
+            if (cache->buckets != NULL) {
+                free(cache->buckets);
+            }
+            free(cache);
+            cache = NULL;
+        }
+    }
+    
+    return cache;
+}
+
+
+void httpsvr_cache_free_entry(httpsvr_cache_entry_struct *entry) {
+    if (entry->mapped) {
+        munmap(entry->data, entry->size);
+        close(entry->fd);
+    } else if (entry->data != NULL) {
+        free(entry->data);
+    }
+    if (entry->path != NULL) {
+        free(entry->path);
+    }
+    free(entry);
+}
+
+
+/* unlink an entry from the table and LRU list, with the lock held */
+void httpsvr_cache_remove(httpsvr_cache_struct *cache,
+                          httpsvr_cache_entry_struct *entry) {
+    httpsvr_cache_entry_struct **link = NULL;
+    
+    link = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+    while (*link != NULL) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+    cache->bytes -= entry->size;
+    entry->cached = 0;
+    
+    /* connections still sending it free it on release */
+    if (entry->refs == 0) {
+        httpsvr_cache_free_entry(entry);
+    }
+}
+
+
+void httpsvr_cache_destroy(httpsvr_cache_struct *cache) {
+    if (cache != NULL) {
+        while (cache->lru_head != NULL) {
+            httpsvr_cache_remove(cache, cache->lru_head);
+        }
+        pthread_mutex_destroy(&cache->lock);
+        free(cache->buckets);
+        free(cache);
+    }
+}
+
+
+/* move an entry to the most recently used end, with the lock held */
+void httpsvr_cache_touch(httpsvr_cache_struct *cache,
+                         httpsvr_cache_entry_struct *entry) {
+    if (cache->lru_head != entry) {
+        entry->lru_prev->lru_next = entry->lru_next;
+        if (entry->lru_next != NULL) {
+            entry->lru_next->lru_prev = entry->lru_prev;
+        } else {
+            cache->lru_tail = entry->lru_prev;
+        }
+        entry->lru_prev = NULL;
+        entry->lru_next = cache->lru_head;
+        cache->lru_head->lru_prev = entry;
+        cache->lru_head = entry;
+    }
+}
+
+
+httpsvr_cache_entry_struct *httpsvr_cache_find(httpsvr_cache_struct *cache,
+                                               const char *path,
+                                               unsigned int hash,
+                                               long long ino) {
+    httpsvr_cache_entry_struct *entry = NULL;
+    
+    entry = cache->buckets[hash & (cache->num_buckets - 1)];
+    while (entry != NULL) {
+        if ((entry->hash == hash) && (entry->ino == ino) && (strcmp(entry->path, path) == 0)) {
+            break;
+        }
+        entry = entry->hash_next;
+    }
+    
+    return entry;
+}
+
+
+/* drop every copy of a path, whichever file it was, with the lock held */
+void httpsvr_cache_evict_path(httpsvr_cache_struct *cache,
+                              const char *path,
+                              unsigned int hash) {
+    httpsvr_cache_entry_struct *entry = NULL;
+    httpsvr_cache_entry_struct *next = NULL;
+    
+    entry = cache->buckets[hash & (cache->num_buckets - 1)];
+    while (entry != NULL) {
+        next = entry->hash_next;
+        if ((entry->hash == hash) && (strcmp(entry->path, path) == 0)) {
+            httpsvr_cache_remove(cache, entry);
+        }
+        entry = next;
+    }
+}
+
+
+int httpsvr_cache_intact(httpsvr_cache_entry_struct *entry) {
+    struct stat st;
+    
+    /* checked before each write from the mapping; a file truncated in
+       place between the check and the write still faults, which is why
+       served files should be replaced by rename */
+    return !entry->mapped ||
+           ((fstat(entry->fd, &st) == 0) && (st.st_size >= entry->size));
+}
+
+
+int httpsvr_cache_map(httpsvr_cache_entry_struct *entry, int fd) {
+    int rc = 0;
+    struct stat st;
+    void *data = NULL;
+    
+    /* only the file that was checked, whole, it may have been replaced */
+    if ((fstat(fd, &st) == 0) &&
+        (st.st_size  == entry->size) &&
+        (st.st_mtime == entry->mtime) &&
+        (st.st_ino   == entry->ino)) {
+        data = mmap(NULL, entry->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            
+            /* fault it in now rather than under the first send */
+            madvise(data, entry->size, MADV_WILLNEED);
+            entry->data   = data;
+            entry->mapped = 1;
+            entry->fd     = fd;
+            rc = 1;
+        }
+    }
+    
+    return rc;
+}
+
+
+httpsvr_cache_entry_struct *httpsvr_cache_load(const char *path,
+                                               unsigned int hash,
+                                               const struct stat *st,
+                                               int map_files) {
+    int fd = -1;
+    long long len = 0;
+    long long n = 0;
+    httpsvr_cache_entry_struct *entry = NULL;
+    entry = malloc(sizeof(httpsvr_cache_entry_struct));
+    
+    if (entry != NULL) {
+        entry->hash_next = NULL;
+        entry->lru_prev  = NULL;
+        entry->lru_next  = NULL;
+        entry->hash      = hash;
+        entry->size      = st->st_size;
+        entry->mtime     = st->st_mtime;
+        entry->ino       = st->st_ino;
+        entry->data      = NULL;
+        entry->mapped    = 0;
+        entry->fd        = -1;
+        entry->refs      = 0;
+        entry->cached    = 0;
+        entry->path      = malloc(strlen(path) + 1);
+        fd = open(path, O_RDONLY);
+        
+        /* a mapping shares the page cache copy with every worker and
+           process serving the file, an empty file cannot be mapped */
+        if ((entry->path != NULL) && (fd != -1) && map_files && (entry->size > 0)) {
+            if (httpsvr_cache_map(entry, fd)) {
+                len = entry->size;
+            }
+        } else {
+            entry->data = malloc((entry->size > 0) ? entry->size : 1);
+        }
+        if ((entry->path != NULL) && (entry->data != NULL) && (fd != -1)) {
+            strcpy(entry->path, path);
+            while (len < entry->size) {
+                n = pread(fd, &entry->data[len], entry->size - len, len);
+                if ((n < 0) && (errno == EINTR)) {
+                    continue;
+                } else if (n <= 0) {
+                    break;
+                }
+                len += n;
+            }
+        }
+        if ((fd != -1) && !entry->mapped) {
+            close(fd);
+        }
+        
+        /* give up if the file changed while being read */
+        if ((entry->path == NULL) || (entry->data == NULL) || (len != entry->size)) {
+            httpsvr_cache_free_entry(entry);
+            entry = NULL;
+        }
+    }
+    
+    return entry;
+}
+
+
+httpsvr_cache_entry_struct *httpsvr_cache_lookup(httpsvr_cache_struct *cache,
+                                                 const char *path) {
+    struct stat st;
+    unsigned int hash = httpsvr_hash(path);
+    httpsvr_cache_entry_struct *entry = NULL;
+    httpsvr_cache_entry_struct *loaded = NULL;
+    
+    if ((stat(path, &st) == 0) &&
+        S_ISREG(st.st_mode) &&
+        (st.st_size <= cache->max_file_len) &&
+        (st.st_size <= cache->max_bytes)) {
+        
+        /* serve the cached copy if the file has not changed */
+        pthread_mutex_lock(&cache->lock);
+        entry = httpsvr_cache_find(cache, path, hash, st.st_ino);
+        if (entry != NULL) {
+            if ((entry->size  == st.st_size) &&
+                (entry->mtime == st.st_mtime)) {
+                httpsvr_cache_touch(cache, entry);
+                entry->refs++;
+            } else {
+                httpsvr_cache_remove(cache, entry);
+                entry = NULL;
+            }
+        }
+        pthread_mutex_unlock(&cache->lock);
+        
+        /* otherwise read it in without holding up other workers */
+        if (entry == NULL) {
+            loaded = httpsvr_cache_load(path, hash, &st, cache->map_files);
+        }
+        if (loaded != NULL) {
+            pthread_mutex_lock(&cache->lock);
+            
+            /* another worker may have loaded it meanwhile, and a file
+               replaced under the path leaves its old copy behind */
+            httpsvr_cache_evict_path(cache, path, hash);
+            
+            /* evict least recently used files until it fits */
+            while ((cache->lru_tail != NULL) &&
+                   ((cache->bytes + loaded->size) > cache->max_bytes)) {
+                httpsvr_cache_remove(cache, cache->lru_tail);
+            }
+            entry = loaded;
+            entry->hash_next = cache->buckets[hash & (cache->num_buckets - 1)];
+            cache->buckets[hash & (cache->num_buckets - 1)] = entry;
+            entry->lru_next = cache->lru_head;
+            if (cache->lru_head != NULL) {
+                cache->lru_head->lru_prev = entry;
+            } else {
+                cache->lru_tail = entry;
+            }
+            cache->lru_head = entry;
+            cache->bytes += entry->size;
+            entry->cached = 1;
+            entry->refs++;
+            pthread_mutex_unlock(&cache->lock);
+        }
+    }
+    
+    return entry;
+}
+
+
+void httpsvr_cache_release(httpsvr_cache_struct *cache,
+                           httpsvr_cache_entry_struct *entry) {
+    if ((cache != NULL) && (entry != NULL)) {
+        pthread_mutex_lock(&cache->lock);
+        entry->refs--;
+        if ((entry->refs == 0) && !entry->cached) {
+            httpsvr_cache_free_entry(entry);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+}
+
+
+int httpsvr_set_file_cache(httpsvr_handle handle,
+                           int max_bytes,
+                           int max_file_len) {
+    int rc = -1;
+    
+    httpsvr_struct *hss = handle;
+    if (hss != NULL) {
+        httpsvr_cache_destroy(hss->cache);
+        hss->cache = NULL;
+        rc = 0;
+        if (max_bytes > 0) {
+            hss->cache = httpsvr_cache_create(max_bytes, max_file_len, hss->file_map);
+            if (hss->cache == NULL) {
+                rc = -1;
+            }
+        }
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_set_file_map(httpsvr_handle handle,
+                         int enable) {
+    int rc = -1;
+    
+    httpsvr_struct *hss = handle;
+    if (hss != NULL) {
+        hss->file_map = enable ? 1 : 0;
+        if (hss->cache != NULL) {
+            hss->cache->map_files = hss->file_map;
+        }
+        rc = 0;
+    }
+    
+    return rc;
+}
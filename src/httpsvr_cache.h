@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_CACHE_H_
+#define HTTPSVR_CACHE_H_
+
+#include <pthread.h>
+
+#include "httpsvr_internal.h"
+
+
+/* one cached static file body, shared by every connection sending it;
+   headers are not kept, each response builds its own */
+struct httpsvr_cache_entry_struct {
+    httpsvr_cache_entry_struct *hash_next;
+    httpsvr_cache_entry_struct *lru_prev;
+    httpsvr_cache_entry_struct *lru_next;
+    unsigned int hash;
+    char   *path;
+    long long size;
+    long long mtime;
+    long long ino;
+    char   *data;
+    int     mapped;                 /* data is a mapping of the file */
+    int     fd;                     /* kept open while mapped, to check its size */
+    int     refs;
+    int     cached;
+};
+
+/* bounded LRU cache of static files keyed by resolved file path and
+   inode */
+struct httpsvr_cache_struct {
+    pthread_mutex_t lock;
+    httpsvr_cache_entry_struct **buckets;
+    int     num_buckets;
+    httpsvr_cache_entry_struct *lru_head;
+    httpsvr_cache_entry_struct *lru_tail;
+    long long bytes;
+    long long max_bytes;
+    long long max_file_len;
+    int     map_files;              /* map new entries rather than copy them */
+};
+
+
+httpsvr_cache_struct *httpsvr_cache_create(long long max_bytes,
+                                           long long max_file_len,
+                                           int map_files);
+
+void httpsvr_cache_destroy(httpsvr_cache_struct *cache);
+
+/* returns a referenced entry holding the current file contents, or
+   NULL if the file is missing or too large to cache */
+httpsvr_cache_entry_struct *httpsvr_cache_lookup(httpsvr_cache_struct *cache,
+                                                 const char *path);
+
+/* 0 once a mapped file has been cut short, its mapping would fault
+   past the new end of file */
+int  httpsvr_cache_intact(httpsvr_cache_entry_struct *entry);
+
+void httpsvr_cache_release(httpsvr_cache_struct *cache,
+                           httpsvr_cache_entry_struct *entry);
+
+#endif  /* HTTPSVR_CACHE_H_ */
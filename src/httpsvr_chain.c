@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined (__linux__)
+#  include <sys/sendfile.h>
+#endif
+
+#include "httpsvr_internal.h"
+#include "httpsvr_cache.h"
+#include "httpsvr_metrics.h"
+
+
+void httpsvr_seg_release(httpsvr_conn_struct *conn, httpsvr_seg_struct *seg) {
+    
+    /* the last piece of a response holds its file or cached copy */
+    if (seg->close_fd) {
+        close(seg->fd);
+        seg->close_fd = 0;
+    }
+    httpsvr_cache_release(conn->hss->cache, seg->entry);
+    seg->entry = NULL;
+}
+
+
+void httpsvr_send_drop(httpsvr_conn_struct *conn, int seg_start) {
+    int i = 0;
+    
+    /* pieces already written were released as they went out */
+    for (i = (seg_start > conn->seg_pos) ? seg_start : conn->seg_pos; i < conn->segs_len; i++) {
+        httpsvr_seg_release(conn, &conn->segs[i]);
+    }
+    if (seg_start < conn->segs_len) {
+        conn->segs_len = seg_start;
+    }
+    if (conn->seg_pos > conn->segs_len) {
+        conn->seg_pos = conn->segs_len;
+    }
+}
+
+
+void httpsvr_send_clear(httpsvr_conn_struct *conn) {
+    httpsvr_send_drop(conn, 0);
+    conn->segs_len = 0;
+    conn->seg_pos  = 0;
+    
+    /* extra buffers go back to the worker, the own one is reused */
+    while (conn->send_bufs_len > 0) {
+        conn->send_bufs_len--;
+        if (conn->buf_pool != NULL) {
+            httpsvr_pool_put(conn->buf_pool, conn->send_bufs[conn->send_bufs_len]);
+        } else {
+            free(conn->send_bufs[conn->send_bufs_len]);
+        }
+    }
+    conn->send_data     = conn->send_base;
+    conn->send_data_len = 0;
+}
+
+
+int httpsvr_send_grow(httpsvr_conn_struct *conn) {
+    int rc = 0;
+    char *buf = NULL;
+    
+    /* later responses are built into a fresh buffer, the pieces
+       already queued keep pointing into the old one */
+    if (conn->send_bufs_len < HTTPSVR_MAX_SEND_BUFS) {
+        if (conn->buf_pool != NULL) {
+            buf = httpsvr_pool_get(conn->buf_pool);
+        } else {
+            buf = malloc(conn->send_data_max_len);
+        }
+        if (buf != NULL) {
+            conn->send_bufs[conn->send_bufs_len++] = buf;
+            conn->send_data     = buf;
+            conn->send_data_len = 0;
+            rc = 1;
+        }
+    }
+    
+    return rc;
+}
+
+
+httpsvr_seg_struct *httpsvr_send_seg(httpsvr_conn_struct *conn) {
+    httpsvr_seg_struct *seg = NULL;
+    
+    if (conn->segs_len < HTTPSVR_MAX_SEGS) {
+        seg = &conn->segs[conn->segs_len++];
+        seg->data     = NULL;
+        seg->fd       = -1;
+        seg->close_fd = 0;
+        seg->entry    = NULL;
+        seg->mapped   = NULL;
+    }
+    
+    return seg;
+}
+
+
+void httpsvr_send_queue(httpsvr_conn_struct *conn, const char *data, int len) {
+    httpsvr_seg_struct *seg = NULL;
+    
+    /* grow the last piece of this response when this one follows it
+       in memory */
+    if (len > 0) {
+        if ((conn->segs_len > conn->seg_pos) && (conn->segs_len > conn->resp_seg_start)) {
+            seg = &conn->segs[conn->segs_len - 1];
+            if ((seg->data == NULL) || (seg->data + seg->end != data)) {
+                seg = NULL;
+            }
+        }
+        if (seg != NULL) {
+            seg->end += len;
+        } else if ((seg = httpsvr_send_seg(conn)) != NULL) {
+            seg->data = data;
+            seg->pos  = 0;
+            seg->end  = len;
+        }
+    }
+}
+
+
+void httpsvr_send_window(httpsvr_conn_struct *conn,
+                         int fd,
+                         httpsvr_cache_entry_struct *entry,
+                         long long start,
+                         long long end) {
+    httpsvr_seg_struct *seg = NULL;
+    
+    /* bytes [start, end) of a cached copy, or of an open file */
+    if ((start < end) && ((seg = httpsvr_send_seg(conn)) != NULL)) {
+        seg->data = (entry != NULL) ? entry->data : NULL;
+        seg->fd   = fd;
+        if ((entry != NULL) && entry->mapped) {
+            seg->mapped = entry;
+        }
+        seg->pos  = start;
+        seg->end  = end;
+    }
+}
+
+
+void httpsvr_send_own(httpsvr_conn_struct *conn,
+                      int fd,
+                      httpsvr_cache_entry_struct *entry) {
+    httpsvr_seg_struct *seg = NULL;
+    
+    /* released once the last piece of this response is written */
+    if ((conn->segs_len > conn->seg_pos) && (conn->segs_len > conn->resp_seg_start)) {
+        seg = &conn->segs[conn->segs_len - 1];
+        seg->fd       = fd;
+        seg->close_fd = (fd != -1);
+        seg->entry    = entry;
+    } else {
+        httpsvr_cache_release(conn->hss->cache, entry);
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+
+long long httpsvr_copy_file(httpsvr_conn_struct *conn, httpsvr_seg_struct *seg) {
+    char buffer[8192];
+    long long n = seg->end - seg->pos;
+    
+    /* through a buffer, where sendfile is missing or there is no socket */
+    if (n > sizeof(buffer)) {
+        n = sizeof(buffer);
+    }
+    n = pread(seg->fd, buffer, n, seg->pos);
+    if ((n > 0) && (conn->sink != NULL)) {
+        if (conn->sink(conn->sink_context, buffer, n) < 0) {
+            n = -1;
+            errno = EPIPE;
+        }
+    } else if (n > 0) {
+        n = send(conn->soc, buffer, n, HTTPSVR_SEND_FLAGS);
+    } else if (n == 0) {
+        n = -1;  /* file shrunk */
+        errno = EIO;
+    }
+    
+    return n;
+}
+
+
+int httpsvr_write_file(httpsvr_conn_struct *conn, httpsvr_seg_struct *seg) {
+    int rc = 1;
+    long long n = 0;
+    
+    /* stream the file window straight from the page cache */
+    while (seg->pos < seg->end) {
+#if defined (__linux__)
+        if (conn->sink == NULL) {
+            off_t offset = seg->pos;
+            n = sendfile(conn->soc, seg->fd, &offset, seg->end - seg->pos);
+        } else {
+            n = httpsvr_copy_file(conn, seg);
+        }
+#else
+        n = httpsvr_copy_file(conn, seg);
+#endif
+        if (n > 0) {
+            seg->pos += n;
+            if (conn->metrics != NULL) {
+                httpsvr_metrics_add(conn->metrics->bytes_out, n);
+            }
+        } else if ((n < 0) && (errno == EINTR)) {
+            continue;
+        } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            rc = 0;  /* socket full, try again when writable */
+            break;
+        } else {
+            rc = -1;  /* error, or file shrunk under us */
+            break;
+        }
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_write_buffer(httpsvr_conn_struct *conn) {
+    int rc = 1;
+    int i = 0;
+    ssize_t n = 0;
+    httpsvr_seg_struct *seg = NULL;
+    struct iovec iov[HTTPSVR_MAX_SEGS];
+    struct msghdr msg;
+    
+    /* a run of memory pieces goes out in one call, up to a mapped file
+       that was cut short */
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    for (i = conn->seg_pos; (i < conn->segs_len) && (conn->segs[i].data != NULL); i++) {
+        seg = &conn->segs[i];
+        if ((seg->mapped != NULL) && !httpsvr_cache_intact(seg->mapped)) {
+            break;
+        }
+        iov[msg.msg_iovlen].iov_base = (char *) &seg->data[seg->pos];
+        iov[msg.msg_iovlen].iov_len  = seg->end - seg->pos;
+        msg.msg_iovlen++;
+    }
+    if (msg.msg_iovlen == 0) {
+        n = -1;  /* file shrunk under us */
+        errno = EIO;
+    } else if (conn->sink != NULL) {
+        n = 0;
+        for (i = 0; (i < msg.msg_iovlen) && (n >= 0); i++) {
+            if (conn->sink(conn->sink_context, iov[i].iov_base, iov[i].iov_len) < 0) {
+                n = -1;
+                errno = EPIPE;
+            } else {
+                n += iov[i].iov_len;
+            }
+        }
+    } else {
+        n = sendmsg(conn->soc, &msg, HTTPSVR_SEND_FLAGS);
+    }
+    if (n >= 0) {
+        if (conn->metrics != NULL) {
+            httpsvr_metrics_add(conn->metrics->bytes_out, n);
+        }
+        
+        /* step over what went out, a piece partly written stays first */
+        while ((n > 0) && (conn->seg_pos < conn->segs_len)) {
+            seg = &conn->segs[conn->seg_pos];
+            if (n >= seg->end - seg->pos) {
+                n -= seg->end - seg->pos;
+                seg->pos = seg->end;
+                httpsvr_seg_release(conn, seg);
+                conn->seg_pos++;
+            } else {
+                seg->pos += n;
+                n = 0;
+            }
+        }
+    } else if (errno == EINTR) {
+        rc = 1;
+    } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        rc = 0;  /* socket full, try again when writable */
+    } else {
+        rc = -1;
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_write_chain(httpsvr_conn_struct *conn) {
+    int rc = -1;
+    httpsvr_seg_struct *seg = NULL;
+    
+    if (conn != NULL) {
+        rc = 1;
+        while ((rc > 0) && (conn->seg_pos < conn->segs_len)) {
+            seg = &conn->segs[conn->seg_pos];
+            if (seg->data != NULL) {
+                rc = httpsvr_write_buffer(conn);
+            } else {
+                
+                /* a file window once the pieces ahead of it are out */
+                rc = httpsvr_write_file(conn, seg);
+                if (rc > 0) {
+                    httpsvr_seg_release(conn, seg);
+                    conn->seg_pos++;
+                }
+            }
+        }
+    }
+    
+    return rc;
+}
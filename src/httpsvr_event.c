@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "httpsvr_internal.h"
+#include "httpsvr_metrics.h"
+#include "httpsvr_log.h"
+#include "httpsvr_zip.h"
+
+#if defined (__linux__)
+#  include <fcntl.h>
+#  include <pthread.h>
+#  include <time.h>
+#  include <sys/epoll.h>
+
+
+#define HTTPSVR_MAX_EVENTS          64
+#define HTTPSVR_EPOLL_TIMEOUT       1000    /* msec between running flag checks */
+#define HTTPSVR_LINGER_READS        16      /* receive buffers drained before a close */
+
+
+typedef struct {
+    httpsvr_struct *hss;
+    SOCKET  listen_soc;
+    int     epoll_fd;
+    httpsvr_conn_struct *conns;
+    int     num_conns;
+    int     max_conns;
+    httpsvr_pool_struct pool;       /* closed connections, ready for reuse */
+    httpsvr_pool_struct buf_pool;   /* send buffers for long batches */
+    httpsvr_metrics_struct *metrics;
+    httpsvr_wheel_struct wheel;     /* connection deadlines */
+    pthread_t thread;
+    int     rc;
+} httpsvr_loop_struct;
+
+
+int httpsvr_set_nonblocking(SOCKET soc) {
+    int rc = -1;
+    int flags = fcntl(soc, F_GETFL, 0);
+    
+    if (flags != -1) {
+        rc = fcntl(soc, F_SETFL, flags | O_NONBLOCK);
+    }
+    
+    return rc;
+}
+
+
+long long httpsvr_now(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return ((long long) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+int httpsvr_loop_watch(httpsvr_loop_struct *loop,
+                       httpsvr_conn_struct *conn,
+                       int op,
+                       unsigned int events) {
+    int rc = 0;
+    struct epoll_event ev;
+    
+    /* skip the system call when nothing changes */
+    if ((op != EPOLL_CTL_MOD) || (conn->events != events)) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = events;
+        ev.data.ptr = conn;
+        rc = epoll_ctl(loop->epoll_fd, op, conn->soc, &ev);
+        if (rc == 0) {
+            conn->events = events;
+        }
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_loop_close(httpsvr_loop_struct *loop,
+                        httpsvr_conn_struct *conn) {
+    if (conn != NULL) {
+        
+        /* unlink from the open connection list */
+        if (conn->prev != NULL) {
+            conn->prev->next = conn->next;
+        } else {
+            loop->conns = conn->next;
+        }
+        if (conn->next != NULL) {
+            conn->next->prev = conn->prev;
+        }
+        
+        /* closing the socket also removes it from the epoll set */
+        httpsvr_timer_cancel(&loop->wheel, &conn->timer);
+        conn->timer_kind = HTTPSVR_DEADLINE_NONE;
+        CLOSE(conn->soc);
+        conn->soc = INVALID_SOCKET;
+        httpsvr_conn_destroy(conn);
+        loop->num_conns--;
+        httpsvr_metrics_add(loop->metrics->active_conns, -1);
+    }
+}
+
+
+void httpsvr_loop_arm(httpsvr_loop_struct *loop,
+                      httpsvr_conn_struct *conn) {
+    httpsvr_struct *hss = loop->hss;
+    int kind = HTTPSVR_DEADLINE_IDLE;
+    int timeout = hss->keep_alive_timeout;
+    
+    /* headers get one deadline from their first byte, so trickling
+       them in buys nothing; the rest restart with each bit of progress */
+    if (conn->state == HTTPSVR_CONN_WRITING) {
+        kind    = HTTPSVR_DEADLINE_WRITE;
+        timeout = hss->write_timeout;
+    } else if (conn->req_len > 0) {
+        kind    = HTTPSVR_DEADLINE_BODY;
+        timeout = hss->body_timeout;
+    } else if ((conn->recv_data_len > 0) ||
+               (conn->requests_left == hss->keep_alive_max_requests)) {
+        kind    = HTTPSVR_DEADLINE_HEADER;  /* a request begun, or none yet */
+        timeout = hss->header_timeout;
+    }
+    if ((kind != HTTPSVR_DEADLINE_HEADER) || (conn->timer_kind != kind)) {
+        conn->timer_kind = kind;
+        if (timeout > 0) {
+            httpsvr_timer_set(&loop->wheel, &conn->timer, httpsvr_now() + timeout);
+        } else {
+            httpsvr_timer_cancel(&loop->wheel, &conn->timer);
+        }
+    }
+}
+
+
+void httpsvr_loop_accept(httpsvr_loop_struct *loop) {
+    SOCKET soc = INVALID_SOCKET;
+    httpsvr_conn_struct *conn = NULL;
+    
+    /* drain all pending connections */
+    while (1) {
+        soc = accept(loop->listen_soc, NULL, 0);
+        if (soc == INVALID_SOCKET) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                httpsvr_metrics_add(loop->metrics->accept_errors, 1);
+                httpsvr_log(loop->hss->log, HTTPSVR_LOG_WARN, "accept failed: %s", strerror(errno));
+            }
+            break;
+        }
+        if ((loop->num_conns >= loop->max_conns) ||
+            (httpsvr_set_nonblocking(soc) != 0)) {
+            CLOSE(soc);
+            httpsvr_metrics_add(loop->metrics->accept_errors, 1);
+            httpsvr_log(loop->hss->log, HTTPSVR_LOG_WARN, "connection dropped, %d of %d open",
+                        loop->num_conns, loop->max_conns);
+            continue;
+        }
+        conn = httpsvr_conn_create(loop->hss, &loop->pool, &loop->buf_pool);
+        if (conn == NULL) {
+            CLOSE(soc);
+            httpsvr_metrics_add(loop->metrics->accept_errors, 1);
+            continue;
+        }
+        conn->soc = soc;
+        conn->metrics = loop->metrics;
+        conn->requests_left = loop->hss->keep_alive_max_requests;
+        if (httpsvr_loop_watch(loop, conn, EPOLL_CTL_ADD, EPOLLIN) != 0) {
+            CLOSE(soc);
+            httpsvr_conn_destroy(conn);
+            httpsvr_metrics_add(loop->metrics->accept_errors, 1);
+            continue;
+        }
+        httpsvr_metrics_add(loop->metrics->accepted, 1);
+        httpsvr_metrics_add(loop->metrics->active_conns, 1);
+        conn->prev = NULL;
+        conn->next = loop->conns;
+        if (loop->conns != NULL) {
+            loop->conns->prev = conn;
+        }
+        loop->conns = conn;
+        loop->num_conns++;
+        httpsvr_loop_arm(loop, conn);
+    }
+}
+
+
+int httpsvr_loop_flush(httpsvr_loop_struct *loop,
+                       httpsvr_conn_struct *conn) {
+    int rc = httpsvr_write_pending(conn);
+    int n = 0;
+    
+    if (rc == 0) {
+        
+        /* wait for room in the socket send buffer */
+        httpsvr_loop_watch(loop, conn, EPOLL_CTL_MOD, EPOLLOUT);
+        httpsvr_loop_arm(loop, conn);
+    } else if (rc < 0) {
+        
+        /* socket error */
+        httpsvr_loop_close(loop, conn);
+        rc = -1;
+    } else if (!conn->keep_alive) {
+        
+        /* last response on this connection; request bytes left unread,
+           as behind a refused request, would have the close reset the
+           connection and lose the response, so they are taken first */
+        shutdown(conn->soc, SD_SEND);
+        for (n = 0; (n < HTTPSVR_LINGER_READS) &&
+             (recv(conn->soc, conn->recv_data, conn->recv_data_max_len, 0) > 0); n++) {
+        }
+        httpsvr_loop_close(loop, conn);
+        rc = -1;
+    } else {
+        
+        /* responses complete, wait for the next request */
+        httpsvr_send_clear(conn);
+        conn->state = HTTPSVR_CONN_READING;
+        conn->timer_kind = HTTPSVR_DEADLINE_NONE;
+        httpsvr_loop_watch(loop, conn, EPOLL_CTL_MOD, EPOLLIN);
+        httpsvr_loop_arm(loop, conn);
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_loop_serve(httpsvr_loop_struct *loop,
+                       httpsvr_conn_struct *conn) {
+    int rc = 1;
+    
+    /* answer all buffered requests with one write, until a write
+       would block */
+    while ((rc > 0) && httpsvr_req_complete(conn)) {
+        httpsvr_process_batch(conn);
+        rc = httpsvr_loop_flush(loop, conn);
+    }
+    
+    /* a 100 Continue goes out before the rest of the body is read,
+       the request decides later whether the connection stays open */
+    if ((rc > 0) && (conn->seg_pos < conn->segs_len)) {
+        conn->state      = HTTPSVR_CONN_WRITING;
+        conn->keep_alive = 1;
+        rc = httpsvr_loop_flush(loop, conn);
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_loop_read(httpsvr_loop_struct *loop,
+                       httpsvr_conn_struct *conn) {
+    int n = conn->recv_data_max_len - conn->recv_data_len;
+    
+    n = recv(conn->soc, &conn->recv_data[conn->recv_data_len], n, 0);
+    if (n > 0) {
+        conn->recv_data_len += n;
+        httpsvr_metrics_add(loop->metrics->bytes_in, n);
+        if (httpsvr_loop_serve(loop, conn) > 0) {
+            httpsvr_loop_arm(loop, conn);
+        }
+    } else if ((n == 0) && (conn->recv_data_len > 0) &&
+               ((conn->req_len == 0) || httpsvr_req_complete(conn))) {
+        
+        /* peer finished sending, answer whatever arrived and close,
+           a request whose body was cut short is dropped */
+        if (!httpsvr_req_complete(conn)) {
+            conn->req_len = conn->recv_data_len;
+        }
+        httpsvr_process_batch(conn);
+        conn->keep_alive = 0;
+        httpsvr_loop_flush(loop, conn);
+    } else if ((n == 0) ||
+               ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) {
+        httpsvr_loop_close(loop, conn);
+    }
+}
+
+
+void httpsvr_loop_write(httpsvr_loop_struct *loop,
+                        httpsvr_conn_struct *conn) {
+    
+    /* finish the blocked response, then any requests queued behind it */
+    if (httpsvr_loop_flush(loop, conn) > 0) {
+        httpsvr_loop_serve(loop, conn);
+    }
+}
+
+
+void httpsvr_loop_expire(httpsvr_loop_struct *loop, long long now) {
+    static const char *names[] = { "", "idle", "header", "body", "write" };
+    httpsvr_timer_struct *timer = httpsvr_wheel_advance(&loop->wheel, now);
+    httpsvr_timer_struct *next = NULL;
+    httpsvr_conn_struct *conn = NULL;
+    
+    /* close connections past their deadline, a stuck client costs
+       nothing until then */
+    while (timer != NULL) {
+        next = timer->next;
+        conn = timer->data;
+        if (conn->timer_kind != HTTPSVR_DEADLINE_IDLE) {
+            httpsvr_metrics_add(loop->metrics->timeouts, 1);
+        }
+        httpsvr_log(loop->hss->log, HTTPSVR_LOG_DEBUG, "closing connection %d, %s timeout",
+                    (int) conn->soc, names[conn->timer_kind]);
+        httpsvr_loop_close(loop, conn);
+        timer = next;
+    }
+}
+
+
+int httpsvr_loop_run(httpsvr_loop_struct *loop) {
+    int rc = -1;
+    int i = 0;
+    int n = 0;
+    struct epoll_event ev;
+    struct epoll_event events[HTTPSVR_MAX_EVENTS];
+    httpsvr_conn_struct *conn = NULL;
+    
+    loop->conns     = NULL;
+    loop->num_conns = 0;
+    httpsvr_pool_init(&loop->pool, httpsvr_conn_len(loop->hss), loop->max_conns);
+    httpsvr_pool_init(&loop->buf_pool, loop->hss->send_data_max_len, HTTPSVR_MAX_SEND_BUFS);
+    loop->metrics   = httpsvr_metrics_register(loop->hss);
+    loop->epoll_fd  = epoll_create1(0);
+    httpsvr_wheel_init(&loop->wheel, httpsvr_now());
+    if ((loop->metrics != NULL) &&
+        (loop->epoll_fd != -1) &&
+        (listen(loop->listen_soc, SOMAXCONN) == 0) &&
+        (httpsvr_set_nonblocking(loop->listen_soc) == 0)) {
+        
+        /* listening socket is tagged with a null connection */
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_soc, &ev) == 0) {
+            rc = 0;
+            while (loop->hss->running) {
+                n = epoll_wait(loop->epoll_fd, events, HTTPSVR_MAX_EVENTS,
+                               httpsvr_wheel_timeout(&loop->wheel, httpsvr_now(),
+                                                     HTTPSVR_EPOLL_TIMEOUT));
+                if ((n < 0) && (errno != EINTR)) {
+                    httpsvr_log(loop->hss->log, HTTPSVR_LOG_ERROR, "epoll_wait failed: %s",
+                                strerror(errno));
+                    rc = -1;
+                    break;
+                }
+                for (i = 0; i < n; i++) {
+                    conn = events[i].data.ptr;
+                    if (conn == NULL) {
+                        httpsvr_loop_accept(loop);
+                    } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        httpsvr_loop_close(loop, conn);
+                    } else if (conn->state == HTTPSVR_CONN_READING) {
+                        httpsvr_loop_read(loop, conn);
+                    } else {
+                        httpsvr_loop_write(loop, conn);
+                    }
+                }
+                
+                httpsvr_loop_expire(loop, httpsvr_now());
+            }
+        }
+    }
+    
+    /* drop any connections still open when stopped */
+    while (loop->conns != NULL) {
+        httpsvr_loop_close(loop, loop->conns);
+    }
+    httpsvr_conn_pool_destroy(&loop->pool);
+    httpsvr_pool_destroy(&loop->buf_pool);
+    httpsvr_zip_thread_end();
+    if (loop->epoll_fd != -1) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+    
+    return rc;
+}
+
+
+void *httpsvr_loop_thread(void *arg) {
+    httpsvr_loop_struct *loop = arg;
+    
+    loop->rc = httpsvr_loop_run(loop);
+    
+    return NULL;
+}
+
+
+int httpsvr_run_event_loop(httpsvr_handle handle, int max_connections) {
+    int rc = -1;
+    httpsvr_loop_struct loop;
+    
+    httpsvr_struct *hss = handle;
+    if ((hss != NULL) && (max_connections > 0)) {
+        loop.hss        = hss;
+        loop.listen_soc = hss->listen_soc;
+        loop.max_conns  = max_connections;
+        hss->running = 1;
+        rc = httpsvr_loop_run(&loop);
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_run_workers(httpsvr_handle handle,
+                        int num_workers,
+                        int max_connections) {
+    int rc = -1;
+    int i = 0;
+    int num_started = 0;
+    httpsvr_loop_struct *loops = NULL;
+    
+    httpsvr_struct *hss = handle;
+    if ((hss != NULL) && (num_workers > 0) && (max_connections > 0)) {
+        loops = malloc(num_workers * sizeof(httpsvr_loop_struct));
+        if (loops != NULL) {
+            
+            /* first worker reuses the socket bound by httpsvr_init,
+               the rest bind their own and the kernel spreads connections */
+            rc = 0;
+            for (i = 0; i < num_workers; i++) {
+                loops[i].hss        = hss;
+                loops[i].max_conns  = max_connections;
+                loops[i].rc         = 0;
+                loops[i].listen_soc = (i == 0) ? hss->listen_soc
+                                               : httpsvr_listen_socket(hss->port);
+                if (loops[i].listen_soc == INVALID_SOCKET) {
+                    rc = -1;
+                    num_workers = i;
+                    break;
+                }
+            }
+            
+            hss->running = (rc == 0);
+            for (i = 0; (i < num_workers) && hss->running; i++) {
+                if (pthread_create(&loops[i].thread, NULL,
+                                   httpsvr_loop_thread, &loops[i]) != 0) {
+                    httpsvr_log(hss->log, HTTPSVR_LOG_ERROR, "worker %d failed to start", i);
+                    hss->running = 0;
+                    rc = -1;
+                    break;
+                }
+                num_started++;
+            }
+            for (i = 0; i < num_started; i++) {
+                pthread_join(loops[i].thread, NULL);
+                if (loops[i].rc != 0) {
+                    rc = -1;
+                }
+            }
+            
+            for (i = 1; i < num_workers; i++) {
+                CLOSE(loops[i].listen_soc);
+            }
+            free(loops);
+        }
+    }
+    
+    return rc;
+}
+
+#else   /* !__linux__ */
+
+int httpsvr_run_event_loop(httpsvr_handle handle, int max_connections) {
+    return -1;  /* epoll is not available */
+}
+
+
+int httpsvr_run_workers(httpsvr_handle handle,
+                        int num_workers,
+                        int max_connections) {
+    return -1;  /* epoll is not available */
+}
+
+#endif  /* __linux__ */
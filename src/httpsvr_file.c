@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "httpsvr.h"
 
@@ -41,24 +42,19 @@ int httpsvr_generic_file_handler(const char *content_type,
                                  const char *parameters,
                                  char *buffer,
                                  int buffer_len) {
-    int len = 0;
-    int n = 0;
+    int rc = 0;
+    struct stat st;
     
     if ((path != NULL) && (buffer != NULL)) {
-        FILE *fp = fopen(path, "r");
-        if (fp != NULL) {
-            n = httpsvr_append_content_type(buffer, buffer_len, content_type);
-            len += n;
-            buffer_len -= n;
-            n = fread(&buffer[len], 1, buffer_len, fp);
-            if (n > 0) {
-                len += n;
-                buffer_len -= n;
-            }
+        if ((stat(path, &st) == 0) && S_ISREG(st.st_mode)) {
+            
+            /* headers only, the server streams the file itself */
+            httpsvr_append_content_type(buffer, buffer_len, content_type);
+            rc = -HTTPSVR_SEND_FILE;
         }
     }
     
-    return len;
+    return rc;
 }
 
 
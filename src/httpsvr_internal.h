@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_INTERNAL_H_
+#define HTTPSVR_INTERNAL_H_
+
+#if defined (WIN32)
+#  include <winsock2.h>
+#  define CLOSE(soc)        closesocket(soc)
+#else
+#  include <unistd.h>
+#  include <sys/types.h>
+#  include <sys/socket.h>
+#  include <sys/uio.h>
+#  include <netinet/in.h>
+#  define SOCKET            int
+#  define INVALID_SOCKET    (-1)
+#  define SOCKET_ERROR      (-1)
+#  define SD_RECEIVE        SHUT_RD
+#  define SD_SEND           SHUT_WR
+#  define CLOSE(soc)        close(soc)
+#endif
+
+#if defined (WIN32)
+#  define HTTPSVR_THREAD_LOCAL  __declspec(thread)
+#else
+#  define HTTPSVR_THREAD_LOCAL  __thread
+#endif
+
+#if defined (MSG_NOSIGNAL)
+#  define HTTPSVR_SEND_FLAGS    MSG_NOSIGNAL
+#else
+#  define HTTPSVR_SEND_FLAGS    0
+#endif
+
+#include "httpsvr.h"
+#include "httpsvr_pool.h"
+#include "httpsvr_timer.h"
+
+
+#define HTTPSVR_KEEP_ALIVE_MAX_REQUESTS     100
+#define HTTPSVR_KEEP_ALIVE_TIMEOUT          5000    /* msec */
+#define HTTPSVR_HEADER_TIMEOUT              10000   /* msec */
+#define HTTPSVR_BODY_TIMEOUT                30000   /* msec */
+#define HTTPSVR_WRITE_TIMEOUT               30000   /* msec */
+#define HTTPSVR_CHUNK_HEAD_LEN              10      /* "7fffffff\r\n" */
+#define HTTPSVR_CHUNK_TAIL_LEN              7       /* "\r\n0\r\n\r\n" */
+#define HTTPSVR_MAX_HEADERS                 64
+#define HTTPSVR_MAX_BODY_LEN                (1024 * 1024)
+#define HTTPSVR_MAX_BUFFERED_BODY_LEN       (64 * 1024)
+#define HTTPSVR_CHUNK_LINE_MAX_LEN          256
+#define HTTPSVR_MAX_SEGS                    128     /* pieces queued for one write */
+#define HTTPSVR_RESP_MAX_SEGS               (3 + 2 * HTTPSVR_MAX_RANGES)
+#define HTTPSVR_MAX_SEND_BUFS               8       /* extra buffers for one batch */
+#define HTTPSVR_TEMPLATE_BASE_LEN           128     /* status line and headers, less user agent */
+#define HTTPSVR_CONTENT_LENGTH_LEN          38      /* "Content-Length: " 20 digits "\r\n" */
+#define HTTPSVR_MAX_RANGES                  8       /* more are answered with the whole file */
+#define HTTPSVR_RANGE_TYPE_LEN              64
+#define HTTPSVR_RANGE_BOUNDARY_LEN          48
+#define HTTPSVR_CONN_ARENA_LEN              4096    /* first chunk, kept while pooled */
+#define HTTPSVR_KEY_ARENA_LEN               1024
+
+
+/* connection states */
+enum HTTPSVR_CONN_STATES {
+    HTTPSVR_CONN_READING        = 0,
+    HTTPSVR_CONN_WRITING        = 1,
+};
+
+/* what a connection's timer is waiting for */
+enum HTTPSVR_DEADLINES {
+    HTTPSVR_DEADLINE_NONE       = 0,
+    HTTPSVR_DEADLINE_IDLE       = 1,    /* next request on a kept connection */
+    HTTPSVR_DEADLINE_HEADER     = 2,    /* all headers, from the first byte */
+    HTTPSVR_DEADLINE_BODY       = 3,    /* more of the body */
+    HTTPSVR_DEADLINE_WRITE      = 4,    /* room to write more */
+};
+
+/* request parser states, advanced one line at a time */
+enum HTTPSVR_PARSE_STATES {
+    HTTPSVR_PARSE_REQUEST_LINE  = 0,
+    HTTPSVR_PARSE_HEADERS       = 1,
+    HTTPSVR_PARSE_ERROR         = 2,
+};
+
+/* request body states, after the headers */
+enum HTTPSVR_BODY_STATES {
+    HTTPSVR_BODY_NONE           = 0,
+    HTTPSVR_BODY_LENGTH         = 1,
+    HTTPSVR_BODY_CHUNK_SIZE     = 2,
+    HTTPSVR_BODY_CHUNK_DATA     = 3,
+    HTTPSVR_BODY_CHUNK_END      = 4,
+    HTTPSVR_BODY_TRAILER        = 5,
+    HTTPSVR_BODY_DONE           = 6,
+    HTTPSVR_BODY_ERROR          = 7,
+};
+
+/* responses with a prebuilt status line and headers */
+enum HTTPSVR_RESPONSES {
+    HTTPSVR_RESP_OK             = 0,
+    HTTPSVR_RESP_NO_CONTENT     = 1,
+    HTTPSVR_RESP_PARTIAL        = 2,
+    HTTPSVR_RESP_MOVED          = 3,
+    HTTPSVR_RESP_NOT_MODIFIED   = 4,
+    HTTPSVR_RESP_BAD_REQUEST    = 5,
+    HTTPSVR_RESP_NOT_FOUND      = 6,
+    HTTPSVR_RESP_TOO_LARGE      = 7,
+    HTTPSVR_RESP_BAD_RANGE      = 8,
+    HTTPSVR_RESP_SERVER_ERROR   = 9,
+    HTTPSVR_RESP_HEADERS_TOO_LARGE = 10,
+    HTTPSVR_NUM_RESP            = 11,
+};
+
+
+typedef struct httpsvr_struct httpsvr_struct;
+typedef struct httpsvr_cache_struct httpsvr_cache_struct;
+typedef struct httpsvr_cache_entry_struct httpsvr_cache_entry_struct;
+typedef struct httpsvr_bundle_struct httpsvr_bundle_struct;
+typedef struct httpsvr_route_node_struct httpsvr_route_node_struct;
+typedef struct httpsvr_zip_cache_struct httpsvr_zip_cache_struct;
+typedef struct httpsvr_metrics_struct httpsvr_metrics_struct;
+typedef struct httpsvr_log_struct httpsvr_log_struct;
+
+/* part of the receive buffer, by offset so it survives buffer moves */
+typedef struct {
+    int     pos;
+    int     len;
+} httpsvr_slice;
+
+typedef struct {
+    httpsvr_slice name;
+    httpsvr_slice value;
+} httpsvr_header_struct;
+
+/* byte range of a file, end exclusive */
+typedef struct {
+    long long start;
+    long long end;
+} httpsvr_range_struct;
+
+/* piece of a response on its way out, bytes [pos, end) of memory or
+   of an open file, the last piece of a response holds its resources */
+typedef struct {
+    const char *data;               /* NULL for a file */
+    int     fd;
+    int     close_fd;
+    long long pos;
+    long long end;
+    httpsvr_cache_entry_struct *entry;
+    httpsvr_cache_entry_struct *mapped;  /* file mapping data points into */
+} httpsvr_seg_struct;
+
+typedef struct {
+    char                   *ext;
+    unsigned int            hash;
+    httpsvr_file_handler    handler;
+} httpsvr_file_handler_struct;
+
+typedef struct {
+    char                   *name;
+    unsigned int            hash;
+    httpsvr_file_handler    handler;
+    httpsvr_stream_handler  stream;
+    const char             *content_type;
+    httpsvr_upload_handler  upload;
+} httpsvr_page_handler_struct;
+
+
+/* per connection state, one per accepted socket */
+typedef struct httpsvr_conn_struct httpsvr_conn_struct;
+struct httpsvr_conn_struct {
+    httpsvr_struct *hss;
+    httpsvr_pool_struct *pool;
+    httpsvr_pool_struct *buf_pool;  /* extra send buffers */
+    httpsvr_metrics_struct *metrics;  /* the worker's, NULL until registered */
+    httpsvr_arena_struct arena;     /* per request, reset between requests */
+    httpsvr_conn_struct *prev;
+    httpsvr_conn_struct *next;
+    SOCKET  soc;
+    httpsvr_sink sink;              /* takes the output in place of soc */
+    void   *sink_context;
+    int     state;
+    unsigned int events;
+    char   *recv_data;
+    int     recv_data_max_len;
+    int     recv_data_len;
+    int     parse_state;
+    int     parse_pos;              /* start of the next unparsed line */
+    int     parse_scan;             /* end of the bytes already scanned */
+    int     parse_spaces;
+    int     parse_colon;
+    httpsvr_slice req_method_slice;
+    httpsvr_slice req_target_slice;
+    httpsvr_slice req_ver_slice;
+    int     req_query_pos;
+    int     req_dot_pos;
+    int     req_tilde;
+    httpsvr_header_struct headers[HTTPSVR_MAX_HEADERS];
+    int     headers_len;
+    int     req_len;
+    char   *send_data;              /* buffer responses are built into */
+    int     send_data_max_len;
+    int     send_data_len;
+    char   *send_base;              /* own buffer, send_data between batches */
+    char   *send_bufs[HTTPSVR_MAX_SEND_BUFS];
+    int     send_bufs_len;
+    httpsvr_seg_struct segs[HTTPSVR_MAX_SEGS];
+    int     segs_len;
+    int     seg_pos;                /* first piece not yet written */
+    int     resp_start;
+    int     resp_seg_start;
+    int     resp_status;            /* HTTPSVR_RESP_*, -1 for a raw response */
+    int     resp_head;              /* start of the headers in send_data */
+    int     resp_length_pos;        /* end of the Content-Length room, -1 if none */
+    int     route_id;               /* route answering the request, -1 if none */
+    long long send_start;           /* nsec the batch was queued, 0 once sent */
+    long long resp_time;            /* nsec taken to build the response */
+    char   *req_save;
+    char   *req_method;
+    char   *req_path;
+    char   *req_params;
+    char   *req_ver;
+    int     body_state;
+    int     body_error;
+    long long body_left;
+    long long body_total;
+    char   *req_body;
+    int     req_body_len;
+    int     req_body_max_len;
+    httpsvr_upload_handler upload;
+    void   *upload_context;
+    const char *upload_name;
+    httpsvr_route_param route_params[HTTPSVR_MAX_ROUTE_PARAMS];
+    int     route_params_len;
+    int     keep_alive;
+    int     requests_left;
+    httpsvr_timer_struct timer;     /* the event loop's deadline */
+    int     timer_kind;
+    char   *file_path;
+    int     file_path_max_len;
+    httpsvr_stream_handler stream;
+    void   *stream_context;
+    char   *stream_params;
+    int     stream_chunked;
+    httpsvr_range_struct ranges[HTTPSVR_MAX_RANGES];
+    int     ranges_len;             /* parts of a multipart/byteranges body */
+    long long range_size;
+    char    range_type[HTTPSVR_RANGE_TYPE_LEN];
+    char    range_boundary[HTTPSVR_RANGE_BOUNDARY_LEN];
+};
+
+
+/* server state, shared read-only by all connections once serving */
+struct httpsvr_struct {
+    SOCKET  listen_soc;
+    unsigned short port;
+    volatile int running;
+    int     keep_alive_max_requests;
+    int     keep_alive_timeout;
+    int     header_timeout;
+    int     body_timeout;
+    int     write_timeout;
+    long long max_body_len;
+    int     max_buffered_body_len;
+    httpsvr_cache_struct *cache;
+    httpsvr_bundle_struct *bundle;  /* prebuilt responses, NULL without */
+    httpsvr_conn_struct *conn;
+    int     recv_data_max_len;
+    int     send_data_max_len;
+    char   *user_agent;
+    int     user_agent_max_len;
+    char   *template_data;
+    struct iovec templates[HTTPSVR_NUM_RESP][2][2];  /* by version, keep-alive */
+    char   *file_root_path;
+    int     file_path_max_len;
+    httpsvr_file_handler_struct *file_handlers;
+    int     file_handlers_max_len;
+    int     file_handlers_len;
+    int    *file_index;             /* open addressed hash of file_handlers */
+    unsigned int file_index_mask;
+    int     file_wildcard;
+    httpsvr_page_handler_struct *page_handlers;
+    int     page_handlers_max_len;
+    int     page_handlers_len;
+    int    *page_index;             /* open addressed hash of page_handlers */
+    unsigned int page_index_mask;
+    int     page_wildcard;
+    httpsvr_route_node_struct *routes;
+    int     num_routes;
+    httpsvr_arena_struct arena;     /* handler keys and routes, for good */
+    int     gzip_static;
+    int     file_map;               /* file cache maps files */
+    int     deflate_level;
+    int     deflate_min_len;
+    httpsvr_zip_cache_struct *zip_cache;
+    httpsvr_metrics_struct *metrics;  /* one per worker */
+    httpsvr_log_struct *log;        /* NULL until logging is set */
+};
+
+
+/* status lines of the prebuilt responses, by HTTPSVR_RESP_* */
+extern const char *httpsvr_status_lines[HTTPSVR_NUM_RESP];
+
+/* the connection whose handler is running on this thread */
+extern HTTPSVR_THREAD_LOCAL httpsvr_conn_struct *httpsvr_current_conn;
+
+
+SOCKET httpsvr_listen_socket(unsigned short port);
+
+unsigned int httpsvr_hash(const char *s);
+
+int  httpsvr_find_file(httpsvr_struct *hss, const char *file_extension);
+
+int  httpsvr_find_page(httpsvr_struct *hss, const char *page_name);
+
+int  httpsvr_conn_len(httpsvr_struct *hss);
+
+/* from the worker's pools, or malloc when they are NULL */
+httpsvr_conn_struct *httpsvr_conn_create(httpsvr_struct *hss,
+                                         httpsvr_pool_struct *pool,
+                                         httpsvr_pool_struct *buf_pool);
+
+void httpsvr_conn_destroy(httpsvr_conn_struct *conn);
+
+void httpsvr_conn_pool_destroy(httpsvr_pool_struct *pool);
+
+void httpsvr_conn_reset(httpsvr_conn_struct *conn);
+
+int  httpsvr_req_complete(httpsvr_conn_struct *conn);
+
+void httpsvr_process_req(httpsvr_conn_struct *conn);
+
+void httpsvr_conn_next(httpsvr_conn_struct *conn);
+
+int  httpsvr_process_batch(httpsvr_conn_struct *conn);
+
+int  httpsvr_header_end(const char *data, int len);
+
+void httpsvr_parse_req(httpsvr_conn_struct *conn);
+
+int  httpsvr_has_token(const char *value, int value_len, const char *token);
+
+void httpsvr_body_reset(httpsvr_conn_struct *conn);
+
+/* the request is answered with status and the connection closed */
+void httpsvr_body_fail(httpsvr_conn_struct *conn, int status);
+
+void httpsvr_body_start(httpsvr_conn_struct *conn);
+
+/* takes body bytes out of the receive buffer, returns 1 once the body
+   is complete or has failed */
+int  httpsvr_body_read(httpsvr_conn_struct *conn);
+
+const char *httpsvr_find_header(httpsvr_conn_struct *conn,
+                                const char *name,
+                                int *value_len);
+
+int  httpsvr_is_head(httpsvr_conn_struct *conn);
+
+int  httpsvr_is_http11(httpsvr_conn_struct *conn);
+
+/* starts a response with a prebuilt status line and common headers */
+void httpsvr_status_resp(httpsvr_conn_struct *conn, int status);
+
+int  httpsvr_format_etag(char *etag, long long size, long long mtime, long long ino);
+
+/* value is an If-None-Match list, true if it holds etag or "*" */
+int  httpsvr_etag_match(const char *value, int value_len,
+                        const char *etag, int etag_len);
+
+int  httpsvr_format_date(char *buffer, int buffer_len, long long t);
+
+int  httpsvr_parse_date(const char *value, int value_len, long long *t);
+
+void httpsvr_append_send(httpsvr_conn_struct *conn, const char *s);
+
+/* starts a response with room for the content length */
+void httpsvr_length_resp(httpsvr_conn_struct *conn, int status);
+
+/* queues the response built in send_data, filling in the content length */
+void httpsvr_send(httpsvr_conn_struct *conn);
+
+/* adds a header line to the handler headers, ahead of the blank line */
+void httpsvr_add_header(httpsvr_conn_struct *conn, const char *name, const char *value);
+
+/* checks Range and If-Range for a file of size bytes, sets the status
+   and headers, and the window [*start, *end) to send; returns the
+   content length */
+long long httpsvr_range_start(httpsvr_conn_struct *conn,
+                              long long size,
+                              long long mtime,
+                              long long ino,
+                              long long *start,
+                              long long *end);
+
+/* queues the parts of a multipart/byteranges body, taking fd or entry */
+void httpsvr_range_queue(httpsvr_conn_struct *conn,
+                         int fd,
+                         httpsvr_cache_entry_struct *entry);
+
+/* releases the pieces from seg_start on, for a response taken back */
+void httpsvr_send_drop(httpsvr_conn_struct *conn, int seg_start);
+
+/* releases all pieces and extra buffers, back to the own buffer */
+void httpsvr_send_clear(httpsvr_conn_struct *conn);
+
+/* switches send_data to a fresh buffer, returns 0 when out of them */
+int  httpsvr_send_grow(httpsvr_conn_struct *conn);
+
+void httpsvr_send_queue(httpsvr_conn_struct *conn, const char *data, int len);
+
+void httpsvr_send_window(httpsvr_conn_struct *conn,
+                         int fd,
+                         httpsvr_cache_entry_struct *entry,
+                         long long start,
+                         long long end);
+
+/* hands fd and entry to the last piece of the response */
+void httpsvr_send_own(httpsvr_conn_struct *conn,
+                      int fd,
+                      httpsvr_cache_entry_struct *entry);
+
+/* returns 1 once all pieces are written, 0 when the socket is full */
+int  httpsvr_write_chain(httpsvr_conn_struct *conn);
+
+int  httpsvr_write_pending(httpsvr_conn_struct *conn);
+
+int  httpsvr_stream_fill(httpsvr_conn_struct *conn);
+
+void httpsvr_stream_end(httpsvr_conn_struct *conn);
+
+#endif  /* HTTPSVR_INTERNAL_H_ */
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+
+#include "httpsvr_internal.h"
+#include "httpsvr_log.h"
+
+
+static const char *httpsvr_log_levels[] = {
+    "off",
+    "error",
+    "warn",
+    "info",
+    "debug",
+};
+
+
+httpsvr_log_struct *httpsvr_log_create(void) {
+    httpsvr_log_struct *log = calloc(1, sizeof(httpsvr_log_struct));
+    int i = 0;
+    
+    if (log != NULL) {
+        log->fd = -1;
+        log->records = malloc(HTTPSVR_LOG_RECORDS * sizeof(httpsvr_log_record_struct));
+        if (log->records == NULL) {
+            free(log);
+            log = NULL;
+        } else {
+            
+            /* slot i is free for the claim at position i */
+            for (i = 0; i < HTTPSVR_LOG_RECORDS; i++) {
+                log->records[i].seq = i;
+            }
+        }
+    }
+    
+    return log;
+}
+
+
+httpsvr_log_record_struct *httpsvr_log_claim(httpsvr_log_struct *log,
+                                             unsigned long long *pos) {
+    httpsvr_log_record_struct *record = NULL;
+    long long diff = 0;
+    
+    *pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+    while (1) {
+        record = &log->records[*pos & (HTTPSVR_LOG_RECORDS - 1)];
+        diff = (long long) (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) - *pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log->head, pos, *pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            
+            /* full, the record is dropped rather than wait */
+            __atomic_fetch_add(&log->dropped, 1, __ATOMIC_RELAXED);
+            record = NULL;
+            break;
+        } else {
+            *pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+        }
+    }
+    
+    return record;
+}
+
+
+long long httpsvr_log_time(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_REALTIME, &ts);
+    
+    return ((long long) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+void httpsvr_log(httpsvr_log_struct *log, int level, const char *format, ...) {
+    httpsvr_log_record_struct *record = NULL;
+    unsigned long long pos = 0;
+    va_list args;
+    
+    if (httpsvr_log_enabled(log, level) &&
+        ((record = httpsvr_log_claim(log, &pos)) != NULL)) {
+        record->level  = level;
+        record->status = 0;
+        record->time   = httpsvr_log_time();
+        va_start(args, format);
+        vsnprintf(record->text, HTTPSVR_LOG_TEXT_LEN, format, args);
+        va_end(args);
+        __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+void httpsvr_log_access(httpsvr_conn_struct *conn) {
+    httpsvr_log_struct *log = conn->hss->log;
+    httpsvr_log_record_struct *record = NULL;
+    unsigned long long pos = 0;
+    long long bytes = 0;
+    int i = 0;
+    
+    /* fields are kept raw, the writer thread does the formatting */
+    if (httpsvr_log_enabled(log, HTTPSVR_LOG_INFO) &&
+        ((record = httpsvr_log_claim(log, &pos)) != NULL)) {
+        for (i = conn->resp_seg_start; i < conn->segs_len; i++) {
+            bytes += conn->segs[i].end - conn->segs[i].pos;
+        }
+        record->level  = HTTPSVR_LOG_INFO;
+        record->status = (conn->resp_status >= 0) ? atoi(httpsvr_status_lines[conn->resp_status]) : -1;
+        record->time   = httpsvr_log_time();
+        record->bytes  = bytes;
+        record->usec   = conn->resp_time / 1000;
+        snprintf(record->text, HTTPSVR_LOG_TEXT_LEN, "%s %s",
+                 (conn->req_method != NULL) ? conn->req_method : "-",
+                 (conn->req_path   != NULL) ? conn->req_path   : "-");
+        __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+int httpsvr_log_quote(char *buffer, int buffer_len, const char *s) {
+    int n = 0;
+    
+    /* logfmt value, quotes and backslashes escaped, control bytes dropped */
+    while ((*s != '\0') && (n < buffer_len - 2)) {
+        if ((*s == '"') || (*s == '\\')) {
+            buffer[n++] = '\\';
+            buffer[n++] = *s;
+        } else if ((unsigned char) *s >= ' ') {
+            buffer[n++] = *s;
+        }
+        s++;
+    }
+    
+    return n;
+}
+
+
+int httpsvr_log_format(httpsvr_log_record_struct *record, char *buffer, int buffer_len) {
+    int n = 0;
+    char *space = NULL;
+    char text[2 * HTTPSVR_LOG_TEXT_LEN];
+    time_t t = record->time / 1000000;
+    struct tm tm;
+    
+    gmtime_r(&t, &tm);
+    n = snprintf(buffer, buffer_len, "time=%04d-%02d-%02dT%02d:%02d:%02d.%06lldZ level=%s ",
+                 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                 tm.tm_hour, tm.tm_min, tm.tm_sec, record->time % 1000000,
+                 httpsvr_log_levels[record->level]);
+    if (record->status != 0) {
+        space = strchr(record->text, ' ');
+        if (space != NULL) {
+            *space = '\0';
+        }
+        text[httpsvr_log_quote(text, sizeof(text), (space != NULL) ? space + 1 : "-")] = '\0';
+        n += snprintf(&buffer[n], buffer_len - n,
+                      "method=%s path=\"%s\" status=%d bytes=%lld usec=%lld\n",
+                      record->text, text, record->status, record->bytes, record->usec);
+    } else {
+        text[httpsvr_log_quote(text, sizeof(text), record->text)] = '\0';
+        n += snprintf(&buffer[n], buffer_len - n, "msg=\"%s\"\n", text);
+    }
+    
+    return n;
+}
+
+
+void httpsvr_log_write(httpsvr_log_struct *log, const char *data, int len) {
+    int n = 0;
+    
+    while (len > 0) {
+        n = write(log->fd, data, len);
+        if (n > 0) {
+            data += n;
+            len  -= n;
+        } else if ((n < 0) && (errno == EINTR)) {
+            continue;
+        } else {
+            break;  /* nowhere to log the failure, drop the lines */
+        }
+    }
+}
+
+
+int httpsvr_log_drain(httpsvr_log_struct *log, char *buffer) {
+    httpsvr_log_record_struct *record = NULL;
+    httpsvr_log_record_struct note;
+    unsigned long long dropped = 0;
+    int num_records = 0;
+    int n = 0;
+    
+    /* take records in order, writing whenever the buffer fills */
+    while (1) {
+        record = &log->records[log->tail & (HTTPSVR_LOG_RECORDS - 1)];
+        if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != log->tail + 1) {
+            break;
+        }
+        if (n > HTTPSVR_LOG_WRITE_LEN - 2 * HTTPSVR_LOG_TEXT_LEN - 128) {
+            httpsvr_log_write(log, buffer, n);
+            n = 0;
+        }
+        n += httpsvr_log_format(record, &buffer[n], HTTPSVR_LOG_WRITE_LEN - n);
+        __atomic_store_n(&record->seq, log->tail + HTTPSVR_LOG_RECORDS, __ATOMIC_RELEASE);
+        log->tail++;
+        num_records++;
+    }
+    
+    /* say how many were lost to a full queue */
+    dropped = __atomic_load_n(&log->dropped, __ATOMIC_RELAXED);
+    if (dropped != log->dropped_seen) {
+        note.level  = HTTPSVR_LOG_WARN;
+        note.status = 0;
+        note.time   = httpsvr_log_time();
+        snprintf(note.text, HTTPSVR_LOG_TEXT_LEN, "%llu log records dropped",
+                 dropped - log->dropped_seen);
+        n += httpsvr_log_format(&note, &buffer[n], HTTPSVR_LOG_WRITE_LEN - n);
+        log->dropped_seen = dropped;
+    }
+    if (n > 0) {
+        httpsvr_log_write(log, buffer, n);
+    }
+    
+    return num_records;
+}
+
+
+void *httpsvr_log_thread(void *arg) {
+    httpsvr_log_struct *log = arg;
+    char *buffer = malloc(HTTPSVR_LOG_WRITE_LEN);
+    struct timespec idle;
+    
+    idle.tv_sec  = 0;
+    idle.tv_nsec = HTTPSVR_LOG_IDLE * 1000000;
+    if (buffer != NULL) {
+        
+        /* sleep only when there was nothing to write, and finish the
+           queue once stopped */
+        while (log->running) {
+            if (httpsvr_log_drain(log, buffer) == 0) {
+                nanosleep(&idle, NULL);
+            }
+        }
+        httpsvr_log_drain(log, buffer);
+        free(buffer);
+    }
+    
+    return NULL;
+}
+
+
+int httpsvr_log_start(httpsvr_log_struct *log, int level, int fd) {
+    int rc = 0;
+    
+    /* the writer restarts to pick up a new fd */
+    __atomic_store_n(&log->level, HTTPSVR_LOG_OFF, __ATOMIC_RELAXED);
+    if (log->started) {
+        log->running = 0;
+        pthread_join(log->thread, NULL);
+        log->started = 0;
+    }
+    if (level > HTTPSVR_LOG_OFF) {
+        log->fd = fd;
+        log->running = 1;
+        if (pthread_create(&log->thread, NULL, httpsvr_log_thread, log) == 0) {
+            log->started = 1;
+            __atomic_store_n(&log->level, level, __ATOMIC_RELAXED);
+        } else {
+            log->running = 0;
+            rc = -1;
+        }
+    }
+    
+    return rc;
+}
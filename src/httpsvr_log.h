@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_LOG_H_
+#define HTTPSVR_LOG_H_
+
+#include <pthread.h>
+
+#include "httpsvr_internal.h"
+
+
+#define HTTPSVR_LOG_RECORDS         4096    /* power of two */
+#define HTTPSVR_LOG_TEXT_LEN        192
+#define HTTPSVR_LOG_WRITE_LEN       (64 * 1024)
+#define HTTPSVR_LOG_IDLE            10      /* msec the writer sleeps when idle */
+
+
+/* one queued record, an access line when status is not 0, otherwise a
+   message; seq says whose turn the slot is */
+typedef struct {
+    unsigned long long seq;
+    int     level;
+    int     status;
+    long long time;                 /* usec since the epoch */
+    long long bytes;
+    long long usec;
+    char    text[HTTPSVR_LOG_TEXT_LEN];
+} httpsvr_log_record_struct;
+
+/* bounded queue, any worker claims a slot with a compare and swap and
+   never waits, the writer thread alone takes them out */
+struct httpsvr_log_struct {
+    int     level;
+    int     fd;
+    httpsvr_log_record_struct *records;
+    unsigned long long head __attribute__ ((aligned (64)));
+    unsigned long long tail __attribute__ ((aligned (64)));
+    unsigned long long dropped;
+    unsigned long long dropped_seen;
+    volatile int running;
+    int     started;
+    pthread_t thread;
+};
+
+
+#define httpsvr_log_enabled(log, lvl) \
+    (((log) != NULL) && (__atomic_load_n(&(log)->level, __ATOMIC_RELAXED) >= (lvl)))
+
+
+httpsvr_log_struct *httpsvr_log_create(void);
+
+/* starts or stops the writer thread, stopping writes out the queue */
+int  httpsvr_log_start(httpsvr_log_struct *log, int level, int fd);
+
+void httpsvr_log(httpsvr_log_struct *log, int level, const char *format, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
+/* access line for the response just queued on conn */
+void httpsvr_log_access(httpsvr_conn_struct *conn);
+
+#endif  /* HTTPSVR_LOG_H_ */
@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "httpsvr_internal.h"
+#include "httpsvr_metrics.h"
+#include "httpsvr_route.h"
+
+
+#define HTTPSVR_METRICS_TEXT_LEN    8192
+
+
+/* formatted metrics, handed out a buffer at a time */
+typedef struct {
+    char   *data;
+    int     len;
+    int     max_len;
+    int     pos;
+} httpsvr_metrics_text_struct;
+
+
+static pthread_mutex_t httpsvr_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *httpsvr_phase_names[HTTPSVR_NUM_PHASES] = {
+    "parse",
+    "handler",
+    "send",
+};
+
+
+httpsvr_metrics_struct *httpsvr_metrics_register(httpsvr_struct *hss) {
+    httpsvr_metrics_struct *metrics = calloc(1, sizeof(httpsvr_metrics_struct));
+    
+    if (metrics != NULL) {
+        
+        /* routes are all added before serving */
+        if (hss->num_routes > 0) {
+            metrics->route_requests = calloc(hss->num_routes, sizeof(unsigned long long));
+            if (metrics->route_requests != NULL) {
+                metrics->num_routes = hss->num_routes;
+            }
+        }
+        
+        /* readers walk the list without the lock */
+        pthread_mutex_lock(&httpsvr_metrics_lock);
+        metrics->next = hss->metrics;
+        __atomic_store_n(&hss->metrics, metrics, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&httpsvr_metrics_lock);
+    }
+    
+    return metrics;
+}
+
+
+long long httpsvr_metrics_clock(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return ((long long) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+
+int httpsvr_hist_index(unsigned long long usec) {
+    int rc = 0;
+    int m = 0;
+    
+    /* upper bounds run 1, 2, 3, 4, 6, 8, 12, 16 ... usec */
+    if (usec > 2) {
+        m = 63 - __builtin_clzll(usec - 1);
+        rc = (usec <= (3ULL << (m - 1))) ? (2 * m) : (2 * m + 1);
+    } else if (usec == 2) {
+        rc = 1;
+    }
+    
+    return rc;
+}
+
+
+unsigned long long httpsvr_hist_bound(int i) {
+    unsigned long long rc = 1;
+    
+    if (i > 0) {
+        rc = (i & 1) ? (1ULL << ((i + 1) / 2)) : (3ULL << (i / 2 - 1));
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_metrics_time(httpsvr_metrics_struct *metrics, int phase, long long nsec) {
+    httpsvr_hist_struct *hist = NULL;
+    int i = 0;
+    
+    if ((metrics != NULL) && (nsec >= 0)) {
+        hist = &metrics->phases[phase];
+        i = httpsvr_hist_index(nsec / 1000);
+        if (i < HTTPSVR_HIST_BUCKETS) {
+            httpsvr_metrics_add(hist->buckets[i], 1);
+        }
+        httpsvr_metrics_add(hist->sum, nsec);
+        httpsvr_metrics_add(hist->count, 1);
+    }
+}
+
+
+void httpsvr_metrics_request(httpsvr_conn_struct *conn) {
+    httpsvr_metrics_struct *metrics = conn->metrics;
+    
+    if (metrics != NULL) {
+        if (conn->resp_status >= 0) {
+            httpsvr_metrics_add(metrics->requests[conn->resp_status], 1);
+        } else {
+            httpsvr_metrics_add(metrics->requests[HTTPSVR_NUM_RESP], 1);
+        }
+        if ((conn->route_id >= 0) && (conn->route_id < metrics->num_routes)) {
+            httpsvr_metrics_add(metrics->route_requests[conn->route_id], 1);
+        }
+    }
+}
+
+
+unsigned long long httpsvr_metrics_load(const unsigned long long *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+void httpsvr_metrics_printf(httpsvr_metrics_text_struct *text, const char *format, ...) {
+    int n = 0;
+    char *data = NULL;
+    va_list args;
+    
+    /* grow and format again when it did not fit */
+    if (text->data != NULL) {
+        va_start(args, format);
+        n = vsnprintf(&text->data[text->len], text->max_len - text->len, format, args);
+        va_end(args);
+        if ((n >= text->max_len - text->len) && (n >= 0)) {
+            data = realloc(text->data, 2 * text->max_len + n);
+            if (data != NULL) {
+                text->data = data;
+                text->max_len = 2 * text->max_len + n;
+                va_start(args, format);
+                n = vsnprintf(&text->data[text->len], text->max_len - text->len, format, args);
+                va_end(args);
+            } else {
+                free(text->data);
+                text->data = NULL;
+                n = 0;
+            }
+        }
+        if (n > 0) {
+            text->len += n;
+        }
+    }
+}
+
+
+void httpsvr_metrics_counter(httpsvr_metrics_text_struct *text,
+                             httpsvr_metrics_struct *list,
+                             const char *name,
+                             const char *type,
+                             const char *help,
+                             size_t offset) {
+    httpsvr_metrics_struct *metrics = NULL;
+    unsigned long long sum = 0;
+    
+    for (metrics = list; metrics != NULL; metrics = metrics->next) {
+        sum += httpsvr_metrics_load((unsigned long long *) ((char *) metrics + offset));
+    }
+    httpsvr_metrics_printf(text, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n",
+                           name, help, name, type, name, (long long) sum);
+}
+
+
+/* a label value with backslash, double quote and line feed escaped */
+void httpsvr_metrics_label(httpsvr_metrics_text_struct *text, const char *value) {
+    int n = 0;
+    
+    while (*value != '\0') {
+        n = strcspn(value, "\\\"\n");
+        if (n > 0) {
+            httpsvr_metrics_printf(text, "%.*s", n, value);
+            value += n;
+        } else if (*value == '\n') {
+            httpsvr_metrics_printf(text, "\\n");
+            value++;
+        } else {
+            httpsvr_metrics_printf(text, "\\%c", *value);
+            value++;
+        }
+    }
+}
+
+
+void httpsvr_metrics_routes(httpsvr_metrics_text_struct *text,
+                            httpsvr_metrics_struct *list,
+                            httpsvr_route_node_struct *node) {
+    httpsvr_metrics_struct *metrics = NULL;
+    httpsvr_route_struct *route = NULL;
+    unsigned long long sum = 0;
+    int mount = 0;
+    
+    /* routes at this node, then those below it */
+    for (; node != NULL; node = node->next) {
+        for (mount = 0; mount < 2; mount++) {
+            for (route = mount ? node->mounts : node->routes; route != NULL; route = route->next) {
+                sum = 0;
+                for (metrics = list; metrics != NULL; metrics = metrics->next) {
+                    if (route->id < metrics->num_routes) {
+                        sum += httpsvr_metrics_load(&metrics->route_requests[route->id]);
+                    }
+                }
+                httpsvr_metrics_printf(text, "httpsvr_route_requests_total{method=\"");
+                httpsvr_metrics_label(text, (route->method != NULL) ? route->method : "*");
+                httpsvr_metrics_printf(text, "\",route=\"");
+                httpsvr_metrics_label(text, route->pattern);
+                httpsvr_metrics_printf(text, "\"} %llu\n", sum);
+            }
+        }
+        httpsvr_metrics_routes(text, list, node->param);
+        httpsvr_metrics_routes(text, list, node->child);
+    }
+}
+
+
+void httpsvr_metrics_hist(httpsvr_metrics_text_struct *text,
+                          httpsvr_metrics_struct *list,
+                          int phase) {
+    httpsvr_metrics_struct *metrics = NULL;
+    const char *name = httpsvr_phase_names[phase];
+    unsigned long long sum = 0;
+    unsigned long long count = 0;
+    unsigned long long total = 0;
+    int i = 0;
+    
+    /* Prometheus buckets are cumulative, bounds in seconds */
+    httpsvr_metrics_printf(text, "# HELP httpsvr_%s_seconds Time spent in the %s phase.\n"
+                                 "# TYPE httpsvr_%s_seconds histogram\n", name, name, name);
+    for (i = 0; i < HTTPSVR_HIST_BUCKETS; i++) {
+        for (metrics = list; metrics != NULL; metrics = metrics->next) {
+            total += httpsvr_metrics_load(&metrics->phases[phase].buckets[i]);
+        }
+        httpsvr_metrics_printf(text, "httpsvr_%s_seconds_bucket{le=\"%g\"} %llu\n",
+                               name, httpsvr_hist_bound(i) / 1e6, total);
+    }
+    for (metrics = list; metrics != NULL; metrics = metrics->next) {
+        count += httpsvr_metrics_load(&metrics->phases[phase].count);
+        sum   += httpsvr_metrics_load(&metrics->phases[phase].sum);
+    }
+    httpsvr_metrics_printf(text, "httpsvr_%s_seconds_bucket{le=\"+Inf\"} %llu\n"
+                                 "httpsvr_%s_seconds_sum %.9f\n"
+                                 "httpsvr_%s_seconds_count %llu\n",
+                           name, count, name, sum / 1e9, name, count);
+}
+
+
+httpsvr_metrics_text_struct *httpsvr_metrics_format(httpsvr_struct *hss) {
+    httpsvr_metrics_text_struct *text = malloc(sizeof(httpsvr_metrics_text_struct));
+    httpsvr_metrics_struct *list = __atomic_load_n(&hss->metrics, __ATOMIC_ACQUIRE);
+    httpsvr_metrics_struct *metrics = NULL;
+    unsigned long long sum = 0;
+    int i = 0;
+    
+    if (text != NULL) {
+        text->len     = 0;
+        text->pos     = 0;
+        text->max_len = HTTPSVR_METRICS_TEXT_LEN;
+        text->data    = malloc(text->max_len);
+        
+        httpsvr_metrics_printf(text, "# HELP httpsvr_requests_total Responses sent, by status.\n"
+                                     "# TYPE httpsvr_requests_total counter\n");
+        for (i = 0; i <= HTTPSVR_NUM_RESP; i++) {
+            sum = 0;
+            for (metrics = list; metrics != NULL; metrics = metrics->next) {
+                sum += httpsvr_metrics_load(&metrics->requests[i]);
+            }
+            if (i < HTTPSVR_NUM_RESP) {
+                httpsvr_metrics_printf(text, "httpsvr_requests_total{status=\"%.3s\"} %llu\n",
+                                       httpsvr_status_lines[i], sum);
+            } else {
+                httpsvr_metrics_printf(text, "httpsvr_requests_total{status=\"other\"} %llu\n", sum);
+            }
+        }
+        if (hss->routes != NULL) {
+            httpsvr_metrics_printf(text, "# HELP httpsvr_route_requests_total Responses sent, by route.\n"
+                                         "# TYPE httpsvr_route_requests_total counter\n");
+            httpsvr_metrics_routes(text, list, hss->routes);
+        }
+        httpsvr_metrics_counter(text, list, "httpsvr_received_bytes_total", "counter",
+                                "Bytes read from clients.",
+                                offsetof(httpsvr_metrics_struct, bytes_in));
+        httpsvr_metrics_counter(text, list, "httpsvr_sent_bytes_total", "counter",
+                                "Bytes written to clients.",
+                                offsetof(httpsvr_metrics_struct, bytes_out));
+        httpsvr_metrics_counter(text, list, "httpsvr_accepted_connections_total", "counter",
+                                "Connections accepted.",
+                                offsetof(httpsvr_metrics_struct, accepted));
+        httpsvr_metrics_counter(text, list, "httpsvr_accept_errors_total", "counter",
+                                "Failed accepts, and connections dropped for lack of room.",
+                                offsetof(httpsvr_metrics_struct, accept_errors));
+        httpsvr_metrics_counter(text, list, "httpsvr_timeouts_total", "counter",
+                                "Connections closed for missing a deadline.",
+                                offsetof(httpsvr_metrics_struct, timeouts));
+        httpsvr_metrics_counter(text, list, "httpsvr_active_connections", "gauge",
+                                "Connections open now.",
+                                offsetof(httpsvr_metrics_struct, active_conns));
+        for (i = 0; i < HTTPSVR_NUM_PHASES; i++) {
+            httpsvr_metrics_hist(text, list, i);
+        }
+        if (text->data == NULL) {
+            free(text);
+            text = NULL;
+        }
+    }
+    
+    return text;
+}
+
+
+int httpsvr_metrics_stream(const char *page_name,
+                           const char *parameters,
+                           void **context,
+                           char *buffer,
+                           int buffer_len) {
+    int n = 0;
+    httpsvr_metrics_text_struct *text = *context;
+    
+    if (buffer == NULL) {
+        if (text != NULL) {
+            free(text->data);
+            free(text);
+            *context = NULL;
+        }
+    } else {
+        
+        /* a snapshot taken on the first call, then sent piece by piece */
+        if ((text == NULL) && (httpsvr_current_conn != NULL)) {
+            text = httpsvr_metrics_format(httpsvr_current_conn->hss);
+            *context = text;
+        }
+        if (text != NULL) {
+            n = text->len - text->pos;
+            if (n > buffer_len) {
+                n = buffer_len;
+            }
+            memcpy(buffer, &text->data[text->pos], n);
+            text->pos += n;
+        } else {
+            n = -1;
+        }
+    }
+    
+    return n;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_METRICS_H_
+#define HTTPSVR_METRICS_H_
+
+#include "httpsvr_internal.h"
+
+
+#define HTTPSVR_HIST_BUCKETS        48      /* two per power of two usec, to about 16 s */
+
+/* timed phases of a request */
+enum HTTPSVR_PHASES {
+    HTTPSVR_PHASE_PARSE         = 0,
+    HTTPSVR_PHASE_HANDLER       = 1,
+    HTTPSVR_PHASE_SEND          = 2,
+    HTTPSVR_NUM_PHASES          = 3,
+};
+
+
+/* log linear latency histogram, longer times only add to count */
+typedef struct {
+    unsigned long long buckets[HTTPSVR_HIST_BUCKETS];
+    unsigned long long count;
+    unsigned long long sum;         /* nsec */
+} httpsvr_hist_struct;
+
+/* one per worker and written by that worker alone, so updates need no
+   lock; readers sum all workers with relaxed loads */
+struct httpsvr_metrics_struct {
+    httpsvr_metrics_struct *next;
+    unsigned long long requests[HTTPSVR_NUM_RESP + 1];  /* + 1 for raw responses */
+    unsigned long long *route_requests;  /* by route id */
+    int     num_routes;
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long accepted;
+    unsigned long long accept_errors;
+    unsigned long long timeouts;
+    long long active_conns;
+    httpsvr_hist_struct phases[HTTPSVR_NUM_PHASES];
+};
+
+
+#define httpsvr_metrics_add(counter, n) \
+    __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+
+/* adds a block for the calling worker to the server's list, the block
+   lives as long as the server */
+httpsvr_metrics_struct *httpsvr_metrics_register(httpsvr_struct *hss);
+
+/* monotonic nsec */
+long long httpsvr_metrics_clock(void);
+
+void httpsvr_metrics_time(httpsvr_metrics_struct *metrics, int phase, long long nsec);
+
+/* counts a finished response by status and route */
+void httpsvr_metrics_request(httpsvr_conn_struct *conn);
+
+#endif  /* HTTPSVR_METRICS_H_ */
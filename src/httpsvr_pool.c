@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "httpsvr_pool.h"
+
+
+void httpsvr_arena_init(httpsvr_arena_struct *arena, int chunk_len) {
+    arena->chunks    = NULL;
+    arena->current   = NULL;
+    arena->chunk_len = chunk_len;
+    arena->last      = NULL;
+}
+
+
+void *httpsvr_arena_alloc(httpsvr_arena_struct *arena, int len) {
+    void *ptr = NULL;
+    httpsvr_arena_chunk_struct *chunk = arena->current;
+    httpsvr_arena_chunk_struct **link = NULL;
+    int n = 0;
+    
+    len = (len + HTTPSVR_ARENA_ALIGN - 1) & ~(HTTPSVR_ARENA_ALIGN - 1);
+    
+    /* first chunk from the current one on with room */
+    while ((chunk != NULL) && (chunk->max_len - chunk->len < len)) {
+        chunk = chunk->next;
+        if (chunk != NULL) {
+            chunk->len = 0;
+        }
+    }
+    
+    /* else a new one at the end, big enough for oversized requests */
+    if (chunk == NULL) {
+        n = (len > arena->chunk_len) ? len : arena->chunk_len;
+        chunk = malloc(sizeof(httpsvr_arena_chunk_struct) + n);
+        if (chunk != NULL) {
+            chunk->next    = NULL;
+            chunk->len     = 0;
+            chunk->max_len = n;
+            link = &arena->chunks;
+            while (*link != NULL) {
+                link = &(*link)->next;
+            }
+            *link = chunk;
+        }
+    }
+    if (chunk != NULL) {
+        arena->current = chunk;
+        ptr = &chunk->data[chunk->len];
+        chunk->len += len;
+        arena->last = ptr;
+    }
+    
+    return ptr;
+}
+
+
+void *httpsvr_arena_grow(httpsvr_arena_struct *arena, void *ptr, int len, int new_len) {
+    void *grown = NULL;
+    httpsvr_arena_chunk_struct *chunk = arena->current;
+    int n = 0;
+    
+    len     = (len + HTTPSVR_ARENA_ALIGN - 1) & ~(HTTPSVR_ARENA_ALIGN - 1);
+    new_len = (new_len + HTTPSVR_ARENA_ALIGN - 1) & ~(HTTPSVR_ARENA_ALIGN - 1);
+    if (ptr == NULL) {
+        grown = httpsvr_arena_alloc(arena, new_len);
+    } else if ((ptr == arena->last) && (chunk != NULL) &&
+               (chunk->max_len - chunk->len >= new_len - len)) {
+        
+        /* latest allocation, just move the end */
+        chunk->len += new_len - len;
+        grown = ptr;
+    } else {
+        grown = httpsvr_arena_alloc(arena, new_len);
+        if (grown != NULL) {
+            n = (len < new_len) ? len : new_len;
+            memcpy(grown, ptr, n);
+        }
+    }
+    
+    return grown;
+}
+
+
+char *httpsvr_arena_strndup(httpsvr_arena_struct *arena, const char *s, int len) {
+    char *copy = httpsvr_arena_alloc(arena, len + 1);
+    
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    
+    return copy;
+}
+
+
+void httpsvr_arena_reset(httpsvr_arena_struct *arena) {
+    arena->current = arena->chunks;
+    if (arena->current != NULL) {
+        arena->current->len = 0;
+    }
+    arena->last = NULL;
+}
+
+
+void httpsvr_arena_trim(httpsvr_arena_struct *arena) {
+    httpsvr_arena_chunk_struct *chunk = NULL;
+    
+    if (arena->chunks != NULL) {
+        while (arena->chunks->next != NULL) {
+            chunk = arena->chunks->next;
+            arena->chunks->next = chunk->next;
+            free(chunk);
+        }
+    }
+    httpsvr_arena_reset(arena);
+}
+
+
+void httpsvr_arena_free(httpsvr_arena_struct *arena) {
+    httpsvr_arena_chunk_struct *chunk = NULL;
+    
+    while (arena->chunks != NULL) {
+        chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+    httpsvr_arena_init(arena, arena->chunk_len);
+}
+
+
+void httpsvr_pool_init(httpsvr_pool_struct *pool, int block_len, int max_free) {
+    pool->free_list = NULL;
+    pool->block_len = block_len;
+    pool->num_free  = 0;
+    pool->max_free  = max_free;
+}
+
+
+void *httpsvr_pool_get(httpsvr_pool_struct *pool) {
+    void *block = pool->free_list;
+    
+    /* the free list links through the first word of each block */
+    if (block != NULL) {
+        pool->free_list = *(void **) block;
+        pool->num_free--;
+    } else {
+        block = malloc(pool->block_len);
+    }
+    
+    return block;
+}
+
+
+void httpsvr_pool_put(httpsvr_pool_struct *pool, void *block) {
+    if (block != NULL) {
+        if (pool->num_free < pool->max_free) {
+            *(void **) block = pool->free_list;
+            pool->free_list = block;
+            pool->num_free++;
+        } else {
+            free(block);
+        }
+    }
+}
+
+
+void httpsvr_pool_destroy(httpsvr_pool_struct *pool) {
+    void *block = NULL;
+    
+    while (pool->free_list != NULL) {
+        block = pool->free_list;
+        pool->free_list = *(void **) block;
+        free(block);
+    }
+    pool->num_free = 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_POOL_H_
+#define HTTPSVR_POOL_H_
+
+
+#define HTTPSVR_ARENA_ALIGN         8
+
+
+/* one block of an arena, allocations are carved from data */
+typedef struct httpsvr_arena_chunk_struct httpsvr_arena_chunk_struct;
+struct httpsvr_arena_chunk_struct {
+    httpsvr_arena_chunk_struct *next;
+    int     len;
+    int     max_len;
+    char    data[];
+};
+
+/* bump allocator, everything in it is released at once by a reset,
+   which keeps the chunks for reuse */
+typedef struct {
+    httpsvr_arena_chunk_struct *chunks;
+    httpsvr_arena_chunk_struct *current;
+    int     chunk_len;
+    char   *last;                   /* most recent allocation, can grow in place */
+} httpsvr_arena_struct;
+
+/* free list of equally sized blocks, for one thread */
+typedef struct {
+    void   *free_list;
+    int     block_len;
+    int     num_free;
+    int     max_free;
+} httpsvr_pool_struct;
+
+
+void  httpsvr_arena_init(httpsvr_arena_struct *arena, int chunk_len);
+
+void *httpsvr_arena_alloc(httpsvr_arena_struct *arena, int len);
+
+/* grows ptr, the latest allocation, in place when there is room,
+   otherwise copies it to a new allocation */
+void *httpsvr_arena_grow(httpsvr_arena_struct *arena, void *ptr, int len, int new_len);
+
+char *httpsvr_arena_strndup(httpsvr_arena_struct *arena, const char *s, int len);
+
+void  httpsvr_arena_reset(httpsvr_arena_struct *arena);
+
+/* reset and free all chunks but the first */
+void  httpsvr_arena_trim(httpsvr_arena_struct *arena);
+
+void  httpsvr_arena_free(httpsvr_arena_struct *arena);
+
+/* keeps up to max_free returned blocks of block_len bytes */
+void  httpsvr_pool_init(httpsvr_pool_struct *pool, int block_len, int max_free);
+
+void *httpsvr_pool_get(httpsvr_pool_struct *pool);
+
+void  httpsvr_pool_put(httpsvr_pool_struct *pool, void *block);
+
+void  httpsvr_pool_destroy(httpsvr_pool_struct *pool);
+
+#endif  /* HTTPSVR_POOL_H_ */
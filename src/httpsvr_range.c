@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "httpsvr_internal.h"
+
+
+int httpsvr_range_number(const char *s, int len, int *i, long long *n) {
+    int rc = 0;
+    int digits = 0;
+    
+    /* at most 18 digits, so it cannot overflow */
+    *n = 0;
+    while ((*i < len) && (s[*i] >= '0') && (s[*i] <= '9') && (digits < 18)) {
+        *n = (*n * 10) + (s[*i] - '0');
+        (*i)++;
+        digits++;
+    }
+    if ((digits > 0) && ((*i >= len) || (s[*i] < '0') || (s[*i] > '9'))) {
+        rc = 1;
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_range_parse(httpsvr_conn_struct *conn,
+                        const char *value,
+                        int value_len,
+                        long long size) {
+    int rc = 0;
+    int i = 6;
+    int specs = 0;
+    long long a = 0;
+    long long b = 0;
+    
+    /* "bytes=0-499, 1000-, -500", -1 if the header is to be ignored */
+    if ((value_len < 6) || (strncasecmp(value, "bytes=", 6) != 0)) {
+        rc = -1;
+    }
+    while ((rc >= 0) && (i < value_len)) {
+        while ((i < value_len) && ((value[i] == ' ') || (value[i] == ','))) {
+            i++;
+        }
+        if (i >= value_len) {
+            break;
+        }
+        specs++;
+        if (value[i] == '-') {
+            
+            /* suffix, the last b bytes */
+            i++;
+            if (!httpsvr_range_number(value, value_len, &i, &b)) {
+                rc = -1;
+            } else if ((b > 0) && (size > 0)) {
+                a = (b < size) ? (size - b) : 0;
+                b = size;
+            } else {
+                continue;  /* unsatisfiable */
+            }
+        } else if (httpsvr_range_number(value, value_len, &i, &a) &&
+                   (i < value_len) && (value[i] == '-')) {
+            i++;
+            if ((i < value_len) && (value[i] >= '0') && (value[i] <= '9')) {
+                if (!httpsvr_range_number(value, value_len, &i, &b) || (b < a)) {
+                    rc = -1;
+                }
+                b = (b < size) ? (b + 1) : size;
+            } else {
+                b = size;
+            }
+            if (a >= size) {
+                continue;  /* unsatisfiable */
+            }
+        } else {
+            rc = -1;
+        }
+        if (rc >= 0) {
+            if (rc >= HTTPSVR_MAX_RANGES) {
+                rc = -1;  /* too many, send it all */
+            } else {
+                conn->ranges[rc].start = a;
+                conn->ranges[rc].end   = b;
+                rc++;
+            }
+        }
+    }
+    if (specs == 0) {
+        rc = -1;
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_range_if(httpsvr_conn_struct *conn,
+                     long long size,
+                     long long mtime,
+                     long long ino) {
+    int rc = 1;
+    char etag[64];
+    const char *value = NULL;
+    int value_len = 0;
+    int etag_len = 0;
+    long long t = 0;
+    
+    /* If-Range takes a strong ETag or the exact Last-Modified date */
+    value = httpsvr_find_header(conn, "If-Range", &value_len);
+    if (value != NULL) {
+        if ((value_len > 0) && (value[0] == '"')) {
+            etag_len = httpsvr_format_etag(etag, size, mtime, ino);
+            rc = (value_len == etag_len) && (memcmp(value, etag, etag_len) == 0);
+        } else {
+            rc = httpsvr_parse_date(value, value_len, &t) && (t == mtime);
+        }
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_range_take_type(httpsvr_conn_struct *conn) {
+    char *s = &conn->send_data[conn->resp_length_pos];
+    int len = conn->send_data_len - conn->resp_length_pos;
+    int i = 0;
+    int n = 0;
+    int v = 0;
+    int e = 0;
+    
+    /* each part gets the handler's Content-Type, the whole response
+       gets multipart/byteranges instead */
+    strcpy(conn->range_type, "application/octet-stream");
+    while (i < len) {
+        n = i;
+        while ((n < len) && (s[n] != '\n')) {
+            n++;
+        }
+        if ((n - i > 13) && (strncasecmp(&s[i], "Content-Type:", 13) == 0)) {
+            v = i + 13;
+            while ((v < n) && (s[v] == ' ')) {
+                v++;
+            }
+            e = ((n > v) && (s[n - 1] == '\r')) ? (n - 1) : n;
+            if (e - v >= HTTPSVR_RANGE_TYPE_LEN) {
+                e = v + HTTPSVR_RANGE_TYPE_LEN - 1;
+            }
+            memcpy(conn->range_type, &s[v], e - v);
+            conn->range_type[e - v] = '\0';
+            if (n < len) {
+                n++;
+            }
+            memmove(&s[i], &s[n], len - n);
+            conn->send_data_len -= n - i;
+            conn->send_data[conn->send_data_len] = '\0';
+            break;
+        }
+        i = n + 1;
+    }
+}
+
+
+int httpsvr_range_head(httpsvr_conn_struct *conn,
+                       char *buffer,
+                       int buffer_len,
+                       httpsvr_range_struct *range) {
+    return snprintf(buffer, buffer_len,
+                    "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                    conn->range_boundary, conn->range_type,
+                    range->start, range->end - 1, conn->range_size);
+}
+
+
+int httpsvr_range_tail(httpsvr_conn_struct *conn,
+                       char *buffer,
+                       int buffer_len) {
+    return snprintf(buffer, buffer_len, "\r\n--%s--\r\n", conn->range_boundary);
+}
+
+
+long long httpsvr_range_start(httpsvr_conn_struct *conn,
+                              long long size,
+                              long long mtime,
+                              long long ino,
+                              long long *start,
+                              long long *end) {
+    long long rc = size;
+    long long parts_len = 0;
+    char s[96];
+    const char *value = NULL;
+    int value_len = 0;
+    int n = -1;
+    int i = 0;
+    
+    conn->ranges_len = 0;
+    conn->range_size = size;
+    
+    /* only GET has ranges, and only while If-Range still holds */
+    if (strcmp(conn->req_method, "GET") == 0) {
+        value = httpsvr_find_header(conn, "Range", &value_len);
+        if ((value != NULL) && httpsvr_range_if(conn, size, mtime, ino)) {
+            n = httpsvr_range_parse(conn, value, value_len, size);
+        }
+    }
+    
+    if (n == 0) {
+        conn->resp_status = HTTPSVR_RESP_BAD_RANGE;
+        sprintf(s, "bytes */%lld", size);
+        httpsvr_add_header(conn, "Content-Range", s);
+        *start = 0;
+        *end   = 0;
+        rc = 0;
+    } else if (n == 1) {
+        conn->resp_status = HTTPSVR_RESP_PARTIAL;
+        *start = conn->ranges[0].start;
+        *end   = conn->ranges[0].end;
+        sprintf(s, "bytes %lld-%lld/%lld", *start, *end - 1, size);
+        httpsvr_add_header(conn, "Content-Range", s);
+        rc = *end - *start;
+    } else if (n > 1) {
+        
+        /* parts are queued by httpsvr_range_queue behind the headers */
+        conn->resp_status = HTTPSVR_RESP_PARTIAL;
+        snprintf(conn->range_boundary, HTTPSVR_RANGE_BOUNDARY_LEN,
+                 "httpsvr-%llx-%llx", ino ^ size, mtime);
+        httpsvr_range_take_type(conn);
+        snprintf(s, sizeof(s), "multipart/byteranges; boundary=%s", conn->range_boundary);
+        parts_len = httpsvr_range_tail(conn, NULL, 0);
+        for (i = 0; i < n; i++) {
+            parts_len += httpsvr_range_head(conn, NULL, 0, &conn->ranges[i]);
+        }
+        
+        /* part headers that would not fit even a buffer of their own get
+           the whole file instead; behind earlier responses the batch
+           builds the response again into a fresh buffer */
+        if ((conn->resp_start == 0) &&
+            (sizeof("Content-Type: \r\n") + strlen(s) + parts_len >=
+             conn->send_data_max_len - conn->send_data_len)) {
+            conn->resp_status = HTTPSVR_RESP_OK;
+            httpsvr_add_header(conn, "Content-Type", conn->range_type);
+        } else {
+            httpsvr_add_header(conn, "Content-Type", s);
+            rc = parts_len;
+            for (i = 0; i < n; i++) {
+                rc += conn->ranges[i].end - conn->ranges[i].start;
+            }
+            conn->ranges_len = n;
+            *start = 0;
+            *end   = 0;
+        }
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_range_queue(httpsvr_conn_struct *conn,
+                         int fd,
+                         httpsvr_cache_entry_struct *entry) {
+    int i = 0;
+    int n = 0;
+    int max_len = 0;
+    char *s = NULL;
+    
+    /* each part header is built behind the response headers, followed
+       by its window of the file or cached copy */
+    for (i = 0; i <= conn->ranges_len; i++) {
+        s = &conn->send_data[conn->send_data_len];
+        max_len = conn->send_data_max_len - conn->send_data_len;
+        if (i < conn->ranges_len) {
+            n = httpsvr_range_head(conn, s, max_len, &conn->ranges[i]);
+        } else {
+            n = httpsvr_range_tail(conn, s, max_len);
+        }
+        
+        /* a full buffer has the response taken back, which only happens
+           behind earlier responses, see httpsvr_range_start */
+        if (n >= max_len) {
+            conn->send_data_len = conn->send_data_max_len;
+            break;
+        }
+        conn->send_data_len += n;
+        httpsvr_send_queue(conn, s, n);
+        if (i < conn->ranges_len) {
+            httpsvr_send_window(conn, fd, entry, conn->ranges[i].start, conn->ranges[i].end);
+        }
+    }
+    
+    /* the file is released once the closing boundary is written */
+    httpsvr_send_own(conn, fd, entry);
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "httpsvr_internal.h"
+#include "httpsvr_route.h"
+
+
+httpsvr_route_node_struct *httpsvr_route_node(httpsvr_arena_struct *arena,
+                                              const char *label,
+                                              int label_len) {
+    httpsvr_route_node_struct *node = httpsvr_arena_alloc(arena, sizeof(httpsvr_route_node_struct));
+    
+    if (node != NULL) {
+        memset(node, 0, sizeof(httpsvr_route_node_struct));
+        node->label = httpsvr_arena_strndup(arena, label, label_len);
+        if (node->label == NULL) {
+            node = NULL;
+        } else {
+            node->label_len = label_len;
+        }
+    }
+    
+    return node;
+}
+
+
+httpsvr_route_node_struct *httpsvr_route_create(httpsvr_arena_struct *arena) {
+    return httpsvr_route_node(arena, "", 0);
+}
+
+
+int httpsvr_route_split(httpsvr_arena_struct *arena,
+                        httpsvr_route_node_struct *node,
+                        int k) {
+    int rc = -1;
+    
+    /* the label past k moves down into a new only child */
+    httpsvr_route_node_struct *tail = httpsvr_route_node(arena,
+                                                         &node->label[k],
+                                                         node->label_len - k);
+    if (tail != NULL) {
+        tail->child  = node->child;
+        tail->param  = node->param;
+        tail->routes = node->routes;
+        tail->mounts = node->mounts;
+        node->child  = tail;
+        node->param  = NULL;
+        node->routes = NULL;
+        node->mounts = NULL;
+        node->label[k]  = '\0';
+        node->label_len = k;
+        rc = 0;
+    }
+    
+    return rc;
+}
+
+
+httpsvr_route_node_struct *httpsvr_route_insert_text(httpsvr_arena_struct *arena,
+                                                     httpsvr_route_node_struct *node,
+                                                     const char *text,
+                                                     int text_len) {
+    httpsvr_route_node_struct *c = NULL;
+    int k = 0;
+    
+    while ((node != NULL) && (text_len > 0)) {
+        
+        /* at most one static child starts with each character */
+        c = node->child;
+        while ((c != NULL) && (c->label[0] != text[0])) {
+            c = c->next;
+        }
+        if (c == NULL) {
+            c = httpsvr_route_node(arena, text, text_len);
+            if (c != NULL) {
+                c->next = node->child;
+                node->child = c;
+            }
+            node = c;
+            text_len = 0;
+        } else {
+            k = 0;
+            while ((k < c->label_len) && (k < text_len) && (c->label[k] == text[k])) {
+                k++;
+            }
+            if ((k < c->label_len) && (httpsvr_route_split(arena, c, k) != 0)) {
+                node = NULL;
+            } else {
+                node = c;
+                text += k;
+                text_len -= k;
+            }
+        }
+    }
+    
+    return node;
+}
+
+
+int httpsvr_route_add(httpsvr_arena_struct *arena,
+                      httpsvr_route_struct **list,
+                      const char *method,
+                      const char *pattern,
+                      httpsvr_route_handler handler,
+                      int *num_routes) {
+    int rc = -1;
+    httpsvr_route_struct *route = *list;
+    
+    /* replace the handler of an existing method */
+    while ((route != NULL) &&
+           !((method == NULL) && (route->method == NULL)) &&
+           !((method != NULL) && (route->method != NULL) &&
+             (strcmp(method, route->method) == 0))) {
+        route = route->next;
+    }
+    if (route != NULL) {
+        route->handler = handler;
+        rc = 0;
+    } else {
+        route = httpsvr_arena_alloc(arena, sizeof(httpsvr_route_struct));
+        if (route != NULL) {
+            route->method = NULL;
+            if (method != NULL) {
+                route->method = httpsvr_arena_strndup(arena, method, strlen(method));
+            }
+            route->pattern = httpsvr_arena_strndup(arena, pattern, strlen(pattern));
+            if (((method == NULL) || (route->method != NULL)) && (route->pattern != NULL)) {
+                route->id = (*num_routes)++;
+                route->handler = handler;
+                route->next = *list;
+                *list = route;
+                rc = 0;
+            }
+        }
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_route_insert(httpsvr_arena_struct *arena,
+                         httpsvr_route_node_struct *root,
+                         const char *method,
+                         const char *pattern,
+                         httpsvr_route_handler handler,
+                         int *num_routes) {
+    int rc = -1;
+    int num_params = 0;
+    int n = 0;
+    httpsvr_route_node_struct *node = root;
+    const char *s = pattern;
+    
+    if ((root != NULL) && (pattern != NULL) && (pattern[0] == '/') && (handler != NULL)) {
+        while ((node != NULL) && (*s != '\0') && (*s != '*')) {
+            if (*s == ':') {
+                
+                /* a named segment, all routes must agree on its name */
+                n = strcspn(s + 1, "/");
+                if ((n == 0) || (num_params >= HTTPSVR_MAX_ROUTE_PARAMS)) {
+                    node = NULL;
+                } else if (node->param == NULL) {
+                    node->param = httpsvr_route_node(arena, s + 1, n);
+                    node = node->param;
+                } else if ((node->param->label_len == n) &&
+                           (strncmp(node->param->label, s + 1, n) == 0)) {
+                    node = node->param;
+                } else {
+                    node = NULL;
+                }
+                num_params++;
+                s += n + 1;
+            } else {
+                n = strcspn(s, ":*");
+                node = httpsvr_route_insert_text(arena, node, s, n);
+                s += n;
+            }
+        }
+        if (node != NULL) {
+            if (*s != '*') {
+                rc = httpsvr_route_add(arena, &node->routes, method, pattern, handler, num_routes);
+            } else if ((s[1] == '\0') && (num_params < HTTPSVR_MAX_ROUTE_PARAMS)) {
+                rc = httpsvr_route_add(arena, &node->mounts, method, pattern, handler, num_routes);
+            }
+        }
+    }
+    
+    return rc;
+}
+
+
+httpsvr_route_struct *httpsvr_route_method(httpsvr_route_struct *list,
+                                           const char *method) {
+    httpsvr_route_struct *route = list;
+    httpsvr_route_struct *get = NULL;
+    httpsvr_route_struct *any = NULL;
+    int head = (strcmp(method, "HEAD") == 0);
+    
+    /* exact method, then GET for HEAD, then any method */
+    while (route != NULL) {
+        if (route->method == NULL) {
+            any = route;
+        } else if (strcmp(route->method, method) == 0) {
+            break;
+        } else if (head && (strcmp(route->method, "GET") == 0)) {
+            get = route;
+        }
+        route = route->next;
+    }
+    if (route == NULL) {
+        route = (get != NULL) ? get : any;
+    }
+    
+    return route;
+}
+
+
+httpsvr_route_struct *httpsvr_route_walk(httpsvr_route_node_struct *node,
+                                         const char *method,
+                                         const char *path,
+                                         httpsvr_route_param *params,
+                                         int n,
+                                         int *num_params) {
+    httpsvr_route_struct *route = NULL;
+    httpsvr_route_node_struct *c = NULL;
+    int len = 0;
+    
+    if (*path == '\0') {
+        route = httpsvr_route_method(node->routes, method);
+        if (route != NULL) {
+            *num_params = n;
+        }
+    } else {
+        
+        /* exact text first */
+        c = node->child;
+        while ((c != NULL) && (c->label[0] != path[0])) {
+            c = c->next;
+        }
+        if ((c != NULL) && (strncmp(path, c->label, c->label_len) == 0)) {
+            route = httpsvr_route_walk(c, method, &path[c->label_len],
+                                       params, n, num_params);
+        }
+        
+        /* then a named segment */
+        if ((route == NULL) && (node->param != NULL) && (path[0] != '/') &&
+            (n < HTTPSVR_MAX_ROUTE_PARAMS)) {
+            len = strcspn(path, "/");
+            params[n].name      = node->param->label;
+            params[n].name_len  = node->param->label_len;
+            params[n].value     = path;
+            params[n].value_len = len;
+            route = httpsvr_route_walk(node->param, method, &path[len],
+                                       params, n + 1, num_params);
+        }
+    }
+    
+    /* last a mount taking whatever is left */
+    if ((route == NULL) && (n < HTTPSVR_MAX_ROUTE_PARAMS)) {
+        route = httpsvr_route_method(node->mounts, method);
+        if (route != NULL) {
+            params[n].name      = HTTPSVR_WILDCARD;
+            params[n].name_len  = 1;
+            params[n].value     = path;
+            params[n].value_len = strlen(path);
+            *num_params = n + 1;
+        }
+    }
+    
+    return route;
+}
+
+
+httpsvr_route_struct *httpsvr_route_match(httpsvr_route_node_struct *root,
+                                          const char *method,
+                                          const char *path,
+                                          httpsvr_route_param *params,
+                                          int *num_params) {
+    httpsvr_route_struct *route = NULL;
+    
+    *num_params = 0;
+    if ((root != NULL) && (method != NULL) && (path != NULL)) {
+        route = httpsvr_route_walk(root, method, path, params, 0, num_params);
+    }
+    
+    return route;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_ROUTE_H_
+#define HTTPSVR_ROUTE_H_
+
+#include "httpsvr_internal.h"
+
+
+/* one handler at a route node, method NULL matches any method */
+typedef struct httpsvr_route_struct httpsvr_route_struct;
+struct httpsvr_route_struct {
+    httpsvr_route_struct *next;
+    char   *method;
+    char   *pattern;
+    int     id;                     /* 0 up, in the order routes were added */
+    httpsvr_route_handler handler;
+};
+
+/* compressed radix tree node, static children are keyed by the first
+   character of their label, a ":name" child matches one path segment */
+struct httpsvr_route_node_struct {
+    char   *label;
+    int     label_len;
+    httpsvr_route_node_struct *child;
+    httpsvr_route_node_struct *next;
+    httpsvr_route_node_struct *param;
+    httpsvr_route_struct *routes;   /* path ends at this node */
+    httpsvr_route_struct *mounts;   /* any rest of the path */
+};
+
+
+/* nodes and labels are allocated from arena and live as long as it */
+httpsvr_route_node_struct *httpsvr_route_create(httpsvr_arena_struct *arena);
+
+/* a new route takes id *num_routes, which is then incremented */
+int  httpsvr_route_insert(httpsvr_arena_struct *arena,
+                          httpsvr_route_node_struct *root,
+                          const char *method,
+                          const char *pattern,
+                          httpsvr_route_handler handler,
+                          int *num_routes);
+
+/* fills params with the captured segments, which point into path */
+httpsvr_route_struct *httpsvr_route_match(httpsvr_route_node_struct *root,
+                                          const char *method,
+                                          const char *path,
+                                          httpsvr_route_param *params,
+                                          int *num_params);
+
+#endif  /* HTTPSVR_ROUTE_H_ */
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#  define HTTPSVR_SCAN_X86
+#  include <immintrin.h>
+#endif
+
+#include "httpsvr_scan.h"
+
+
+httpsvr_scan_set httpsvr_scan_request_line;
+httpsvr_scan_set httpsvr_scan_header_line;
+httpsvr_scan_set httpsvr_scan_line_end;
+
+
+int httpsvr_scan_scalar(const httpsvr_scan_set *set, const char *data, int len) {
+    int i = 0;
+    
+    while ((i < len) && !set->member[(unsigned char) data[i]]) {
+        i++;
+    }
+    
+    return i;
+}
+
+
+#if defined (HTTPSVR_SCAN_X86)
+
+/* 16 bytes at a time, pcmpestri matches against the whole set */
+__attribute__((target("sse4.2")))
+int httpsvr_scan_sse42(const httpsvr_scan_set *set, const char *data, int len) {
+    __m128i chars = _mm_loadu_si128((const __m128i *) set->chars);
+    __m128i block;
+    int i = 0;
+    int n = 0;
+    
+    for (i = 0; i + 16 <= len; i += 16) {
+        block = _mm_loadu_si128((const __m128i *) &data[i]);
+        n = _mm_cmpestri(chars, set->len, block, 16,
+                         _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (n < 16) {
+            return i + n;
+        }
+    }
+    
+    return i + httpsvr_scan_scalar(set, &data[i], len - i);
+}
+
+
+/* 32 bytes at a time, one compare per delimiter */
+__attribute__((target("avx2")))
+int httpsvr_scan_avx2(const httpsvr_scan_set *set, const char *data, int len) {
+    __m256i chars[HTTPSVR_SCAN_MAX_SET];
+    __m256i block;
+    __m256i hits;
+    unsigned int mask = 0;
+    int i = 0;
+    int k = 0;
+    
+    for (k = 0; k < set->len; k++) {
+        chars[k] = _mm256_set1_epi8(set->chars[k]);
+    }
+    for (i = 0; i + 32 <= len; i += 32) {
+        block = _mm256_loadu_si256((const __m256i *) &data[i]);
+        hits  = _mm256_cmpeq_epi8(block, chars[0]);
+        for (k = 1; k < set->len; k++) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, chars[k]));
+        }
+        mask = _mm256_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    
+    /* header lines are short, so most scans end in the tail */
+    if (i + 16 <= len) {
+        __m128i half = _mm_loadu_si128((const __m128i *) &data[i]);
+        __m128i half_hits = _mm_cmpeq_epi8(half, _mm256_castsi256_si128(chars[0]));
+        for (k = 1; k < set->len; k++) {
+            half_hits = _mm_or_si128(half_hits, _mm_cmpeq_epi8(half, _mm256_castsi256_si128(chars[k])));
+        }
+        mask = _mm_movemask_epi8(half_hits);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+    
+    return i + httpsvr_scan_scalar(set, &data[i], len - i);
+}
+
+#endif  /* HTTPSVR_SCAN_X86 */
+
+
+typedef int (*httpsvr_scan_func)(const httpsvr_scan_set *set, const char *data, int len);
+
+httpsvr_scan_func httpsvr_scan_impl = httpsvr_scan_scalar;
+const char *httpsvr_scan_impl_name = "scalar";
+
+
+void httpsvr_scan_set_init(httpsvr_scan_set *set, const char *chars) {
+    int i = 0;
+    
+    memset(set, 0, sizeof(httpsvr_scan_set));
+    set->len = strlen(chars);
+    if (set->len > HTTPSVR_SCAN_MAX_SET) {
+        set->len = HTTPSVR_SCAN_MAX_SET;
+    }
+    memcpy(set->chars, chars, set->len);
+    for (i = 0; i < set->len; i++) {
+        set->member[(unsigned char) chars[i]] = 1;
+    }
+}
+
+
+int httpsvr_scan_use(const char *name) {
+    int rc = -1;
+    
+    if (strcmp(name, "scalar") == 0) {
+        httpsvr_scan_impl = httpsvr_scan_scalar;
+        httpsvr_scan_impl_name = "scalar";
+        rc = 0;
+#if defined (HTTPSVR_SCAN_X86)
+    } else if ((strcmp(name, "sse4.2") == 0) && __builtin_cpu_supports("sse4.2")) {
+        httpsvr_scan_impl = httpsvr_scan_sse42;
+        httpsvr_scan_impl_name = "sse4.2";
+        rc = 0;
+    } else if ((strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        httpsvr_scan_impl = httpsvr_scan_avx2;
+        httpsvr_scan_impl_name = "avx2";
+        rc = 0;
+#endif
+    }
+    
+    return rc;
+}
+
+
+const char *httpsvr_scan_name(void) {
+    return httpsvr_scan_impl_name;
+}
+
+
+void httpsvr_scan_init(void) {
+    
+    /* the spaces, '?', '.' and '~' of a request line are found in the
+       same pass as its end, as is the colon of a header line */
+    httpsvr_scan_set_init(&httpsvr_scan_request_line, " ?.~\n");
+    httpsvr_scan_set_init(&httpsvr_scan_header_line, ":\n");
+    httpsvr_scan_set_init(&httpsvr_scan_line_end, "\n");
+    
+#if defined (HTTPSVR_SCAN_X86)
+    __builtin_cpu_init();
+#endif
+    
+    /* on header sized lines pcmpestri beats avx2, whose wider loads
+       only pay off past a few cache lines, see bench/scanbench */
+    if (httpsvr_scan_use("sse4.2") != 0) {
+        if (httpsvr_scan_use("avx2") != 0) {
+            httpsvr_scan_use("scalar");
+        }
+    }
+}
+
+
+int httpsvr_scan(const httpsvr_scan_set *set, const char *data, int len) {
+    return httpsvr_scan_impl(set, data, len);
+}
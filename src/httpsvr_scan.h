@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_SCAN_H_
+#define HTTPSVR_SCAN_H_
+
+
+#define HTTPSVR_SCAN_MAX_SET    16
+
+
+/* a set of delimiter bytes to scan for, prepared once for every
+   scanner so the hot path does no setup */
+typedef struct {
+    char    chars[HTTPSVR_SCAN_MAX_SET];
+    int     len;
+    unsigned char member[256];
+} httpsvr_scan_set;
+
+
+/* delimiters of the request line, of header lines and of any line */
+extern httpsvr_scan_set httpsvr_scan_request_line;
+extern httpsvr_scan_set httpsvr_scan_header_line;
+extern httpsvr_scan_set httpsvr_scan_line_end;
+
+
+/* prepares the sets and picks the fastest scanner the cpu runs */
+void httpsvr_scan_init(void);
+
+void httpsvr_scan_set_init(httpsvr_scan_set *set, const char *chars);
+
+/* forces a scanner, "avx2", "sse4.2" or "scalar", returns -1 if the
+   cpu or the build lacks it */
+int  httpsvr_scan_use(const char *name);
+
+const char *httpsvr_scan_name(void);
+
+/* offset of the first byte of data in set, or len if there is none */
+int  httpsvr_scan(const httpsvr_scan_set *set, const char *data, int len);
+
+#endif  /* HTTPSVR_SCAN_H_ */
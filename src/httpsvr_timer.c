@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "httpsvr_timer.h"
+
+
+void httpsvr_wheel_init(httpsvr_wheel_struct *wheel, long long now) {
+    int level = 0;
+    int i = 0;
+    
+    /* each slot is the head of a circular list */
+    for (level = 0; level < HTTPSVR_WHEEL_LEVELS; level++) {
+        for (i = 0; i < HTTPSVR_WHEEL_SLOTS; i++) {
+            wheel->slots[level][i].prev = &wheel->slots[level][i];
+            wheel->slots[level][i].next = &wheel->slots[level][i];
+        }
+    }
+    wheel->next  = now / HTTPSVR_TIMER_TICK;
+    wheel->count = 0;
+}
+
+
+void httpsvr_wheel_insert(httpsvr_wheel_struct *wheel, httpsvr_timer_struct *timer) {
+    httpsvr_timer_struct *slot = NULL;
+    long long delta = 0;
+    int level = 0;
+    
+    /* the lowest level whose turn reaches the tick */
+    if (timer->expires < wheel->next) {
+        timer->expires = wheel->next;
+    }
+    delta = timer->expires - wheel->next;
+    while ((level < HTTPSVR_WHEEL_LEVELS - 1) &&
+           (delta >= (1LL << (HTTPSVR_WHEEL_BITS * (level + 1))))) {
+        level++;
+    }
+    if (delta >= (1LL << (HTTPSVR_WHEEL_BITS * HTTPSVR_WHEEL_LEVELS))) {
+        timer->expires = wheel->next + (1LL << (HTTPSVR_WHEEL_BITS * HTTPSVR_WHEEL_LEVELS)) - 1;
+    }
+    slot = &wheel->slots[level][(timer->expires >> (HTTPSVR_WHEEL_BITS * level)) &
+                                (HTTPSVR_WHEEL_SLOTS - 1)];
+    timer->next = slot;
+    timer->prev = slot->prev;
+    slot->prev->next = timer;
+    slot->prev = timer;
+}
+
+
+void httpsvr_timer_set(httpsvr_wheel_struct *wheel,
+                       httpsvr_timer_struct *timer,
+                       long long expires) {
+    httpsvr_timer_cancel(wheel, timer);
+    timer->expires = (expires + HTTPSVR_TIMER_TICK - 1) / HTTPSVR_TIMER_TICK;
+    httpsvr_wheel_insert(wheel, timer);
+    wheel->count++;
+}
+
+
+void httpsvr_timer_cancel(httpsvr_wheel_struct *wheel,
+                          httpsvr_timer_struct *timer) {
+    
+    /* an expired timer keeps next, it links the expired list */
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = NULL;
+        timer->next = NULL;
+        wheel->count--;
+    }
+}
+
+
+void httpsvr_wheel_cascade(httpsvr_wheel_struct *wheel, int level, int i) {
+    httpsvr_timer_struct *slot = &wheel->slots[level][i];
+    httpsvr_timer_struct *timer = slot->next;
+    httpsvr_timer_struct *next = NULL;
+    
+    /* empty the slot first, its timers all land on lower levels */
+    slot->prev = slot;
+    slot->next = slot;
+    while (timer != slot) {
+        next = timer->next;
+        httpsvr_wheel_insert(wheel, timer);
+        timer = next;
+    }
+}
+
+
+httpsvr_timer_struct *httpsvr_wheel_advance(httpsvr_wheel_struct *wheel, long long now) {
+    httpsvr_timer_struct *expired = NULL;
+    httpsvr_timer_struct *timer = NULL;
+    httpsvr_timer_struct *slot = NULL;
+    long long tick = now / HTTPSVR_TIMER_TICK;
+    int level = 0;
+    int i = 0;
+    
+    /* nothing pending, nothing to step through */
+    if (wheel->count == 0) {
+        if (tick >= wheel->next) {
+            wheel->next = tick + 1;
+        }
+    }
+    while (wheel->next <= tick) {
+        
+        /* at the start of a turn, bring down the next slot above */
+        i = wheel->next & (HTTPSVR_WHEEL_SLOTS - 1);
+        for (level = 1; (i == 0) && (level < HTTPSVR_WHEEL_LEVELS); level++) {
+            i = (wheel->next >> (HTTPSVR_WHEEL_BITS * level)) & (HTTPSVR_WHEEL_SLOTS - 1);
+            httpsvr_wheel_cascade(wheel, level, i);
+        }
+        
+        slot = &wheel->slots[0][wheel->next & (HTTPSVR_WHEEL_SLOTS - 1)];
+        while (slot->next != slot) {
+            timer = slot->next;
+            httpsvr_timer_cancel(wheel, timer);
+            timer->next = expired;
+            expired = timer;
+        }
+        wheel->next++;
+    }
+    
+    return expired;
+}
+
+
+int httpsvr_wheel_timeout(httpsvr_wheel_struct *wheel, long long now, int max_wait) {
+    long long tick = wheel->next;
+    long long wait = max_wait;
+    int i = 0;
+    
+    /* the next level 0 slot with timers, or the next cascade */
+    if (wheel->count > 0) {
+        for (i = 0; i < HTTPSVR_WHEEL_SLOTS; i++, tick++) {
+            if (((i > 0) && ((tick & (HTTPSVR_WHEEL_SLOTS - 1)) == 0)) ||
+                (wheel->slots[0][tick & (HTTPSVR_WHEEL_SLOTS - 1)].next !=
+                 &wheel->slots[0][tick & (HTTPSVR_WHEEL_SLOTS - 1)])) {
+                break;
+            }
+        }
+        wait = tick * HTTPSVR_TIMER_TICK - now;
+        if (wait < 0) {
+            wait = 0;
+        } else if (wait > max_wait) {
+            wait = max_wait;
+        }
+    }
+    
+    return (int) wait;
+}
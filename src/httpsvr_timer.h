@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_TIMER_H_
+#define HTTPSVR_TIMER_H_
+
+
+#define HTTPSVR_TIMER_TICK          10      /* msec */
+#define HTTPSVR_WHEEL_BITS          6
+#define HTTPSVR_WHEEL_SLOTS         (1 << HTTPSVR_WHEEL_BITS)
+#define HTTPSVR_WHEEL_LEVELS        4       /* 64^4 ticks, about 46 hours */
+
+
+/* a deadline, linked into one slot of the wheel while pending */
+typedef struct httpsvr_timer_struct httpsvr_timer_struct;
+struct httpsvr_timer_struct {
+    httpsvr_timer_struct *prev;     /* NULL when not pending */
+    httpsvr_timer_struct *next;
+    long long expires;              /* tick */
+    void   *data;
+};
+
+/* hierarchical timing wheel for one thread: level 0 has a slot per
+   tick, each level above a slot per whole turn of the one below, whose
+   timers move down a level as their turn comes up */
+typedef struct {
+    httpsvr_timer_struct slots[HTTPSVR_WHEEL_LEVELS][HTTPSVR_WHEEL_SLOTS];
+    long long next;                 /* first tick not yet run */
+    int     count;
+} httpsvr_wheel_struct;
+
+
+void httpsvr_wheel_init(httpsvr_wheel_struct *wheel, long long now);
+
+/* (re)arms timer to expire at msec, later than the wheel can hold is
+   clamped */
+void httpsvr_timer_set(httpsvr_wheel_struct *wheel,
+                       httpsvr_timer_struct *timer,
+                       long long expires);
+
+void httpsvr_timer_cancel(httpsvr_wheel_struct *wheel,
+                          httpsvr_timer_struct *timer);
+
+/* runs the ticks up to now msec, returns the timers that expired linked
+   by next, already cancelled */
+httpsvr_timer_struct *httpsvr_wheel_advance(httpsvr_wheel_struct *wheel, long long now);
+
+/* msec from now until the wheel next has work, at most max_wait */
+int  httpsvr_wheel_timeout(httpsvr_wheel_struct *wheel, long long now, int max_wait);
+
+#endif  /* HTTPSVR_TIMER_H_ */
@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if !defined (HTTPSVR_NO_ZLIB)
+#  include <zlib.h>
+#endif
+
+#include "httpsvr_internal.h"
+#include "httpsvr_zip.h"
+
+
+#define HTTPSVR_ZIP_VARY            "Vary: Accept-Encoding\r\n"
+
+/* per worker thread, so compressing never takes a lock */
+#if !defined (HTTPSVR_NO_ZLIB)
+HTTPSVR_THREAD_LOCAL z_stream httpsvr_zip_streams[2];
+HTTPSVR_THREAD_LOCAL int httpsvr_zip_levels[2];  /* level + 1 once set up */
+#endif
+HTTPSVR_THREAD_LOCAL char *httpsvr_zip_scratch = NULL;
+HTTPSVR_THREAD_LOCAL int httpsvr_zip_scratch_len = 0;
+
+
+httpsvr_zip_cache_struct *httpsvr_zip_cache_create(long long max_bytes) {
+    httpsvr_zip_cache_struct *cache = NULL;
+    cache = calloc(1, sizeof(httpsvr_zip_cache_struct));
+    
+    if (cache != NULL) {
+        cache->bytes     = 0;
+        cache->max_bytes = max_bytes;
+        if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+            free(cache);
+            cache = NULL;
+        }
+    }
+    
+    return cache;
+}
+
+
+void httpsvr_zip_cache_destroy(httpsvr_zip_cache_struct *cache) {
+    int i = 0;
+    
+    if (cache != NULL) {
+        for (i = 0; i < HTTPSVR_ZIP_CACHE_SLOTS; i++) {
+            if (cache->slots[i].data != NULL) {
+                free(cache->slots[i].data);
+            }
+        }
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+    }
+}
+
+
+int httpsvr_zip_cache_lookup(httpsvr_zip_cache_struct *cache,
+                             unsigned int hash,
+                             int coding,
+                             const char *data,
+                             int len,
+                             char *out) {
+    int rc = -1;
+    httpsvr_zip_entry_struct *entry = NULL;
+    
+    /* the same body as last time gets the same compressed bytes */
+    if (cache != NULL) {
+        pthread_mutex_lock(&cache->lock);
+        entry = &cache->slots[hash % HTTPSVR_ZIP_CACHE_SLOTS];
+        if ((entry->data    != NULL) &&
+            (entry->hash    == hash) &&
+            (entry->coding  == coding) &&
+            (entry->raw_len == len) &&
+            (memcmp(entry->data, data, len) == 0)) {
+            memcpy(out, &entry->data[len], entry->zip_len);
+            rc = entry->zip_len;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_zip_cache_insert(httpsvr_zip_cache_struct *cache,
+                              unsigned int hash,
+                              int coding,
+                              const char *data,
+                              int len,
+                              const char *zip,
+                              int zip_len) {
+    httpsvr_zip_entry_struct *entry = NULL;
+    char *copy = NULL;
+    
+    if (cache != NULL) {
+        copy = malloc(len + zip_len);
+        if (copy != NULL) {
+            memcpy(copy, data, len);
+            memcpy(&copy[len], zip, zip_len);
+            pthread_mutex_lock(&cache->lock);
+            
+            /* each slot holds the latest body hashed to it */
+            entry = &cache->slots[hash % HTTPSVR_ZIP_CACHE_SLOTS];
+            if (entry->data != NULL) {
+                cache->bytes -= entry->raw_len + entry->zip_len;
+                free(entry->data);
+                entry->data = NULL;
+            }
+            if (cache->bytes + len + zip_len <= cache->max_bytes) {
+                entry->hash    = hash;
+                entry->coding  = coding;
+                entry->raw_len = len;
+                entry->zip_len = zip_len;
+                entry->data    = copy;
+                cache->bytes  += len + zip_len;
+                copy = NULL;
+            }
+            pthread_mutex_unlock(&cache->lock);
+            if (copy != NULL) {
+                free(copy);
+            }
+        }
+    }
+}
+
+
+int httpsvr_zip_deflate(int coding, int level, const char *data, int len, char *out, int out_len) {
+    int rc = -1;
+#if !defined (HTTPSVR_NO_ZLIB)
+    int i = (coding == HTTPSVR_ZIP_GZIP) ? 0 : 1;
+    z_stream *zs = &httpsvr_zip_streams[i];
+    
+    /* gzip or zlib wrapper around the same deflate stream */
+    if ((httpsvr_zip_levels[i] != 0) && (httpsvr_zip_levels[i] != level + 1)) {
+        deflateEnd(zs);
+        httpsvr_zip_levels[i] = 0;
+    }
+    if (httpsvr_zip_levels[i] == 0) {
+        memset(zs, 0, sizeof(z_stream));
+        if (deflateInit2(zs, level, Z_DEFLATED, (i == 0) ? 31 : 15,
+                         8, Z_DEFAULT_STRATEGY) == Z_OK) {
+            httpsvr_zip_levels[i] = level + 1;
+        }
+    } else {
+        deflateReset(zs);
+    }
+    if (httpsvr_zip_levels[i] != 0) {
+        zs->next_in   = (Bytef *) data;
+        zs->avail_in  = len;
+        zs->next_out  = (Bytef *) out;
+        zs->avail_out = out_len;
+        if (deflate(zs, Z_FINISH) == Z_STREAM_END) {
+            rc = out_len - zs->avail_out;
+        }
+    }
+#endif
+    
+    return rc;
+}
+
+
+void httpsvr_zip_thread_end(void) {
+#if !defined (HTTPSVR_NO_ZLIB)
+    int i = 0;
+    
+    for (i = 0; i < 2; i++) {
+        if (httpsvr_zip_levels[i] != 0) {
+            deflateEnd(&httpsvr_zip_streams[i]);
+            httpsvr_zip_levels[i] = 0;
+        }
+    }
+#endif
+    free(httpsvr_zip_scratch);
+    httpsvr_zip_scratch     = NULL;
+    httpsvr_zip_scratch_len = 0;
+}
+
+
+int httpsvr_zip_body(httpsvr_struct *hss, int coding, const char *data, int len) {
+    int rc = -1;
+    unsigned int hash = 2166136261u;  /* FNV-1a */
+    char *scratch = NULL;
+    int n = len + (len / 1000) + 64;  /* past the deflate bound */
+    int i = 0;
+    
+    /* compressed bytes go to the thread's scratch buffer */
+    if (httpsvr_zip_scratch_len < n) {
+        scratch = realloc(httpsvr_zip_scratch, n);
+        if (scratch != NULL) {
+            httpsvr_zip_scratch     = scratch;
+            httpsvr_zip_scratch_len = n;
+        }
+    }
+    if (httpsvr_zip_scratch_len >= n) {
+        for (i = 0; i < len; i++) {
+            hash ^= (unsigned char) data[i];
+            hash *= 16777619u;
+        }
+        rc = httpsvr_zip_cache_lookup(hss->zip_cache, hash, coding, data, len,
+                                      httpsvr_zip_scratch);
+        if (rc < 0) {
+            rc = httpsvr_zip_deflate(coding, hss->deflate_level, data, len,
+                                     httpsvr_zip_scratch, n);
+            if (rc > 0) {
+                httpsvr_zip_cache_insert(hss->zip_cache, hash, coding, data, len,
+                                         httpsvr_zip_scratch, rc);
+            }
+        }
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_zip_accepts(httpsvr_conn_struct *conn) {
+    int accepted = HTTPSVR_ZIP_NONE;
+    int refused = HTTPSVR_ZIP_NONE;
+    int coding = HTTPSVR_ZIP_NONE;
+    const char *value = NULL;
+    int len = 0;
+    int i = 0;
+    int n = 0;
+    int q = 0;
+    
+    /* "gzip, deflate;q=0.5, *;q=0" */
+    value = httpsvr_find_header(conn, "Accept-Encoding", &len);
+    while ((value != NULL) && (i < len)) {
+        while ((i < len) && ((value[i] == ' ') || (value[i] == ','))) {
+            i++;
+        }
+        n = i;
+        while ((n < len) && (value[n] != ',') && (value[n] != ';') && (value[n] != ' ')) {
+            n++;
+        }
+        coding = HTTPSVR_ZIP_NONE;
+        if (((n - i == 4) && (strncasecmp(&value[i], "gzip", 4) == 0)) ||
+            ((n - i == 6) && (strncasecmp(&value[i], "x-gzip", 6) == 0))) {
+            coding = HTTPSVR_ZIP_GZIP;
+        } else if ((n - i == 7) && (strncasecmp(&value[i], "deflate", 7) == 0)) {
+            coding = HTTPSVR_ZIP_DEFLATE;
+        } else if ((n - i == 1) && (value[i] == '*')) {
+            coding = HTTPSVR_ZIP_GZIP | HTTPSVR_ZIP_DEFLATE;
+        }
+        
+        /* a q value of zero refuses the coding */
+        q = 1;
+        while ((n < len) && (value[n] != ',')) {
+            if ((len - n > 3) && (value[n] == ';') && (strncasecmp(&value[n + 1], "q=", 2) == 0)) {
+                n += 3;
+                q = 0;
+                while ((n < len) && (value[n] != ',') && (value[n] != ' ') && (value[n] != ';')) {
+                    if ((value[n] >= '1') && (value[n] <= '9')) {
+                        q = 1;
+                    }
+                    n++;
+                }
+            } else {
+                n++;
+            }
+        }
+        if (q) {
+            accepted |= coding;
+        } else {
+            refused |= coding;
+        }
+        i = n;
+    }
+    
+    return accepted & ~refused;
+}
+
+
+const char *httpsvr_zip_header(const char *s, int len, const char *name, int *value_len) {
+    const char *value = NULL;
+    int name_len = strlen(name);
+    int i = 0;
+    int n = 0;
+    
+    /* look through the header lines a handler wrote */
+    while ((value == NULL) && (i < len)) {
+        n = i;
+        while ((n < len) && (s[n] != '\n')) {
+            n++;
+        }
+        if ((n - i > name_len) && (s[i + name_len] == ':') &&
+            (strncasecmp(&s[i], name, name_len) == 0)) {
+            i += name_len + 1;
+            while ((i < n) && (s[i] == ' ')) {
+                i++;
+            }
+            value = &s[i];
+            *value_len = ((n > i) && (s[n - 1] == '\r')) ? (n - 1 - i) : (n - i);
+        }
+        i = n + 1;
+    }
+    
+    return value;
+}
+
+
+int httpsvr_zip_type(const char *value, int len) {
+    int rc = 0;
+    int i = 0;
+    
+    /* text compresses well, images and archives already are compressed */
+    for (i = 0; (rc == 0) && (i < len); i++) {
+        if (((len - i >= 5) && (strncasecmp(&value[i], "text/", 5) == 0)) ||
+            ((len - i >= 4) && (strncasecmp(&value[i], "json", 4) == 0)) ||
+            ((len - i >= 3) && (strncasecmp(&value[i], "xml", 3) == 0)) ||
+            ((len - i >= 10) && (strncasecmp(&value[i], "javascript", 10) == 0))) {
+            rc = 1;
+        }
+    }
+    
+    return rc;
+}
+
+
+void httpsvr_zip_resp(httpsvr_conn_struct *conn) {
+    httpsvr_struct *hss = conn->hss;
+    char *s = NULL;
+    const char *value = NULL;
+    int value_len = 0;
+    int start = conn->resp_length_pos;
+    int header_len = 0;
+    int body_len = 0;
+    int coding = HTTPSVR_ZIP_NONE;
+    int n = -1;
+    
+    if ((hss->deflate_level > 0) &&
+        (conn->resp_status == HTTPSVR_RESP_OK) &&
+        (start >= 0) &&
+        (conn->send_data_len < conn->send_data_max_len)) {
+        s = &conn->send_data[start];
+        header_len = httpsvr_header_end(s, conn->send_data_len - start);
+        body_len = conn->send_data_len - start - header_len;
+        value = httpsvr_zip_header(s, header_len, "Content-Type", &value_len);
+        if ((header_len > 0) &&
+            (body_len >= hss->deflate_min_len) &&
+            (value != NULL) &&
+            httpsvr_zip_type(value, value_len) &&
+            (httpsvr_zip_header(s, header_len, "Content-Encoding", &value_len) == NULL)) {
+            
+            /* prefer gzip, the coding every client gets right */
+            coding = httpsvr_zip_accepts(conn);
+            if (coding & HTTPSVR_ZIP_GZIP) {
+                coding = HTTPSVR_ZIP_GZIP;
+            } else if (coding & HTTPSVR_ZIP_DEFLATE) {
+                coding = HTTPSVR_ZIP_DEFLATE;
+            }
+            if (coding != HTTPSVR_ZIP_NONE) {
+                n = httpsvr_zip_body(hss, coding, &s[header_len], body_len);
+            }
+            
+            /* swap in the compressed body if it is worth it and fits */
+            conn->send_data_len = start + header_len;
+            if ((n > 0) && (n < body_len) &&
+                (conn->send_data_max_len - conn->send_data_len - 64 > n)) {
+                httpsvr_add_header(conn, "Content-Encoding",
+                                   (coding == HTTPSVR_ZIP_GZIP) ? "gzip" : "deflate");
+                httpsvr_add_header(conn, "Vary", "Accept-Encoding");
+                memcpy(&conn->send_data[conn->send_data_len], httpsvr_zip_scratch, n);
+                conn->send_data_len += n;
+            } else {
+                
+                /* left as is, but caches still learn that it varies */
+                conn->send_data_len += body_len;
+                n = sizeof(HTTPSVR_ZIP_VARY) - 1;
+                if (conn->send_data_max_len - conn->send_data_len > n) {
+                    memmove(&s[header_len - 2 + n], &s[header_len - 2], body_len + 2);
+                    memcpy(&s[header_len - 2], HTTPSVR_ZIP_VARY, n);
+                    conn->send_data_len += n;
+                }
+            }
+        }
+    }
+}
+
+
+int httpsvr_set_deflate(httpsvr_handle handle,
+                        int level,
+                        int min_len,
+                        int cache_bytes) {
+    int rc = -1;
+    
+    httpsvr_struct *hss = handle;
+    if (hss != NULL) {
+        httpsvr_zip_cache_destroy(hss->zip_cache);
+        hss->zip_cache       = NULL;
+        hss->deflate_level   = (level > 9) ? 9 : ((level > 0) ? level : 0);
+        hss->deflate_min_len = (min_len > 0) ? min_len : 0;
+        rc = 0;
+#if defined (HTTPSVR_NO_ZLIB)
+        hss->deflate_level   = 0;
+#endif
+        if ((hss->deflate_level > 0) && (cache_bytes > 0)) {
+            hss->zip_cache = httpsvr_zip_cache_create(cache_bytes);
+            if (hss->zip_cache == NULL) {
+                rc = -1;
+            }
+        }
+    }
+    
+    return rc;
+}
+
+
+int httpsvr_set_gzip_static(httpsvr_handle handle,
+                            int enable) {
+    int rc = -1;
+    
+    httpsvr_struct *hss = handle;
+    if (hss != NULL) {
+        hss->gzip_static = enable ? 1 : 0;
+        rc = 0;
+    }
+    
+    return rc;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTPSVR_ZIP_H_
+#define HTTPSVR_ZIP_H_
+
+#include <pthread.h>
+
+#include "httpsvr_internal.h"
+
+
+#define HTTPSVR_ZIP_CACHE_SLOTS     256
+
+/* content codings, as a mask of what a client accepts */
+enum HTTPSVR_ZIP_CODINGS {
+    HTTPSVR_ZIP_NONE            = 0,
+    HTTPSVR_ZIP_GZIP            = 1,
+    HTTPSVR_ZIP_DEFLATE         = 2,
+};
+
+
+/* one compressed handler body, kept with the body it came from */
+typedef struct {
+    unsigned int hash;
+    int     coding;
+    int     raw_len;
+    int     zip_len;
+    char   *data;                   /* raw_len bytes, then zip_len bytes */
+} httpsvr_zip_entry_struct;
+
+struct httpsvr_zip_cache_struct {
+    pthread_mutex_t lock;
+    httpsvr_zip_entry_struct slots[HTTPSVR_ZIP_CACHE_SLOTS];
+    long long bytes;
+    long long max_bytes;
+};
+
+
+httpsvr_zip_cache_struct *httpsvr_zip_cache_create(long long max_bytes);
+
+void httpsvr_zip_cache_destroy(httpsvr_zip_cache_struct *cache);
+
+/* releases the calling thread's deflate streams and scratch buffer,
+   set up again on its next compressed response */
+void httpsvr_zip_thread_end(void);
+
+/* codings the request's Accept-Encoding allows, HTTPSVR_ZIP_* mask */
+int  httpsvr_zip_accepts(httpsvr_conn_struct *conn);
+
+/* compresses the body of a finished handler response in place, when
+   the client, the content type and the size allow it */
+void httpsvr_zip_resp(httpsvr_conn_struct *conn);
+
+#endif  /* HTTPSVR_ZIP_H_ */
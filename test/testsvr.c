@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "httpsvr.h"
 #include "httpsvr_file.h"
@@ -26,6 +28,252 @@ int httpsvr_wildcard_page(const char *path,
 }
 
 
+/* fills the whole send buffer, too large to answer */
+int httpsvr_huge_page(const char *path,
+                      const char *parameters,
+                      char *buffer,
+                      int buffer_len) {
+    int len = 0;
+    
+    len = httpsvr_append_content_type(buffer, buffer_len, "text/plain");
+    memset(&buffer[len], 'x', buffer_len - len);
+    
+    return buffer_len;
+}
+
+
+int httpsvr_count_stream(const char *path,
+                         const char *parameters,
+                         void **context,
+                         char *buffer,
+                         int buffer_len) {
+    int len = 0;
+    int n = 0;
+    int *count = *context;
+    
+    if (buffer == NULL) {
+        free(count);  /* end of stream */
+        
+    } else {
+        if (count == NULL) {
+            count = calloc(1, sizeof(int));
+            *context = count;
+        }
+        
+        /* one line per number, as many as fit */
+        while ((count != NULL) && (*count < 100000) && (buffer_len - len > 16)) {
+            n = sprintf(&buffer[len], "%d\n", ++(*count));
+            len += n;
+        }
+    }
+    
+    return len;
+}
+
+
+int httpsvr_params_route(const char *path,
+                         const char *parameters,
+                         const httpsvr_route_param *params,
+                         int num_params,
+                         char *buffer,
+                         int buffer_len) {
+    int len = 0;
+    int i = 0;
+    
+    len += httpsvr_append_content_type(&buffer[len], buffer_len - len, "text/plain");
+    for (i = 0; (i < num_params) && (buffer_len - len > 0); i++) {
+        len += snprintf(&buffer[len], buffer_len - len, "%.*s=%.*s\n",
+                        params[i].name_len, params[i].name,
+                        params[i].value_len, params[i].value);
+    }
+    
+    return len;
+}
+
+
+int httpsvr_headers_route(const char *path,
+                          const char *parameters,
+                          const httpsvr_route_param *params,
+                          int num_params,
+                          char *buffer,
+                          int buffer_len) {
+    int len = 0;
+    int i = 0;
+    int name_len = 0;
+    int value_len = 0;
+    const char *name = NULL;
+    const char *value = NULL;
+    
+    len += httpsvr_append_content_type(&buffer[len], buffer_len - len, "text/plain");
+    len += snprintf(&buffer[len], buffer_len - len, "%s\n", httpsvr_get_method());
+    for (i = 0; i < httpsvr_get_num_headers(); i++) {
+        value = httpsvr_get_header_at(i, &name, &name_len, &value_len);
+        if (len < buffer_len) {
+            len += snprintf(&buffer[len], buffer_len - len, "%.*s: %.*s\n",
+                            name_len, name, value_len, value);
+        }
+    }
+    
+    return len;
+}
+
+
+int httpsvr_body_route(const char *path,
+                       const char *parameters,
+                       const httpsvr_route_param *params,
+                       int num_params,
+                       char *buffer,
+                       int buffer_len) {
+    int len = 0;
+    int body_len = 0;
+    const char *body = httpsvr_get_body(&body_len);
+    
+    len += httpsvr_append_content_type(&buffer[len], buffer_len - len, "text/plain");
+    len += snprintf(&buffer[len], buffer_len - len, "%d bytes: %.*s\n",
+                    body_len, (body_len < 64) ? body_len : 64, (body != NULL) ? body : "");
+    
+    return len;
+}
+
+
+int httpsvr_ingest_upload(const char *page_name,
+                          const char *parameters,
+                          void **context,
+                          const char *data,
+                          int data_len,
+                          char *buffer,
+                          int buffer_len) {
+    int len = 0;
+    long long *total = *context;
+    
+    if (data != NULL) {
+        if (total == NULL) {
+            total = calloc(1, sizeof(long long));
+            *context = total;
+        }
+        if (total != NULL) {
+            *total += data_len;
+        }
+    } else if (buffer != NULL) {
+        len += httpsvr_append_content_type(&buffer[len], buffer_len - len, "text/plain");
+        len += snprintf(&buffer[len], buffer_len - len, "ingested %lld bytes\n",
+                        (total != NULL) ? *total : 0);
+        free(total);
+    } else {
+        free(total);  /* request dropped */
+    }
+    
+    return len;
+}
+
+
+/* keeps the start of an in-process response for the checks */
+int httpsvr_check_sink(void *context, const char *data, int data_len) {
+    char *resp = context;
+    int len = strlen(resp);
+    int n = (data_len < 4095 - len) ? data_len : 4095 - len;
+    
+    memcpy(&resp[len], data, n);
+    resp[len + n] = '\0';
+    return data_len;
+}
+
+
+int httpsvr_check(const char *name, int ok) {
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+
+/* answer request in process, its response starts resp */
+void httpsvr_check_request(httpsvr_handle handle, const char *request, char *resp) {
+    resp[0] = '\0';
+    httpsvr_process(handle, request, strlen(request), httpsvr_check_sink, resp);
+}
+
+
+int httpsvr_check_log(httpsvr_handle handle) {
+    char resp[4096];
+    char log[4096];
+    FILE *fp = tmpfile();
+    int n = 0;
+    
+    /* a page request is logged with its path as requested */
+    if (fp != NULL) {
+        httpsvr_set_log(handle, HTTPSVR_LOG_INFO, fileno(fp));
+        httpsvr_check_request(handle, "GET /wildcard HTTP/1.1\r\nHost: localhost\r\n\r\n", resp);
+        httpsvr_set_log(handle, HTTPSVR_LOG_OFF, -1);
+        rewind(fp);
+        n = fread(log, 1, sizeof(log) - 1, fp);
+        log[n] = '\0';
+        fclose(fp);
+    }
+    
+    return httpsvr_check("page request logged with its path",
+                         strstr(log, "path=\"/wildcard\"") != NULL);
+}
+
+
+int httpsvr_check_large_headers(httpsvr_handle handle) {
+    char request[4096];
+    char resp[4096];
+    int n = 0;
+    
+    /* headers past the receive buffer are refused, and what follows
+       them is never taken as a request */
+    n = sprintf(request, "GET /wildcard HTTP/1.1\r\nHost: localhost\r\nX-Padding: ");
+    memset(&request[n], 'x', 2000);
+    n += 2000;
+    sprintf(&request[n], "\r\nContent-Length: 0\r\n\r\nGET /wildcard HTTP/1.1\r\n\r\n");
+    httpsvr_check_request(handle, request, resp);
+    
+    return httpsvr_check("oversized headers answered with 431",
+                         (strncmp(resp, "HTTP/1.1 431 ", 13) == 0) &&
+                         (strstr(resp, "Connection: close\r\n") != NULL) &&
+                         (strstr(&resp[13], "HTTP/1.1 ") == NULL));
+}
+
+
+int httpsvr_check_overflow(httpsvr_handle handle) {
+    char resp[4096];
+    const char *second = NULL;
+    const char *third = NULL;
+    int failed = 0;
+    
+    /* output filling the send buffer is answered with 500 on its own */
+    httpsvr_check_request(handle, "GET /huge HTTP/1.1\r\nHost: localhost\r\n\r\n", resp);
+    failed += httpsvr_check("overflowing handler answered with 500",
+                            strncmp(resp, "HTTP/1.1 500 ", 13) == 0);
+    
+    /* and behind another response, without holding up the next one */
+    httpsvr_check_request(handle,
+                          "GET /wildcard HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                          "GET /huge HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                          "GET /wildcard HTTP/1.1\r\nHost: localhost\r\n\r\n", resp);
+    second = strstr(&resp[13], "HTTP/1.1 ");
+    third = (second != NULL) ? strstr(&second[13], "HTTP/1.1 ") : NULL;
+    failed += httpsvr_check("pipelined overflowing handler gets 500",
+                            (strncmp(resp, "HTTP/1.1 200 ", 13) == 0) &&
+                            (second != NULL) && (strncmp(second, "HTTP/1.1 500 ", 13) == 0) &&
+                            (third != NULL) && (strncmp(third, "HTTP/1.1 200 ", 13) == 0));
+    
+    return failed;
+}
+
+
+/* in-process checks of what the server answers, run by make check */
+int httpsvr_run_checks(httpsvr_handle handle) {
+    int failed = 0;
+    
+    failed += httpsvr_check_log(handle);
+    failed += httpsvr_check_large_headers(handle);
+    failed += httpsvr_check_overflow(handle);
+    printf("%d checks failed\n", failed);
+    
+    return failed;
+}
+
+
 int main (int argc, const char * argv[]) {
     unsigned short port     = 18080;
     int recv_buffer_len     = 1024;
@@ -33,6 +281,8 @@ int main (int argc, const char * argv[]) {
     int file_path_len       = recv_buffer_len;
     int num_file_handlers   = 32;
     int num_page_handlers   = 32;
+    int max_connections     = 1024;
+    int num_workers         = 1;
     httpsvr_handle handle   = NULL;
     handle = httpsvr_init(port,
                           recv_buffer_len,
@@ -43,6 +293,16 @@ int main (int argc, const char * argv[]) {
     if (handle == NULL) {
         fprintf(stderr, "Failed to start httpsvr on port %hu\n", port);
     } else {
+        httpsvr_set_log(handle, HTTPSVR_LOG_INFO, fileno(stdout));
+        httpsvr_set_file_cache(handle, 4 * 1024 * 1024, 256 * 1024);
+        httpsvr_set_file_map(handle, 1);
+        httpsvr_set_max_body(handle, 64 * 1024 * 1024, 64 * 1024);
+        httpsvr_set_gzip_static(handle, 1);
+        httpsvr_set_deflate(handle, 6, 256, 1024 * 1024);
+        if ((argc > 2) && (httpsvr_set_bundle(handle, argv[2]) != 0)) {
+            fprintf(stderr, "Failed to load bundle %s\n", argv[2]);
+        }
+
         httpsvr_add_file_handler(handle, "html", httpsvr_html_file_handler);
         httpsvr_add_file_handler(handle, "htm",  httpsvr_html_file_handler);
         httpsvr_add_file_handler(handle, "css",  httpsvr_css_file_handler);
@@ -55,12 +315,37 @@ int main (int argc, const char * argv[]) {
         httpsvr_add_file_handler(handle, "*",    httpsvr_html_file_handler);
 
         httpsvr_add_page_handler(handle, "/",    httpsvr_redirect_to_index_html);
+        httpsvr_add_stream_handler(handle, "count", "text/plain", httpsvr_count_stream);
+        httpsvr_add_stream_handler(handle, "metrics", "text/plain; version=0.0.4",
+                                   httpsvr_metrics_stream);
+        httpsvr_add_upload_handler(handle, "ingest", httpsvr_ingest_upload);
+        httpsvr_add_page_handler(handle, "huge", httpsvr_huge_page);
         httpsvr_add_page_handler(handle, "*",    httpsvr_wildcard_page);
 
+        httpsvr_add_route(handle, "GET",  "/api/users/:id",       httpsvr_params_route);
+        httpsvr_add_route(handle, "GET",  "/api/users/:id/:item", httpsvr_params_route);
+        httpsvr_add_route(handle, NULL,   "/api/*",               httpsvr_params_route);
+        httpsvr_add_route(handle, NULL,   "/headers",             httpsvr_headers_route);
+        httpsvr_add_route(handle, "POST", "/body",                httpsvr_body_route);
+
+        if ((argc > 1) && (strcmp(argv[1], "check") == 0)) {
+            return (httpsvr_run_checks(handle) == 0) ? 0 : 1;
+        }
+        
         printf("%s\n", HTTPSVR_USER_AGENT);
         printf("Listening on port %hu\n", port);
-        while (1) {
-            httpsvr_receive(handle);
+        if (argc > 1) {
+            num_workers = atoi(argv[1]);
+        }
+        if (((num_workers > 1) &&
+             (httpsvr_run_workers(handle, num_workers, max_connections) != 0)) ||
+            ((num_workers <= 1) &&
+             (httpsvr_run_event_loop(handle, max_connections) != 0))) {
+            
+            /* fall back to serving one connection at a time */
+            while (1) {
+                httpsvr_receive(handle);
+            }
         }
     }
     
@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2011, Jim Hollinger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Jim Hollinger nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "httpsvr.h"
+#include "httpsvr_file.h"
+#include "httpsvr_internal.h"
+#include "httpsvr_bundle.h"
+
+
+#define MKBUNDLE_MAX_PATH           1024
+#define MKBUNDLE_MAX_HEAD           1024
+#define MKBUNDLE_MAX_TRIES          (1 << 20)   /* seeds tried per bucket */
+
+
+/* content types come from the library's own file handlers */
+const struct {
+    const char *ext;
+    httpsvr_file_handler handler;
+} mkbundle_types[] = {
+    { "html", httpsvr_html_file_handler },
+    { "htm",  httpsvr_html_file_handler },
+    { "css",  httpsvr_css_file_handler },
+    { "csv",  httpsvr_csv_file_handler },
+    { "txt",  httpsvr_plain_file_handler },
+    { "text", httpsvr_plain_file_handler },
+    { "xml",  httpsvr_xml_file_handler },
+    { "ico",  httpsvr_html_file_handler },
+    { "gif",  httpsvr_gif_file_handler },
+    { "jpg",  httpsvr_jpeg_file_handler },
+    { "jpeg", httpsvr_jpeg_file_handler },
+    { "png",  httpsvr_png_file_handler },
+    { "svg",  httpsvr_svg_file_handler },
+    { "tif",  httpsvr_tiff_file_handler },
+    { "tiff", httpsvr_tiff_file_handler },
+};
+
+typedef struct {
+    char   *path;                   /* request path, from '/' */
+    char   *data;
+    long long size;
+    long long mtime;
+    long long ino;
+    char    head[MKBUNDLE_MAX_HEAD];
+    int     head_len;
+    char   *gzip;
+    long long gzip_size;
+    char    gzip_head[MKBUNDLE_MAX_HEAD];
+    int     gzip_head_len;
+    httpsvr_bundle_asset record;
+} mkbundle_file;
+
+mkbundle_file *mkbundle_files = NULL;
+int mkbundle_num_files = 0;
+int mkbundle_max_files = 0;
+int mkbundle_zip = 0;
+
+
+char *mkbundle_read(const char *path, long long size) {
+    FILE *fp = fopen(path, "rb");
+    char *data = malloc((size > 0) ? size : 1);
+    
+    if ((fp == NULL) || (data == NULL) ||
+        ((long long) fread(data, 1, size, fp) != size)) {
+        free(data);
+        data = NULL;
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    
+    return data;
+}
+
+
+/* gzip of the body, kept only when it saves at least an eighth */
+void mkbundle_gzip(mkbundle_file *file) {
+    z_stream zs;
+    uLong max_len = 0;
+    
+    memset(&zs, 0, sizeof(zs));
+    if ((file->size > 64) &&
+        (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 31, 9, Z_DEFAULT_STRATEGY) == Z_OK)) {
+        max_len = deflateBound(&zs, file->size);
+        file->gzip = malloc(max_len);
+        if (file->gzip != NULL) {
+            zs.next_in   = (Bytef *) file->data;
+            zs.avail_in  = file->size;
+            zs.next_out  = (Bytef *) file->gzip;
+            zs.avail_out = max_len;
+            if ((deflate(&zs, Z_FINISH) == Z_STREAM_END) &&
+                (zs.total_out < file->size - file->size / 8)) {
+                file->gzip_size = zs.total_out;
+            } else {
+                free(file->gzip);
+                file->gzip = NULL;
+            }
+        }
+        deflateEnd(&zs);
+    }
+}
+
+
+/* Content-Length, Content-Type, validators and coding, then the blank line */
+int mkbundle_head(char *head, const mkbundle_file *file, const char *file_path,
+                  long long size, const char *etag, int gzip) {
+    char type[256];
+    char date[40];
+    const char *ext = strrchr(file->path, '.');
+    int len = 0;
+    int i = 0;
+    
+    strcpy(type, "Content-Type: application/octet-stream\r\n");
+    for (i = 0; (ext != NULL) && (i < (int) (sizeof(mkbundle_types) / sizeof(mkbundle_types[0]))); i++) {
+        if (strcasecmp(ext + 1, mkbundle_types[i].ext) == 0) {
+            mkbundle_types[i].handler(file_path, NULL, type, sizeof(type));
+            if (strstr(type, "\r\n") != NULL) {
+                strstr(type, "\r\n")[2] = '\0';
+            }
+            break;
+        }
+    }
+    httpsvr_format_date(date, sizeof(date), file->mtime);
+    len = snprintf(head, MKBUNDLE_MAX_HEAD,
+                   "Content-Length: %lld\r\n"
+                   "%s"
+                   "ETag: %s\r\n"
+                   "Last-Modified: %s\r\n"
+                   "%s%s"
+                   "\r\n",
+                   size, type, etag, date,
+                   gzip ? "Content-Encoding: gzip\r\n" : "",
+                   (file->gzip != NULL) ? "Vary: Accept-Encoding\r\n" : "");
+    
+    return (len < MKBUNDLE_MAX_HEAD) ? len : -1;
+}
+
+
+int mkbundle_add(const char *file_path, const char *path, const struct stat *st) {
+    mkbundle_file *file = NULL;
+    int rc = -1;
+    
+    if (mkbundle_num_files == mkbundle_max_files) {
+        mkbundle_max_files = (mkbundle_max_files > 0) ? 2 * mkbundle_max_files : 64;
+        mkbundle_files = realloc(mkbundle_files, mkbundle_max_files * sizeof(mkbundle_file));
+    }
+    if (mkbundle_files != NULL) {
+        file = &mkbundle_files[mkbundle_num_files];
+        memset(file, 0, sizeof(mkbundle_file));
+        file->path  = strdup(path);
+        file->size  = st->st_size;
+        file->mtime = st->st_mtime;
+        file->ino   = st->st_ino;
+        file->data  = mkbundle_read(file_path, file->size);
+        if ((file->path != NULL) && (file->data != NULL)) {
+            if (mkbundle_zip) {
+                mkbundle_gzip(file);
+            }
+            httpsvr_format_etag(file->record.etag, file->size, file->mtime, file->ino);
+            file->head_len = mkbundle_head(file->head, file, file_path, file->size,
+                                           file->record.etag, 0);
+            if (file->gzip != NULL) {
+                httpsvr_format_etag(file->record.gzip_etag, file->gzip_size,
+                                    file->mtime, file->ino);
+                file->gzip_head_len = mkbundle_head(file->gzip_head, file, file_path,
+                                                    file->gzip_size, file->record.gzip_etag, 1);
+            }
+            if ((file->head_len > 0) && (file->gzip_head_len >= 0)) {
+                mkbundle_num_files++;
+                rc = 0;
+            }
+        }
+        if (rc != 0) {
+            fprintf(stderr, "mkbundle: cannot read %s\n", file_path);
+        }
+    }
+    
+    return rc;
+}
+
+
+/* every regular file under dir, skipping dot files */
+int mkbundle_walk(const char *dir, const char *prefix) {
+    char file_path[MKBUNDLE_MAX_PATH];
+    char path[MKBUNDLE_MAX_PATH];
+    struct dirent *de = NULL;
+    struct stat st;
+    DIR *d = opendir(dir);
+    int rc = (d != NULL) ? 0 : -1;
+    
+    while ((rc == 0) && ((de = readdir(d)) != NULL)) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        if ((snprintf(file_path, sizeof(file_path), "%s/%s", dir, de->d_name) >= (int) sizeof(file_path)) ||
+            (snprintf(path, sizeof(path), "%s/%s", prefix, de->d_name) >= (int) sizeof(path)) ||
+            (stat(file_path, &st) != 0)) {
+            rc = -1;
+        } else if (S_ISDIR(st.st_mode)) {
+            rc = mkbundle_walk(file_path, path);
+        } else if (S_ISREG(st.st_mode)) {
+            rc = mkbundle_add(file_path, path, &st);
+        }
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    
+    return rc;
+}
+
+
+uint32_t mkbundle_pow2(uint32_t n) {
+    uint32_t p = 1;
+    
+    while (p < n) {
+        p *= 2;
+    }
+    
+    return p;
+}
+
+
+/* hash and displace: paths are spread over buckets, and each bucket,
+   fullest first, gets the first seed placing all its paths in free
+   slots; 0 if some bucket found none */
+int mkbundle_hash(uint32_t *buckets, uint32_t num_buckets,
+                  uint32_t *slots, uint32_t num_slots) {
+    uint32_t *order = malloc(mkbundle_num_files * sizeof(uint32_t));
+    uint32_t *bucket_of = malloc(mkbundle_num_files * sizeof(uint32_t));
+    uint32_t *taken = malloc(mkbundle_num_files * sizeof(uint32_t));
+    uint32_t *sizes = calloc(num_buckets, sizeof(uint32_t));
+    uint32_t seed = 0;
+    uint32_t slot = 0;
+    uint32_t t = 0;
+    int rc = (order != NULL) && (bucket_of != NULL) && (taken != NULL) && (sizes != NULL);
+    int start = 0;
+    int end = 0;
+    int num = 0;
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    
+    for (i = 0; rc && (i < mkbundle_num_files); i++) {
+        bucket_of[i] = httpsvr_bundle_hash(mkbundle_files[i].path,
+                                           strlen(mkbundle_files[i].path), 0) & (num_buckets - 1);
+        sizes[bucket_of[i]]++;
+        order[i] = i;
+    }
+    
+    /* files of the fullest buckets first, a bucket's files together */
+    for (i = 1; rc && (i < mkbundle_num_files); i++) {
+        t = order[i];
+        for (j = i; (j > 0) &&
+             ((sizes[bucket_of[order[j - 1]]] < sizes[bucket_of[t]]) ||
+              ((sizes[bucket_of[order[j - 1]]] == sizes[bucket_of[t]]) &&
+               (bucket_of[order[j - 1]] > bucket_of[t]))); j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = t;
+    }
+    for (i = 0; i < (int) num_slots; i++) {
+        slots[i] = HTTPSVR_BUNDLE_EMPTY;
+    }
+    for (i = 0; i < (int) num_buckets; i++) {
+        buckets[i] = 0;
+    }
+    
+    for (start = 0; rc && (start < mkbundle_num_files); start = end) {
+        for (end = start; (end < mkbundle_num_files) &&
+             (bucket_of[order[end]] == bucket_of[order[start]]); end++) {
+        }
+        for (seed = 1; seed < MKBUNDLE_MAX_TRIES; seed++) {
+            num = 0;
+            for (k = start; k < end; k++) {
+                slot = httpsvr_bundle_hash(mkbundle_files[order[k]].path,
+                                           strlen(mkbundle_files[order[k]].path),
+                                           seed) & (num_slots - 1);
+                for (j = 0; (j < num) && (taken[j] != slot); j++) {
+                }
+                if ((slots[slot] != HTTPSVR_BUNDLE_EMPTY) || (j < num)) {
+                    break;
+                }
+                taken[num++] = slot;
+            }
+            if (k == end) {
+                break;
+            }
+        }
+        if (seed == MKBUNDLE_MAX_TRIES) {
+            rc = 0;
+        } else {
+            buckets[bucket_of[order[start]]] = seed;
+            for (k = start; k < end; k++) {
+                slots[taken[k - start]] = order[k];
+            }
+        }
+    }
+    free(order);
+    free(bucket_of);
+    free(taken);
+    free(sizes);
+    
+    return rc;
+}
+
+
+int mkbundle_write(const char *out_path) {
+    httpsvr_bundle_head head;
+    uint32_t *buckets = NULL;
+    uint32_t *slots = NULL;
+    uint64_t off = 0;
+    FILE *fp = NULL;
+    int rc = -1;
+    int ok = 1;
+    int i = 0;
+    
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, HTTPSVR_BUNDLE_MAGIC, sizeof(head.magic));
+    head.version     = HTTPSVR_BUNDLE_VERSION;
+    head.byte_order  = HTTPSVR_BUNDLE_BYTE_ORDER;
+    head.num_assets  = mkbundle_num_files;
+    head.num_buckets = mkbundle_pow2((mkbundle_num_files + 1) / 2);
+    head.num_slots   = mkbundle_pow2(mkbundle_num_files + mkbundle_num_files / 4 + 1);
+    
+    /* a bigger table whenever some bucket cannot be placed */
+    do {
+        free(buckets);
+        free(slots);
+        buckets = malloc(head.num_buckets * sizeof(uint32_t));
+        slots = malloc(head.num_slots * sizeof(uint32_t));
+        if ((buckets == NULL) || (slots == NULL)) {
+            ok = 0;
+            break;
+        }
+        if (!mkbundle_hash(buckets, head.num_buckets, slots, head.num_slots)) {
+            head.num_slots *= 2;
+            continue;
+        }
+        break;
+    } while (1);
+    
+    /* lay out the tables, records, then each file's paths and responses */
+    off = sizeof(head);
+    head.buckets_off = off;
+    off += head.num_buckets * sizeof(uint32_t);
+    head.slots_off = off;
+    off += head.num_slots * sizeof(uint32_t);
+    off = (off + 7) & ~7ull;
+    head.assets_off = off;
+    off += mkbundle_num_files * sizeof(httpsvr_bundle_asset);
+    for (i = 0; i < mkbundle_num_files; i++) {
+        mkbundle_file *file = &mkbundle_files[i];
+        file->record.path_len  = strlen(file->path);
+        file->record.path_off  = off;
+        off += file->record.path_len + 1;
+        file->record.head_len  = file->head_len;
+        file->record.body_len  = file->size;
+        file->record.resp_off  = off;
+        off += file->head_len + file->size;
+        file->record.mtime     = file->mtime;
+        if (file->gzip != NULL) {
+            file->record.gzip_head_len = file->gzip_head_len;
+            file->record.gzip_body_len = file->gzip_size;
+            file->record.gzip_off      = off;
+            off += file->gzip_head_len + file->gzip_size;
+        }
+    }
+    head.len = off;
+    
+    fp = ok ? fopen(out_path, "wb") : NULL;
+    if (fp != NULL) {
+        ok = (fwrite(&head, sizeof(head), 1, fp) == 1) &&
+             (fwrite(buckets, sizeof(uint32_t), head.num_buckets, fp) == head.num_buckets) &&
+             (fwrite(slots, sizeof(uint32_t), head.num_slots, fp) == head.num_slots);
+        off = sizeof(head) + (head.num_buckets + head.num_slots) * sizeof(uint32_t);
+        while (ok && (off < head.assets_off)) {
+            ok = (fputc(0, fp) != EOF);
+            off++;
+        }
+        for (i = 0; ok && (i < mkbundle_num_files); i++) {
+            ok = (fwrite(&mkbundle_files[i].record, sizeof(httpsvr_bundle_asset), 1, fp) == 1);
+        }
+        for (i = 0; ok && (i < mkbundle_num_files); i++) {
+            mkbundle_file *file = &mkbundle_files[i];
+            ok = (fwrite(file->path, 1, file->record.path_len + 1, fp) == file->record.path_len + 1) &&
+                 (fwrite(file->head, 1, file->head_len, fp) == file->head_len) &&
+                 (fwrite(file->data, 1, file->size, fp) == file->size);
+            if (ok && (file->gzip != NULL)) {
+                ok = (fwrite(file->gzip_head, 1, file->gzip_head_len, fp) == file->gzip_head_len) &&
+                     (fwrite(file->gzip, 1, file->gzip_size, fp) == file->gzip_size);
+            }
+        }
+        if ((fclose(fp) == 0) && ok) {
+            rc = 0;
+        }
+    }
+    free(buckets);
+    free(slots);
+    
+    return rc;
+}
+
+
+void mkbundle_usage(void) {
+    printf("usage: mkbundle [-z] -o bundle dir\n"
+           "  -o bundle    file to write, served with httpsvr_set_bundle\n"
+           "  -z           add gzip variants of files it shrinks by an eighth\n"
+           "every file under dir is served as its path below dir\n");
+}
+
+
+int main(int argc, const char *argv[]) {
+    const char *out_path = NULL;
+    const char *dir = NULL;
+    long long bytes = 0;
+    int num_gzip = 0;
+    int i = 0;
+    
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-z") == 0) {
+            mkbundle_zip = 1;
+        } else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+            out_path = argv[++i];
+        } else if ((argv[i][0] != '-') && (dir == NULL)) {
+            dir = argv[i];
+        } else {
+            mkbundle_usage();
+            return 1;
+        }
+    }
+    if ((out_path == NULL) || (dir == NULL)) {
+        mkbundle_usage();
+        return 1;
+    }
+    
+    if (mkbundle_walk(dir, "") != 0) {
+        fprintf(stderr, "mkbundle: cannot read %s\n", dir);
+        return 1;
+    }
+    if (mkbundle_write(out_path) != 0) {
+        fprintf(stderr, "mkbundle: cannot write %s\n", out_path);
+        return 1;
+    }
+    for (i = 0; i < mkbundle_num_files; i++) {
+        bytes += mkbundle_files[i].size;
+        num_gzip += (mkbundle_files[i].gzip != NULL);
+    }
+    printf("%s: %d files, %lld bytes, %d gzip variants\n", out_path, mkbundle_num_files,
+           bytes, num_gzip);
+    
+    return 0;
+}